@@ -0,0 +1,145 @@
+#include "ynicc.h"
+
+// コンパイルのフェーズ(トークン、構文木、型、コード生成)ごとのメモリアリーナ
+//
+// Token や Node を1個ずつcallocするとmallocのコストがかかる上にfreeもされずにリークしていたので、
+// 大きめのchunkを確保してその中から順番に切り出して(bump allocate)使う。
+// 切り出したオブジェクトは個別にはfreeせず、フェーズが終わった時点で arena_release でアリーナごとまとめて解放する。
+
+enum {
+  // 1個のchunkのサイズ
+  ARENA_CHUNK_SIZE = 1 << 20,
+  // これより大きいオブジェクトは専用のchunkを確保する
+  ARENA_LARGE_OBJECT_SIZE = 1 << 16,
+};
+
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+  ArenaChunk *next;
+  char *buf;
+  long capacity; // bufのサイズ
+  long used;     // bufのうち切り出し済みのバイト数
+};
+
+typedef struct Arena Arena;
+struct Arena {
+  ArenaChunk *chunks; // 先頭が今切り出し中のchunk
+
+  // 以下は --arena-stats 用の統計情報
+  long objects;       // 割り当てたオブジェクト数(累計)
+  long bytes;         // 割り当てたバイト数(累計)
+  long reserved;      // 今chunkとして確保しているバイト数
+  long peak_reserved; // reservedの最大値
+  int releases;       // arena_releaseされた回数
+};
+
+static Arena arenas[ARENA_NUM];
+
+static char *arena_names[] = {
+  "token",
+  "ast",
+  "type",
+  "codegen",
+  "ident",
+};
+
+static ArenaChunk *new_chunk(Arena *a, long size) {
+  ArenaChunk *c = calloc(1, sizeof(ArenaChunk));
+  c->buf = calloc(1, size);
+  if (!c->buf) {
+    error("arena: メモリを確保できません(%ld bytes)", size);
+  }
+  c->capacity = size;
+
+  a->reserved += size;
+  if (a->peak_reserved < a->reserved) {
+    a->peak_reserved = a->reserved;
+  }
+  return c;
+}
+
+// kind のアリーナからゼロクリアされた size バイトの領域を確保する(callocの代わり)
+void *arena_alloc(ArenaKind kind, long size) {
+  Arena *a = &arenas[kind];
+
+  // 構造体のアラインメント(最大でlongやポインタの8バイト)に合わせる
+  size = (size + 7) / 8 * 8;
+
+  a->objects++;
+  a->bytes += size;
+
+  if (size > ARENA_LARGE_OBJECT_SIZE) {
+    // 大きいオブジェクトは専用のchunkにして、今切り出し中のchunkの残りを無駄にしないように2番目につなぐ
+    ArenaChunk *c = new_chunk(a, size);
+    c->used = size;
+    if (a->chunks) {
+      c->next = a->chunks->next;
+      a->chunks->next = c;
+    } else {
+      a->chunks = c;
+    }
+    return c->buf;
+  }
+
+  ArenaChunk *c = a->chunks;
+  if (!c || c->used + size > c->capacity) {
+    c = new_chunk(a, ARENA_CHUNK_SIZE);
+    c->next = a->chunks;
+    a->chunks = c;
+  }
+
+  char *p = c->buf + c->used;
+  c->used += size;
+  return p;
+}
+
+// kind のアリーナから確保したオブジェクトをまとめて解放する
+void arena_release(ArenaKind kind) {
+  Arena *a = &arenas[kind];
+
+  ArenaChunk *c = a->chunks;
+  while (c) {
+    ArenaChunk *next = c->next;
+    free(c->buf);
+    free(c);
+    c = next;
+  }
+  a->chunks = NULL;
+  a->reserved = 0;
+  a->releases++;
+}
+
+// kind のアリーナから確保したオブジェクトをまとめて捨てるが、今切り出し中のchunkは次の確保のために残しておく
+// (何度も確保と解放を繰り返すアリーナで、毎回chunkを確保し直さないようにする)
+void arena_reset(ArenaKind kind) {
+  Arena *a = &arenas[kind];
+
+  ArenaChunk *keep = a->chunks;
+  if (!keep || keep->capacity != ARENA_CHUNK_SIZE) {
+    arena_release(kind);
+    return;
+  }
+
+  ArenaChunk *c = keep->next;
+  while (c) {
+    ArenaChunk *next = c->next;
+    a->reserved -= c->capacity;
+    free(c->buf);
+    free(c);
+    c = next;
+  }
+  // 次に切り出す時にゼロクリアされているように、使った部分だけクリアしておく
+  memset(keep->buf, 0, keep->used);
+  keep->used = 0;
+  keep->next = NULL;
+  a->releases++;
+}
+
+void arena_dump_stats(void) {
+  fprintf(stderr, "## arena stats\n");
+  fprintf(stderr, "## %-8s %10s %12s %14s %8s\n", "arena", "objects", "bytes", "peak-reserved", "releases");
+  for (int i = 0; i < ARENA_NUM; i++) {
+    Arena *a = &arenas[i];
+    fprintf(stderr, "## %-8s %10ld %12ld %14ld %8d\n", arena_names[i], a->objects, a->bytes, a->peak_reserved, a->releases);
+  }
+}
@@ -0,0 +1,135 @@
+#!/bin/bash
+# ベンチマーク用のCのソースを生成して標準出力に書く(同じ引数なら常に同じ内容になる)
+#
+# usage: bench/gen_input.sh <形> [規模]
+#
+#   funcs    小さな関数がたくさん
+#   expr     深く入れ子になった式
+#   struct   メンバの多い構造体とそのメンバへのアクセス
+#   init     大きな配列の初期化式
+#   globals  グローバル変数がたくさん
+#   switch   case の多い switch 文
+#
+# 規模(デフォルト1)に比例して大きくなる。規模1で expr は2600行、それ以外は1万行前後になる。
+set -e
+
+SHAPE=$1
+SCALE=${2:-1}
+
+case $SHAPE in
+  funcs)
+    awk -v n=$((SCALE * 1000)) 'BEGIN {
+      for (f = 0; f < n; f++) {
+        printf("int func_%d(int a, int b) {\n", f);
+        printf("  int x = a * %d + b;\n", f);
+        printf("  if (x > %d)\n", f * 3);
+        printf("    x = x - b;\n");
+        printf("  for (int i = 0; i < a; i++)\n");
+        printf("    x += i;\n");
+        printf("  return x;\n");
+        printf("}\n");
+        printf("\n");
+      }
+    }'
+    ;;
+  expr)
+    # 1文ごとに括弧が40段入れ子になった式
+    awk -v n=$((SCALE * 25)) 'BEGIN {
+      for (f = 0; f < n; f++) {
+        printf("int expr_%d(int a, int b) {\n", f);
+        printf("  int x = 0;\n");
+        for (s = 0; s < 100; s++) {
+          printf("  x = ");
+          for (d = 0; d < 40; d++) {
+            printf("(a + ");
+          }
+          printf("b");
+          for (d = 0; d < 40; d++) {
+            printf(" * %d)", d + s);
+          }
+          printf(" - x;\n");
+        }
+        printf("  return x;\n");
+        printf("}\n");
+      }
+    }'
+    ;;
+  struct)
+    # 200メンバの構造体と、全メンバを読み書きする関数
+    awk -v n=$((SCALE * 16)) 'BEGIN {
+      for (t = 0; t < n; t++) {
+        printf("struct S%d {\n", t);
+        for (m = 0; m < 200; m++) {
+          printf("  %s m%d;\n", (m % 3 == 0) ? "char" : (m % 3 == 1) ? "int" : "long", m);
+        }
+        printf("};\n");
+        printf("long use_s%d(struct S%d *p) {\n", t, t);
+        printf("  long sum = 0;\n");
+        for (m = 0; m < 200; m++) {
+          printf("  p->m%d = %d;\n", m, m);
+          printf("  sum = sum + p->m%d;\n", m);
+        }
+        printf("  return sum;\n");
+        printf("}\n");
+      }
+    }'
+    ;;
+  init)
+    # 1行に10要素ずつ並べた大きな配列の初期化式
+    awk -v n=$((SCALE * 10)) 'BEGIN {
+      for (a = 0; a < n; a++) {
+        printf("int table_%d[] = {\n", a);
+        for (l = 0; l < 1000; l++) {
+          printf(" ");
+          for (e = 0; e < 10; e++) {
+            printf(" %d,", (a * 7919 + l * 104729 + e * 13) % 1000003);
+          }
+          printf("\n");
+        }
+        printf("};\n");
+      }
+    }'
+    ;;
+  globals)
+    awk -v n=$((SCALE * 10000)) 'BEGIN {
+      for (g = 0; g < n; g++) {
+        if (g % 2 == 0) {
+          printf("int global_%d = %d;\n", g, g);
+        } else {
+          printf("long global_%d;\n", g);
+        }
+      }
+      printf("long sum_globals() {\n");
+      printf("  long sum = 0;\n");
+      for (g = 0; g < n; g = g + 97) {
+        printf("  sum = sum + global_%d;\n", g);
+      }
+      printf("  return sum;\n");
+      printf("}\n");
+    }'
+    ;;
+  switch)
+    # 1関数あたり1000個の case がある switch 文
+    awk -v n=$((SCALE * 3)) 'BEGIN {
+      for (f = 0; f < n; f++) {
+        printf("int switch_%d(int x) {\n", f);
+        printf("  int r = 0;\n");
+        printf("  switch (x) {\n");
+        for (c = 0; c < 1000; c++) {
+          printf("  case %d:\n", c * 3 + f);
+          printf("    r = x * %d;\n", c);
+          printf("    break;\n");
+        }
+        printf("  default:\n");
+        printf("    r = -1;\n");
+        printf("  }\n");
+        printf("  return r;\n");
+        printf("}\n");
+      }
+    }'
+    ;;
+  *)
+    echo "unknown shape: $SHAPE" >&2
+    exit 1
+    ;;
+esac
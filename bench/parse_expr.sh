@@ -0,0 +1,44 @@
+#!/bin/bash
+# 式の多い大きな入力を生成して、パース(--syntax-only)にかかる時間を計るマイクロベンチマーク
+#
+# usage: bench/parse_expr.sh [ynicc のパス] [生成する関数の数]
+#
+# 比較したいときは、それぞれのコミットでビルドした ynicc を指定して実行する
+#   $ bench/parse_expr.sh ./ynicc-old
+#   $ bench/parse_expr.sh ./ynicc
+set -e
+
+YNICC=${1:-./ynicc}
+FUNCS=${2:-100}
+RUNS=5
+
+SRC=$(mktemp /tmp/ynicc-bench-expr.XXXXXX)
+trap 'rm -f $SRC' EXIT
+
+# 1関数あたり600文、各文が演算子を十数個含む式になるようなCのソースを生成する
+awk -v funcs=$FUNCS 'BEGIN {
+  for (f = 0; f < funcs; f++) {
+    printf("int expr_%d(int a, int b, int c, int d) {\n", f);
+    printf("  int x = 0;\n");
+    for (i = 0; i < 300; i++) {
+      printf("  x = (a + b * c - d / (c + %d)) << 2 | (a & b) ^ (c >> 1) + x;\n", i + 1);
+      printf("  x += a < b && c >= d || !(a == %d) ? -x : ~x;\n", i);
+    }
+    printf("  return x;\n");
+    printf("}\n");
+  }
+}' > $SRC
+
+lines=$(wc -l < $SRC)
+best=
+for i in $(seq $RUNS); do
+  start=$(date +%s%N)
+  $YNICC --syntax-only $SRC
+  end=$(date +%s%N)
+  t=$(( (end - start) / 1000000 ))
+  if [ -z "$best" ] || [ $t -lt $best ]; then
+    best=$t
+  fi
+done
+
+echo "$YNICC: $lines lines, best of $RUNS: ${best} ms"
@@ -0,0 +1,82 @@
+#!/bin/bash
+# ynicc が生成したコードの速さを計るベンチマーク
+#
+# bench/runtime/ の各カーネルを ynicc と gcc (-O0, -O1, -O2) でコンパイルして実行し、
+# 実行時間(RUNS 回の最短)、実行した命令数、.text のサイズと、それぞれの gcc -O2 に対する比を表示する。
+# 出力が gcc -O0 でコンパイルしたものと違ったらエラーにする。
+#
+# 命令数はハードウェアのカウンタ(perf_event_open)が使える時だけ表示する。
+#
+# usage: bench/runtime.sh [ynicc のパス] [カーネルのリスト]
+#   $ bench/runtime.sh ./ynicc "fib sieve"
+set -e
+
+YNICC=${1:-./ynicc}
+DIR=$(dirname $0)/runtime
+KERNELS=${2:-$(cd $DIR && ls *.c | grep -v '^icount.c$' | sed 's/\.c$//')}
+COMPILERS="ynicc gcc-O0 gcc-O1 gcc-O2"
+RUNS=${RUNS:-3}
+
+TMP=$(mktemp -d /tmp/ynicc-bench-runtime.XXXXXX)
+trap 'rm -rf $TMP' EXIT
+
+gcc -O2 -o $TMP/icount $DIR/icount.c
+
+# $1 のカーネルを $2 のコンパイラでビルドして $TMP/<カーネル>.<コンパイラ> を作る
+build() {
+  local src=$DIR/$1.c
+  local out=$TMP/$1.$2
+  case $2 in
+    ynicc)
+      $YNICC $src -o $out.s 2> /dev/null
+      gcc -c -o $out.o $out.s
+      ;;
+    gcc-O*)
+      gcc -w -${2#gcc-} -c -o $out.o $src
+      ;;
+  esac
+  # ynicc の出力には .note.GNU-stack がないので、リンカの警告が出ないように明示する
+  gcc -static -z noexecstack -o $out $out.o
+}
+
+# .text.startup なども含めたコードの大きさ
+text_size() {
+  size -A $1 | awk '$1 ~ /^\.text/ { sum += $2 } END { print sum }'
+}
+
+printf "%-10s %-8s %10s %7s %16s %8s %7s\n" kernel compiler "time(ms)" "x-O2" instructions "text(B)" "x-O2"
+for k in $KERNELS; do
+  for c in $COMPILERS; do
+    build $k $c
+  done
+
+  $TMP/$k.gcc-O0 > $TMP/$k.expected
+  for c in $COMPILERS; do
+    best=
+    for i in $(seq $RUNS); do
+      start=$(date +%s%N)
+      $TMP/$k.$c > $TMP/$k.$c.out
+      end=$(date +%s%N)
+      t=$(( (end - start) / 1000 ))
+      if [ -z "$best" ] || [ $t -lt $best ]; then
+        best=$t
+      fi
+    done
+    if ! cmp -s $TMP/$k.expected $TMP/$k.$c.out; then
+      echo "$k: $c の出力が gcc -O0 と一致しません" >&2
+      exit 1
+    fi
+    echo "$c $best $($TMP/icount $TMP/$k.$c 2>&1 > /dev/null | awk '{ print $2 }') $(text_size $TMP/$k.$c.o)"
+  done > $TMP/$k.result
+
+  # gcc -O2 の結果を基準に比を計算する
+  awk -v kernel=$k '
+    { compiler[NR] = $1; us[NR] = $2; insns[NR] = $3; text[NR] = $4 }
+    $1 == "gcc-O2" { base_us = $2; base_text = $4 }
+    END {
+      for (i = 1; i <= NR; i++) {
+        printf("%-10s %-8s %10.1f %7.2f %16s %8d %7.2f\n", kernel, compiler[i], us[i] / 1000,
+               us[i] / base_us, insns[i], text[i], text[i] / base_text)
+      }
+    }' $TMP/$k.result
+done
@@ -0,0 +1,129 @@
+// examples/8puzzle.c を大きくしたもの(構造体、ポインタ、mallocを使った幅優先探索)
+// 一番手数のかかる31手の局面を解く
+void *calloc();
+int free();
+int memcpy();
+int printf();
+
+char *seen;
+
+typedef struct State {
+  struct State *parent;
+  int board[3][3];
+} State;
+
+typedef struct Queue {
+  struct Queue *head;
+  struct Queue *tail;
+  struct Queue *next;
+  State *val;
+} Queue;
+
+Queue *init_queue() {
+  return calloc(1, sizeof(Queue));
+}
+
+State *dequeue(Queue *q) {
+  if (!q->head) {
+    return 0;
+  }
+  State *v = q->head->val;
+  Queue *tmp = q->head;
+  q->head = q->head->next;
+  free(tmp);
+  return v;
+}
+
+void enqueue(Queue *q, State *v) {
+  Queue *entry = init_queue();
+  entry->val = v;
+  if (q->tail) {
+    q->tail->next = entry;
+  }
+  q->tail = entry;
+  if (!q->head) {
+    q->head = entry;
+  }
+}
+
+int hash_value(State *s) {
+  int h = 0;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      h = h * 10 + s->board[i][j];
+    }
+  }
+  return h;
+}
+
+void search_free_pos(int board[][3], int *r, int *c) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (board[i][j] == 0) {
+        *r = i;
+        *c = j;
+        return;
+      }
+    }
+  }
+}
+
+State *new_state(State *parent, int zero_r, int zero_c, int new_r, int new_c) {
+  State *s = calloc(1, sizeof(State));
+  s->parent = parent;
+  memcpy(s->board, parent->board, sizeof(parent->board));
+  s->board[zero_r][zero_c] = s->board[new_r][new_c];
+  s->board[new_r][new_c] = 0;
+  return s;
+}
+
+State *solve(Queue *q, State *initial_state) {
+  int direction[4][2] = {{0, 1}, {0, -1}, {-1, 0}, {1, 0}};
+  enqueue(q, initial_state);
+  State *s;
+  while (s = dequeue(q)) {
+    int hash = hash_value(s);
+    if (hash == 12345678) {
+      return s;
+    }
+    if (seen[hash]) {
+      continue;
+    }
+    seen[hash] = 1;
+
+    int r, c;
+    search_free_pos(s->board, &r, &c);
+    for (int i = 0; i < 4; i++) {
+      int row = r + direction[i][0];
+      int col = c + direction[i][1];
+      if (0 <= row && row <= 2 && 0 <= col && col <= 2) {
+        State *ns = new_state(s, r, c, row, col);
+        if (!seen[hash_value(ns)]) {
+          enqueue(q, ns);
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+int main() {
+  seen = calloc(876543210 + 1, sizeof(char));
+
+  State s = {
+    0,
+    {
+      {8, 0, 6},
+      {5, 4, 7},
+      {2, 3, 1}
+    },
+  };
+
+  State *result = solve(init_queue(), &s);
+  int steps = 0;
+  for (State *p = result; p && p->parent; p = p->parent) {
+    steps++;
+  }
+  printf("%d\n", steps);
+  return 0;
+}
@@ -0,0 +1,17 @@
+// examples/fib.c を大きくしたもの(再帰呼び出し)
+int printf();
+
+int fib(int n) {
+  if (n == 1) {
+    return 1;
+  } else if (n == 2) {
+    return 1;
+  } else {
+    return fib(n - 1) + fib(n - 2);
+  }
+}
+
+int main() {
+  printf("%d\n", fib(35));
+  return 0;
+}
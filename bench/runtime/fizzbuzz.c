@@ -0,0 +1,23 @@
+// examples/fizzbuzz.c を大きくしたもの(剰余と分岐)
+// 1行ずつ表示する代わりに、それぞれの個数を数える
+int printf();
+
+int main() {
+  long fizz = 0;
+  long buzz = 0;
+  long fizz_buzz = 0;
+  long other = 0;
+  for (int i = 1; i <= 30000000; i++) {
+    if (i % 15 == 0) {
+      fizz_buzz++;
+    } else if (i % 5 == 0) {
+      buzz++;
+    } else if (i % 3 == 0) {
+      fizz++;
+    } else {
+      other = other + i;
+    }
+  }
+  printf("%ld %ld %ld %ld\n", fizz_buzz, buzz, fizz, other);
+  return 0;
+}
@@ -0,0 +1,69 @@
+// 子プロセスとしてコマンドを実行して、ユーザー空間で実行した命令数を標準エラーに表示する
+// (bench/runtime.sh から gcc でビルドして使う。ynicc ではビルドしない)
+//
+// usage: icount <command> [args...]
+//
+// perf_event_open でハードウェアの命令数カウンタを使う。カウンタが使えない環境(仮想マシンなど)では
+// 命令数の代わりに "n/a" を表示する。コマンドの標準出力はそのまま。
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: icount <command> [args...]\n");
+    return 2;
+  }
+
+  // 子プロセスが exec するまで待たせるためのパイプ
+  int go[2];
+  if (pipe(go) < 0) {
+    perror("pipe");
+    return 2;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1) {
+      _exit(127);
+    }
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+  close(go[0]);
+
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.inherit = 1;
+  int fd = syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+
+  if (write(go[1], "x", 1) != 1) {
+    perror("write");
+  }
+  close(go[1]);
+
+  int status;
+  waitpid(pid, &status, 0);
+
+  long long count;
+  if (fd >= 0 && read(fd, &count, sizeof(count)) == sizeof(count)) {
+    fprintf(stderr, "instructions: %lld\n", count);
+  } else {
+    fprintf(stderr, "instructions: n/a\n");
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,31 @@
+// 行列の積(多重ループと2次元配列)
+int printf();
+
+long a[200][200];
+long b[200][200];
+long c[200][200];
+
+int main() {
+  int n = 200;
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      a[i][j] = i + j;
+      b[i][j] = i * 2 - j + 1;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      long sum = 0;
+      for (int k = 0; k < n; k++) {
+        sum = sum + a[i][k] * b[k][j];
+      }
+      c[i][j] = sum;
+    }
+  }
+  long trace = 0;
+  for (int i = 0; i < n; i++) {
+    trace = trace + c[i][i];
+  }
+  printf("%ld\n", trace);
+  return 0;
+}
@@ -0,0 +1,20 @@
+// エラトステネスのふるい(配列の読み書きとループ)
+void *calloc();
+int printf();
+
+int main() {
+  int n = 20000000;
+  char *composite = calloc(n + 1, 1);
+  int count = 0;
+  for (long i = 2; i <= n; i++) {
+    if (composite[i]) {
+      continue;
+    }
+    count++;
+    for (long j = i * i; j <= n; j = j + i) {
+      composite[j] = 1;
+    }
+  }
+  printf("%d\n", count);
+  return 0;
+}
@@ -0,0 +1,102 @@
+// examples/sudoku.c を大きくしたもの(配列と再帰によるバックトラック)
+// 同じ問題を何回も解く
+int printf();
+int memcpy();
+
+int free_pos_count(int (*board)[9]) {
+  int count = 0;
+  for (int i = 0; i < 9; i++) {
+    for (int j = 0; j < 9; j++) {
+      if (board[i][j] == 0) {
+        count = count + 1;
+      }
+    }
+  }
+  return count;
+}
+
+int next_free_pos(int (*board)[9], int pos) {
+  for (int i = pos; i < 9 * 9; i++) {
+    if (board[i / 9][i - i / 9 * 9] == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int can_put(int (*board)[9], int row, int col, int num) {
+  for (int i = 0; i < 9; i++) {
+    if (board[i][col] == num) {
+      return 0;
+    }
+  }
+  for (int i = 0; i < 9; i++) {
+    if (board[row][i] == num) {
+      return 0;
+    }
+  }
+
+  int r_offset = row / 3;
+  int c_offset = col / 3;
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 3; c++) {
+      if (board[r + 3 * r_offset][c + 3 * c_offset] == num) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+int solve(int (*board)[9], int pos) {
+  if (free_pos_count(board) == 0) {
+    return 1;
+  }
+  int free_pos = next_free_pos(board, pos);
+  if (free_pos == -1) {
+    return 0;
+  }
+  int r = free_pos / 9;
+  int c = free_pos - r * 9;
+  for (int n = 1; n <= 9; n++) {
+    if (can_put(board, r, c, n)) {
+      board[r][c] = n;
+      if (solve(board, free_pos + 1)) {
+        return 1;
+      }
+      board[r][c] = 0;
+    }
+  }
+  return 0;
+}
+
+int problem[9][9] = {
+  {0, 0, 0, 0, 7, 0, 0, 0, 0},
+  {0, 3, 0, 0, 0, 0, 0, 4, 0},
+  {0, 0, 0, 1, 0, 0, 0, 8, 0},
+
+  {1, 0, 0, 0, 0, 0, 0, 0, 6},
+  {0, 0, 9, 3, 0, 0, 0, 0, 5},
+  {0, 8, 0, 2, 0, 9, 0, 0, 0},
+
+  {0, 0, 0, 6, 0, 0, 0, 0, 2},
+  {0, 0, 0, 4, 1, 0, 0, 3, 0},
+  {0, 4, 2, 0, 0, 8, 7, 9, 0}
+};
+
+int main() {
+  int board[9][9];
+  long sum = 0;
+  for (int k = 0; k < 3; k++) {
+    memcpy(board, problem, sizeof(board));
+    if (!solve(board, 0)) {
+      printf("not solved\n");
+      return 1;
+    }
+    for (int i = 0; i < 9; i++) {
+      sum = sum * 3 + board[i][i];
+    }
+  }
+  printf("%ld\n", sum);
+  return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/bash
+# コンパイラ自体の速さを計るベンチマーク
+#
+# bench/gen_input.sh で形の違う入力を規模を変えて生成し、ynicc --time-report で
+# フェーズごとの時間を計って、1秒あたりに処理できる行数と、そのフェーズが終わった時点の最大RSSを表示する。
+#
+# usage: bench/throughput.sh [ynicc のパス] [規模のリスト]
+#   $ bench/throughput.sh ./ynicc "1 2 4"
+set -e
+
+YNICC=${1:-./ynicc}
+SCALES=${2:-1 2 4}
+SHAPES="funcs expr struct init globals switch"
+DIR=$(dirname $0)
+
+TMP=$(mktemp -d /tmp/ynicc-bench.XXXXXX)
+trap 'rm -rf $TMP' EXIT
+
+printf "%-8s %5s %8s  %-10s %10s %12s %14s\n" shape scale lines phase "wall(ms)" "lines/s" "peak-rss(KB)"
+for shape in $SHAPES; do
+  for scale in $SCALES; do
+    src=$TMP/$shape-$scale.c
+    $DIR/gen_input.sh $shape $scale > $src
+    lines=$(wc -l < $src)
+    $YNICC --time-report -o /dev/null $src 2> $TMP/report
+
+    # "## <phase> <wall> <cpu> <calls> <peak-rss>" の行を取り出す
+    awk -v shape=$shape -v scale=$scale -v lines=$lines '
+      $1 == "##" && $2 != "phase" && $2 != "time" && NF >= 4 {
+        wall = $3
+        rate = wall > 0 ? lines / (wall / 1000) : 0
+        rss = $2 == "total" ? "" : $6
+        printf("%-8s %5d %8d  %-10s %10.3f %12.0f %14s\n", shape, scale, lines, $2, wall, rate, rss)
+      }' $TMP/report
+  done
+done
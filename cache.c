@@ -0,0 +1,249 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ynicc.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 生成したアセンブリのキャッシュ(--cache-dir)
+//
+// 入力ファイルの内容、コンパイラ自身(実行ファイルの内容)、プレリュードの内容からキーを作り、
+// 同じキーのアセンブリがキャッシュディレクトリにあれば、トークナイズ〜コード生成をせずにそれを出力する。
+// キャッシュのエントリは <キー>.s という名前のファイルで、一時ファイルに書いてから rename するので
+// 複数のプロセスが同時に同じディレクトリを使っても、書きかけのエントリが読まれることはない。
+//
+// ヒット/ミスの回数はプロセスをまたいで数えられるように、キャッシュディレクトリの hits, misses という
+// ファイルに1回につき1バイト追記していき、ファイルの大きさを回数とする。
+
+enum {
+  CACHE_READ_BUFFER_SIZE = 1 << 16,
+};
+
+// 32bitのFNV-1aを初期値を変えて2つ並べて、64bitのハッシュとして使う
+typedef struct CacheHash CacheHash;
+struct CacheHash {
+  long h1;
+  long h2;
+};
+
+static char *cache_dir;
+// コンパイラ自身のハッシュ(コンパイラを作り直したら以前のエントリは使わない)
+static CacheHash compiler_hash;
+
+static void hash_init(CacheHash *h) {
+  h->h1 = 2166136261;
+  h->h2 = 3323198485;
+}
+
+static void hash_bytes(CacheHash *h, char *buf, long len) {
+  long h1 = h->h1;
+  long h2 = h->h2;
+  for (long i = 0; i < len; i++) {
+    int c = buf[i] & 0xff;
+    h1 = ((h1 ^ c) * 16777619) & 0xffffffff;
+    h2 = ((h2 ^ c) * 16777619) & 0xffffffff;
+  }
+  h->h1 = h1;
+  h->h2 = h2;
+}
+
+// ハッシュにハッシュを混ぜる
+static void hash_hash(CacheHash *h, CacheHash *other) {
+  char buf[40];
+  int n = sprintf(buf, "%08lx%08lx", other->h1, other->h2);
+  hash_bytes(h, buf, n);
+}
+
+static void hash_file(CacheHash *h, char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    error("cannot open %s: %s", path, strerror(errno));
+  }
+  char *buf = calloc(CACHE_READ_BUFFER_SIZE, sizeof(char));
+  for (;;) {
+    long n = fread(buf, 1, CACHE_READ_BUFFER_SIZE, fp);
+    if (n <= 0) {
+      break;
+    }
+    hash_bytes(h, buf, n);
+  }
+  free(buf);
+  fclose(fp);
+}
+
+static char *cache_file_path(char *name) {
+  char *path = calloc(strlen(cache_dir) + strlen(name) + 2, sizeof(char));
+  sprintf(path, "%s/%s", cache_dir, name);
+  return path;
+}
+
+static long file_size(char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    return 0;
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+// hits か misses に1回分を記録する
+static void count_up(char *name) {
+  char *path = cache_file_path(name);
+  FILE *fp = fopen(path, "a");
+  if (fp) {
+    fputc('.', fp);
+    fclose(fp);
+  }
+  free(path);
+}
+
+// dir をキャッシュディレクトリとして使う(なければ作る)
+void cache_open(char *dir) {
+  int ret = mkdir(dir, 493); // 0755
+  if (ret < 0 && errno != EEXIST) {
+    error("cannot create %s: %s", dir, strerror(errno));
+  }
+  cache_dir = dir;
+
+  hash_init(&compiler_hash);
+  hash_file(&compiler_hash, "/proc/self/exe");
+  // 最適化のレベルと有効なパスで出力が変わる
+  hash_bytes(&compiler_hash, (char *)&opt_level, sizeof(opt_level));
+  for (int i = 0; i < PASS_NUM; i++) {
+    bool enabled = pass_enabled(i);
+    hash_bytes(&compiler_hash, (char *)&enabled, sizeof(enabled));
+  }
+}
+
+bool cache_is_open(void) {
+  return cache_dir != NULL;
+}
+
+// input (とプレリュードの prelude_input。なければNULL)をコンパイルした結果のエントリのパスを返す
+char *cache_entry(char *input, char *prelude_input) {
+  CacheHash h;
+  hash_init(&h);
+  hash_hash(&h, &compiler_hash);
+  if (prelude_input) {
+    hash_bytes(&h, prelude_input, strlen(prelude_input));
+  }
+  // プレリュードと入力の境目を区別するために区切りを入れておく
+  hash_bytes(&h, "\0", 1);
+  hash_bytes(&h, input, strlen(input));
+
+  char name[40];
+  sprintf(name, "%08lx%08lx.s", h.h1, h.h2);
+  return cache_file_path(name);
+}
+
+// エントリの内容を今の出力に追加する
+// エントリがなければ false を返す
+bool cache_emit(char *entry) {
+  FILE *fp = fopen(entry, "r");
+  if (!fp) {
+    return false;
+  }
+
+  // fd から直接読むので、stdioのバッファを介さないように lseek で大きさを調べる
+  int fd = fileno(fp);
+  long size = lseek(fd, 0, SEEK_END);
+  lseek(fd, 0, SEEK_SET);
+
+  emit_copy(fd, size);
+  fclose(fp);
+  return true;
+}
+
+// エントリの内容を output_path (NULLなら標準出力)に書く
+// エントリがなければ false を返す
+bool cache_output(char *entry, char *output_path) {
+  FILE *fp = fopen(entry, "r");
+  if (!fp) {
+    return false;
+  }
+  fclose(fp);
+
+  emit_open(output_path);
+  cache_emit(entry);
+  emit_close();
+  return true;
+}
+
+// エントリがあればその内容を output_path に書いて true を返す(ヒット/ミスを記録する)
+bool cache_fetch(char *entry, char *output_path) {
+  if (cache_output(entry, output_path)) {
+    count_up("hits");
+    return true;
+  }
+  count_up("misses");
+  return false;
+}
+
+// 関数ごとのコード生成結果のキャッシュのエントリを pgm の各関数に設定する
+//
+// 関数のコードは、その関数の本体のソースと、関数から参照できるグローバルな宣言(型、typedef、
+// グローバル変数、他の関数の宣言)で決まる。構造体のレイアウトはメンバの型をたどって間接的にも参照されるので、
+// 関数が実際に使っているものだけを正確に集めるのは難しい。ここではその関数より前にある
+// 関数本体以外のソース(各関数の "{" より前の部分を含む)を全部キーに含めることで、それを近似している。
+// 関数本体を変更しても他の関数のキーは変わらないので、変更した関数だけコードを生成し直すことになる。
+void cache_assign_functions(Program *pgm, char *input, char *prelude_input) {
+  CacheHash env;
+  hash_init(&env);
+  hash_hash(&env, &compiler_hash);
+  if (prelude_input) {
+    hash_bytes(&env, prelude_input, strlen(prelude_input));
+  }
+  hash_bytes(&env, "\0", 1);
+
+  char *prev = input;
+  for (Function *f = pgm->functions; f; f = f->next) {
+    hash_bytes(&env, prev, f->body_src - prev);
+
+    CacheHash h;
+    memcpy(&h, &env, sizeof(CacheHash));
+    hash_bytes(&h, f->body_src, f->src_end - f->body_src);
+
+    char name[40];
+    sprintf(name, "f-%08lx%08lx.s", h.h1, h.h2);
+    f->cache_entry = cache_file_path(name);
+    prev = f->src_end;
+  }
+}
+
+// 関数のエントリがあればその内容を今の出力に追加して true を返す(ヒット/ミスを記録する)
+bool cache_fetch_function(char *entry) {
+  if (cache_emit(entry)) {
+    count_up("function_hits");
+    return true;
+  }
+  count_up("function_misses");
+  return false;
+}
+
+// エントリを書くための一時ファイルのパスを返す
+char *cache_temp_path(char *entry) {
+  char *path = calloc(strlen(entry) + 32, sizeof(char));
+  sprintf(path, "%s.tmp.%d", entry, getpid());
+  return path;
+}
+
+// 書き終わった一時ファイルをエントリにする
+void cache_store(char *temp_path, char *entry) {
+  int ret = rename(temp_path, entry);
+  if (ret < 0) {
+    error("cannot rename %s: %s", temp_path, strerror(errno));
+  }
+}
+
+static void print_stats(char *kind, char *hits_name, char *misses_name) {
+  char *hits = cache_file_path(hits_name);
+  char *misses = cache_file_path(misses_name);
+  fprintf(stderr, "## cache %s (%s): %ld hits, %ld misses\n", cache_dir, kind, file_size(hits), file_size(misses));
+  free(hits);
+  free(misses);
+}
+
+void cache_print_stats(void) {
+  print_stats("files", "hits", "misses");
+  print_stats("functions", "function_hits", "function_misses");
+}
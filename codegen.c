@@ -1,77 +1,228 @@
+#define _POSIX_C_SOURCE 200809L
 #include "ynicc.h"
 #include <assert.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 関数1個分のコード生成の状態
+//
+// ラベルの番号は関数ごとに1から振り、ラベル名に関数名を含めることで他の関数のラベルと区別する。
+// これで各関数のコード生成が他の関数に依存しなくなるので、別々のワーカーで並列に生成しても
+// 直列に生成した場合と同じ出力になる。
+typedef struct CodegenContext CodegenContext;
+struct CodegenContext {
+  // 今コード生成中の関数名
+  char *funcname;
+
+  // 今のbreakの飛び先のキー
+  int break_seq;
+
+  // 今のcontinueの飛び先のキー
+  int continue_seq;
+
+  // 次に使うラベルの番号
+  int label_index;
+
+  // 値スタックに積んでいる値の数と、そのうちハードウェアのスタックに退避している値の数(下から順に退避する)
+  int depth;
+  int spilled;
+};
 
-// 今コード生成中の関数名
-static char *funcname;
-
-// 今のbreakの飛び先のキー
-static int current_break_jump_seq;
+// 今コード生成中の関数の状態
+static CodegenContext *ctx;
 
-// 今のcontinueの飛び先のキー
-static int current_continue_jump_seq;
+int opt_level;
 
 static void gen(Node *node);
 static void gen_bin_op(Node *node);
 
-static int printfln(char *fmt, ...) {
-  va_list ap;
-  va_start(ap, fmt);
-  int n = vprintf(fmt, ap);
-  putchar('\n');
+// 式の途中の値を置くレジスタ
+//
+// 式の値は「値スタック」に積むが、値スタックの i 番目の値は TMP_REGISTERS_SIZE8[i % TMP_REG_NUM] に置く。
+// レジスタが全部埋まっている時に値を積む場合は、一番下にある値をハードウェアのスタックにpushして(スピル)
+// そのレジスタを空け、その値を使う時になったらpopして同じレジスタに戻す。
+// rax, rcx, rdx は idiv、シフト、関数の戻り値で使う作業用のレジスタなので値スタックには使わない。
+//
+// 関数呼び出しでは呼び出し側保存のレジスタが壊れるので、呼び出し前に値スタックの値を全部スピルする。
+enum {
+  TMP_REG_NUM = 6,
+};
+
+static char *TMP_REGISTERS_SIZE8[] = {
+    "rdi", "rsi", "r8", "r9", "r10", "r11",
+};
+
+static char *TMP_REGISTERS_SIZE4[] = {
+    "edi", "esi", "r8d", "r9d", "r10d", "r11d",
+};
+
+static char *TMP_REGISTERS_SIZE2[] = {
+    "di", "si", "r8w", "r9w", "r10w", "r11w",
+};
+
+static char *TMP_REGISTERS_SIZE1[] = {
+    "dil", "sil", "r8b", "r9b", "r10b", "r11b",
+};
+
+// "  op dst, src" の1行を書く
+static void emit_op(char *op, char *dst, char *src) {
+  emit("  ");
+  emit(op);
+  emit(" ");
+  emit(dst);
+  emit(", ");
+  emitln(src);
+}
+
+// "  op dst, imm" の1行を書く
+static void emit_op_num(char *op, char *dst, long imm) {
+  emit("  ");
+  emit(op);
+  emit(" ");
+  emit(dst);
+  emitln_num(", ", imm);
+}
+
+// "  op dst, size[addr]" の1行を書く(size は "BYTE PTR " などのメモリのサイズの指定)
+static void emit_load(char *op, char *dst, char *size, char *addr) {
+  emit("  ");
+  emit(op);
+  emit(" ");
+  emit(dst);
+  emit(", ");
+  emit(size);
+  emit("[");
+  emit(addr);
+  emitln("]");
+}
+
+// "  mov [addr], src" の1行を書く
+static void emit_store(char *addr, char *src) {
+  emit("  mov [");
+  emit(addr);
+  emitln_str("], ", src);
+}
+
+// 値スタックの slot 番目の値を置くレジスタの番号
+static int slot_index(int slot) {
+  int i = slot % TMP_REG_NUM;
+  return i;
+}
+
+// 値スタックの slot 番目の値を置くレジスタ
+static char *slot_reg(int slot) {
+  return TMP_REGISTERS_SIZE8[slot_index(slot)];
+}
+
+// 値スタックの上から i 番目(0が先頭)の値を置くレジスタ
+static char *top_reg(int i) {
+  return slot_reg(ctx->depth - 1 - i);
+}
+
+// 値スタックのレジスタにある値のうち一番下のものをハードウェアのスタックに退避する
+static void spill_bottom(void) {
+  emitln_str("  push ", slot_reg(ctx->spilled));
+  ctx->spilled++;
+}
+
+// 最後に退避した値をレジスタに戻す
+static void reload_top(void) {
+  ctx->spilled--;
+  emitln_str("  pop ", slot_reg(ctx->spilled));
+}
+
+// 値スタックに値を1個積んで、その値を置くレジスタを返す
+static char *push_reg(void) {
+  if (ctx->depth - ctx->spilled == TMP_REG_NUM) {
+    spill_bottom();
+  }
+  return slot_reg(ctx->depth++);
+}
 
-  return n + 1;
+// 値スタックの先頭の値を捨てる
+static void pop_reg(void) {
+  assert(ctx->depth > ctx->spilled);
+  ctx->depth--;
+}
+
+// 値スタックの上から n 個の値がレジスタにあるようにする
+static void need(int n) {
+  while (ctx->spilled > ctx->depth - n) {
+    reload_top();
+  }
+}
+
+// 次に積む値のためのレジスタを空けておく
+// (分岐の合流先で値を積む時に、どちらの経路から来てもスピルの状態が同じになるようにする)
+static void reserve_reg(void) {
+  if (ctx->depth - ctx->spilled == TMP_REG_NUM) {
+    spill_bottom();
+  }
+}
+
+// 退避している値の数を spilled にそろえる(分岐の前後でレジスタの状態を一致させるのに使う)
+static void restore_spilled(int spilled) {
+  while (ctx->spilled > spilled) {
+    reload_top();
+  }
+  while (ctx->spilled < spilled) {
+    spill_bottom();
+  }
 }
 
-//スタックの先頭に積まれている値をアドレスとみなして、引数の型のサイズに合わせた値をそのアドレスから取得してスタックに積む
+// 値スタックの先頭の値(アドレス)が指す先から、引数の型のサイズに合わせた値を読んで、先頭の値と置き換える
 static void load(Type *t) {
-  printfln("  pop rax"); // スタックにつまれている、変数のアドレスをraxにロード
-  // 変数のアドレスにある値をraxにロード
+  need(1);
+  char *r = top_reg(0);
+  // 変数のアドレスにある値をロード
   int sz = t->size;
   if (sz == 1) {
-    printfln("  movsx rax, BYTE PTR [rax]");
+    emit_load("movsx", r, "BYTE PTR ", r);
   } else if (sz == 2) {
-    printfln("  movsx rax, WORD PTR [rax]");
+    emit_load("movsx", r, "WORD PTR ", r);
   } else if (sz == 4) {
-    printfln("  movsxd rax, DWORD PTR [rax]");
+    emit_load("movsxd", r, "DWORD PTR ", r);
   } else if (sz == 8) {
-    printfln("  mov rax, [rax]");
+    emit_load("mov", r, "", r);
   } else {
     assert(false);
   }
-
-  printfln("  push rax"); // 変数の値(rax)をスタックに積む
 }
 
-// スタックの先頭を値、 スタックの2番目の値をアドレスとみなして、そのアドレスに値を設定して、 値をスタックに積む
+// 値スタックの先頭を値、2番目の値をアドレスとみなして、そのアドレスに値を設定して、その2つを値に置き換える
 static void store(Type *t) {
-  printfln("  pop rdi"); // rhsの結果
-  printfln("  pop rax"); // 左辺の変数のアドレス
+  need(2);
+  int slot = ctx->depth - 1;
+  char *val = slot_reg(slot); // rhsの結果
+  char *addr = top_reg(1); // 左辺の変数のアドレス
 
   if (t->kind == TY_BOOL) {
-    // booleanの場合はrdiが
+    // booleanの場合は値が
     // 0のときは0
-    // それ以外は固定で1をrdiに設定する
-    printfln("  cmp rdi, 0");
-    // cmp の比較で rdi != 0 のときだけ rdiの下位8bit に1をセット
-    printfln("  setne dil");
-    // rdiの上位56bitはクリアして1を代入
-    printfln("  movzb rdi, dil");
+    // それ以外は固定で1を設定する
+    emit_op("cmp", val, "0");
+    // cmp の比較で 値 != 0 のときだけ下位8bit に1をセット
+    emitln_str("  setne ", TMP_REGISTERS_SIZE1[slot_index(slot)]);
+    // 上位56bitはクリアして1を代入
+    emit_op("movzb", val, TMP_REGISTERS_SIZE1[slot_index(slot)]);
   }
 
   int sz = t->size;
   // 左辺の変数にrhsの結果を代入
   if (sz == 1) {
-    printfln("  mov [rax], dil");
+    emit_store(addr, TMP_REGISTERS_SIZE1[slot_index(slot)]);
   } else if (sz == 2) {
-    printfln("  mov [rax], di");
+    emit_store(addr, TMP_REGISTERS_SIZE2[slot_index(slot)]);
   } else if (sz == 4) {
-    printfln("  mov [rax], edi");
+    emit_store(addr, TMP_REGISTERS_SIZE4[slot_index(slot)]);
   } else if (sz == 8) {
-    printfln("  mov [rax], rdi");
+    emit_store(addr, val);
   } else {
     assert(false);
   }
-  printfln("  push rdi"); // この代入結果自体もスタックに積む(右結合でどんどん左に伝搬していくときの右辺値になる)
+  // この代入結果自体も値として残す(右結合でどんどん左に伝搬していくときの右辺値になる)
+  emit_op("mov", addr, val);
+  pop_reg();
 }
 
 static void gen_addr(Node *node) {
@@ -79,90 +230,281 @@ static void gen_addr(Node *node) {
   #pragma clang diagnostic ignored "-Wswitch"
   switch(node->kind) {
     case ND_VAR:
-      printfln("  # gen_addr start (var_name: %s, var_type: %s)", node->var->name, node->var->is_local ? "local" : "global");
-      printfln("  # gen_addr-ND_VAR start");
+      emitfln("  # gen_addr start (var_name: %s, var_type: %s)", node->var->name, node->var->is_local ? "local" : "global");
+      emitln("  # gen_addr-ND_VAR start");
       // compound_literaruの場合 この アドレス参照時のvarノードで初めて初期化されるので、そのチェック
       // &(int) { 1 } みたいなケース
       if (node->init) {
         gen(node->init);
       }
+      // レジスタに置いた変数はアドレスを取られないものだけ
+      assert(!node->var->reg);
       if (node->var->is_local) {
-        printfln("  mov rax, rbp");
-        printfln("  sub rax, %d", node->var->offset);
-        printfln("  push rax");
+        char *r = push_reg();
+        emit("  lea ");
+        emit(r);
+        emit(", [rbp-");
+        emit_num(node->var->offset);
+        emitln("]");
       } else {
-        // global変数の場合は単にそのラベル(=変数名)をpushする
-        printfln("  push offset %s", node->var->name);
+        // global変数の場合は単にそのラベル(=変数名)のアドレスを積む
+        emitfln("  mov %s, offset %s", push_reg(), node->var->name);
       }
-      printfln("  # gen_addr-ND_VAR end");
-      printfln("  # gen_addr end");
+      emitln("  # gen_addr-ND_VAR end");
+      emitln("  # gen_addr end");
       return;
     case ND_DEREF:
-      printfln("  # gen_addr start (var_name: none)");
-      printfln("  # gen_addr-ND_DEREF start");
+      emitln("  # gen_addr start (var_name: none)");
+      emitln("  # gen_addr-ND_DEREF start");
       gen(node->lhs);
-      printfln("  # gen_addr-ND_DEREF stop");
-      printfln("  # gen_addr end");
+      emitln("  # gen_addr-ND_DEREF stop");
+      emitln("  # gen_addr end");
       return;
     case ND_MEMBER:
-      printfln("  # gen_addr start (struct-member: %s)", node->member->name);
-      printfln("  # gen_addr-ND_MEMBER start");
-      printfln("  # struct var ref start");
+      emitfln("  # gen_addr start (struct-member: %s)", node->member->name);
+      emitln("  # gen_addr-ND_MEMBER start");
+      emitln("  # struct var ref start");
       gen_addr(node->lhs);
-      printfln("  # struct var ref end");
-      printfln("  # struct member ref start");
-      printfln("  pop rax"); // 構造体変数のアドレス
-      printfln("  add rax, %d", node->member->offset); //構造体のアドレスを元にそのメンバーの位置(オフセットを設定)
-      printfln("  push rax"); // 構造体メンバーのアドレスをpush
-      printfln("  # struct member ref end");
-      printfln("  # gen_addr-ND_MEMBER stop");
-      printfln("  # gen_addr end");
+      emitln("  # struct var ref end");
+      emitln("  # struct member ref start");
+      need(1);
+      //構造体のアドレスを元にそのメンバーの位置(オフセットを設定)
+      emit_op_num("add", top_reg(0), node->member->offset);
+      emitln("  # struct member ref end");
+      emitln("  # gen_addr-ND_MEMBER stop");
+      emitln("  # gen_addr end");
       return;
   }
 
  error("代入の左辺値が変数ではありません");
 }
 
-// スタックの先頭の値をインクリメントしてスタックに積み直す
+// ++, -- で増減する大きさ
+// ポインタの場合はそのポインタが指す先の型のサイズ分インクリメントする。(int *x; x++ が4バイト先に進むような場合)
+// ポインタでない場合は単に値を1増やす int i = 0; i++; でiが1になる みたいな場合
+static long inc_size(Type *ty) {
+  return ty->ptr_to ? ty->ptr_to->size : 1;
+}
+
+// 値スタックの先頭の値をインクリメントする
 static void inc(Type *ty) {
-  printfln("  pop rax");
-  // ポインタの場合はそのポインタが指す先の型のサイズ分インクリメントする。(int *x; x++ が4バイト先に進むような場合)
-  // ポインタでない場合は単に値を1増やす int i = 0; i++; でiが1になる みたいな場合
-  printfln("  add rax, %ld\n", ty->ptr_to ? ty->ptr_to->size : 1);
-  printfln("  push rax");
+  need(1);
+  emit_op_num("add", top_reg(0), inc_size(ty));
 }
 
-// スタックの先頭の値をデクリメントしてスタックに積み直す
+// 値スタックの先頭の値をデクリメントする
 static void dec(Type *ty) {
-  printfln("  pop rax");
-  printfln("  sub rax, %ld\n", ty->ptr_to ? ty->ptr_to->size : 1);
-  printfln("  push rax");
+  need(1);
+  emit_op_num("sub", top_reg(0), inc_size(ty));
+}
+
+// 値スタックの先頭の値(アドレス)を複製して積む
+static void dup_top(void) {
+  need(1);
+  char *src = top_reg(0);
+  emit_op("mov", push_reg(), src);
 }
 
 static int next_label_key() {
-  // break可能なseq(forやwhileに入った後に使われるbreak)を判断できるように
-  // 初期値を1にして0の場合はトップレベルに出てきたbreak(=不正なbreak)とみなす
-  static int label_index = 1;
-  return label_index++;
+  return ctx->label_index++;
+}
+
+// レジスタの値を ty の型の値に変換する(下位 ty->size バイトを符号拡張する)
+// r8〜r64 は同じレジスタの1, 2, 4, 8バイトの名前
+static void extend_reg(Type *ty, char *r8, char *r16, char *r32, char *r64) {
+  if (ty->kind == TY_BOOL) {
+    emit_op("cmp", r64, "0");
+    emitln_str("  setne ", r8);
+  }
+
+  if (ty->size == 1) {
+    emit_op("movsx", r64, r8);
+  } else if (ty->size == 2) {
+    emit_op("movsx", r64, r16);
+  } else if (ty->size == 4) {
+    emit_op("movsxd", r64, r32);
+  }
 }
 
 static void cast(Node *node) {
-  printfln(" pop rax");
+  need(1);
+  int i = slot_index(ctx->depth - 1);
+  extend_reg(node->ty, TMP_REGISTERS_SIZE1[i], TMP_REGISTERS_SIZE2[i], TMP_REGISTERS_SIZE4[i], TMP_REGISTERS_SIZE8[i]);
+}
+
+// ローカル変数を置くレジスタ
+//
+// アドレスを取られないスカラーのローカル変数(引数も含む)は、関数全体を通して callee-saved レジスタに置く。
+// 関数呼び出しをまたいでも値が壊れないので、呼び出しの前後で退避する必要がない。
+// 使うレジスタはプロローグで保存してエピローグで元に戻す。
+enum {
+  VAR_REG_NUM = 5,
+};
+
+static char *VAR_REGISTERS_SIZE8[] = {
+    "rbx", "r12", "r13", "r14", "r15",
+};
+
+static char *VAR_REGISTERS_SIZE4[] = {
+    "ebx", "r12d", "r13d", "r14d", "r15d",
+};
+
+static char *VAR_REGISTERS_SIZE2[] = {
+    "bx", "r12w", "r13w", "r14w", "r15w",
+};
+
+static char *VAR_REGISTERS_SIZE1[] = {
+    "bl", "r12b", "r13b", "r14b", "r15b",
+};
+
+// レジスタに置いた変数 var を var の型の値にそろえる
+static void extend_var_reg(Var *var) {
+  int i = var->reg - 1;
+  extend_reg(var->type, VAR_REGISTERS_SIZE1[i], VAR_REGISTERS_SIZE2[i], VAR_REGISTERS_SIZE4[i], VAR_REGISTERS_SIZE8[i]);
+}
+
+static char *var_reg(Var *var) {
+  return VAR_REGISTERS_SIZE8[var->reg - 1];
+}
+
+// node が レジスタに置いたローカル変数そのものかどうか
+static bool is_reg_var(Node *node) {
+  return node->kind == ND_VAR && node->var->reg;
+}
+
+// レジスタに置いた変数の ++, -- (delta だけ増やす)
+// post なら変更前の値を、そうでなければ変更後の値を積む
+static void gen_reg_var_inc(Var *var, long delta, bool post) {
+  char *r = push_reg();
+  if (post) {
+    emit_op("mov", r, var_reg(var));
+  }
+  emit_op_num("add", var_reg(var), delta);
+  extend_var_reg(var);
+  if (!post) {
+    emit_op("mov", r, var_reg(var));
+  }
+}
+
+// レジスタに置ける型かどうか
+static bool is_reg_type(Type *ty) {
+  return ty->kind == TY_BOOL || ty->kind == TY_CHAR || ty->kind == TY_SHORT || ty->kind == TY_INT ||
+         ty->kind == TY_LONG || ty->kind == TY_PTR || ty->kind == TY_ENUM;
+}
+
+// 変数ごとの使われる回数(ループの中は重くする)と、アドレスを取られるかどうか
+typedef struct VarUsage VarUsage;
+struct VarUsage {
+  Var *var;
+  long weight;
+  bool address_taken;
+};
+
+static VarUsage *var_usages;
+static int var_usage_num;
+
+static VarUsage *find_var_usage(Var *var) {
+  if (!var->usage_index) {
+    return NULL;
+  }
+  return &var_usages[var->usage_index - 1];
+}
+
+// node 以下で使われているローカル変数の回数を数える(loop_weight はループの深さに応じた重み)
+static void count_var_usage(Node *node, long loop_weight) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_VAR && node->var && node->var->is_local) {
+      VarUsage *u = find_var_usage(node->var);
+      if (u) {
+        u->weight += loop_weight;
+        if (node->init) {
+          // compound literal はアドレスを取って初期化する
+          u->address_taken = true;
+        }
+      }
+    }
+    if (node->kind == ND_ADDR && node->lhs->kind == ND_VAR && node->lhs->var->is_local) {
+      VarUsage *u = find_var_usage(node->lhs->var);
+      if (u) {
+        u->address_taken = true;
+      }
+    }
 
-  if (node->ty->kind == TY_BOOL) {
-    printfln("  cmp rax, 0");
-    printfln("  setne al");
+    count_var_usage(node->init, loop_weight);
+    count_var_usage(node->lhs, loop_weight);
+    count_var_usage(node->rhs, loop_weight);
+    if (!node_has_stmt_part(node->kind)) {
+      continue;
+    }
+
+    long body_weight = loop_weight;
+    if ((node->kind == ND_WHILE || node->kind == ND_FOR) && loop_weight < 4096) {
+      body_weight = loop_weight * 8;
+    }
+    count_var_usage(node->cond, body_weight);
+    count_var_usage(node->then, loop_weight);
+    count_var_usage(node->els, loop_weight);
+    count_var_usage(node->body, body_weight);
+    count_var_usage(node->inc, body_weight);
+    count_var_usage(node->initializer, loop_weight);
+    count_var_usage(node->arg, loop_weight);
   }
+}
 
-  if (node->ty->size == 1) {
-    printfln("  movsx rax, al");
-  } else if (node->ty->size == 2) {
-    printfln("  movsx rax, ax");
-  } else if (node->ty->size == 4) {
-    printfln("  movsxd rax, eax");
+// アドレスを取られないスカラーのローカル変数のうち、よく使われるものから順に callee-saved レジスタを割り当てて、
+// 使ったレジスタの数を返す
+static int assign_var_registers(Function *func) {
+  int nlocals = 0;
+  for (VarList *v = func->locals; v; v = v->next) {
+    nlocals++;
+  }
+  var_usages = calloc(nlocals, sizeof(VarUsage));
+  var_usage_num = 0;
+  for (VarList *v = func->locals; v; v = v->next) {
+    v->var->reg = 0;
+    v->var->usage_index = 0;
+    if (is_reg_type(v->var->type)) {
+      var_usages[var_usage_num++].var = v->var;
+      v->var->usage_index = var_usage_num;
+    }
+  }
+
+  if (!pass_enabled(PASS_REGVAR)) {
+    free(var_usages);
+    var_usages = NULL;
+    return 0;
+  }
+  count_var_usage(func->body, 1);
+
+  int nregs = 0;
+  while (nregs < VAR_REG_NUM) {
+    // まだレジスタに置いていない中で一番重い変数を選ぶ(1回しか使わないならスタックのままでいい)
+    VarUsage *best = NULL;
+    for (int i = 0; i < var_usage_num; i++) {
+      VarUsage *u = &var_usages[i];
+      if (u->address_taken || u->var->reg || u->weight < 2) {
+        continue;
+      }
+      if (!best || u->weight > best->weight) {
+        best = u;
+      }
+    }
+    if (!best) {
+      break;
+    }
+    best->var->reg = ++nregs;
   }
 
-  printfln(" push rax");
+  free(var_usages);
+  var_usages = NULL;
+  return nregs;
+}
+
+// 値スタックの先頭の値を0と比較して捨てる(この後に je/jne で分岐する)
+static void cmp_zero_and_pop(void) {
+  need(1);
+  emit_op("cmp", top_reg(0), "0");
+  pop_reg();
 }
 
 // 引数に渡す時用のレジスタ
@@ -183,286 +525,300 @@ static char *ARGUMENT_REGISTERS_SIZE1[] = {
     "dil", "sil", "dl", "cl", "r8b", "r9b",
 };
 
+
 static void gen(Node *node) {
   assert(node);
   // switchの警告を消すpragma
   #pragma clang diagnostic ignored "-Wswitch"
   switch (node->kind) {
     case ND_NUM:
-      // 32bitを超える整数を直接pushできないので、32bit以内は直接
-      // 超える場合は一度レジスタ(64bit)経由でpushする
-      //
-      // 実際にためしたところ、リテラルに書けるのは符号付き32bit整数のようなので、
-      // 正の数の場合
-      //   push 2147483647  (== 2^31 - 1)
-      // はOKで、
-      //   push 2147483648  (== 2^31 )
-      // だと、 Error: operand type mismatch for `push' のエラーになる
+      // 即値をそのままレジスタに入れる(64bitに収まらない数値リテラルは mov が movabs になる)
       if (node->val == (int)node->val) {
-        // intのサイズに収まる場合は普通にpushする
-        printfln("  push %ld", node->val);
+        emit_op_num("mov", push_reg(), node->val);
       } else {
-        // intを超える数値リテラルの場合はレジスタ経由でpush
-        // movabsのabsはよくわからなかった
-        printfln("  movabs rax, %ld", node->val);
-        printfln("  push rax");
+        emit_op_num("movabs", push_reg(), node->val);
       }
       return;
     case ND_MEMBER:
     case ND_VAR:
       if (node->kind == ND_VAR) {
         if (node->var) {
-          printfln("  # ND_VAR start(var_name: %s)", node->var->name);
+          emitfln("  # ND_VAR start(var_name: %s)", node->var->name);
         } else {
-          printfln("  # ND_VAR start(var_name: none)");
+          emitln("  # ND_VAR start(var_name: none)");
         }
       } else {
         assert(node->kind == ND_MEMBER);
-        printfln("  # ND_VAR start(struct-member))");
+        emitln("  # ND_VAR start(struct-member))");
         // x->y->みたいな場合にややこしい(落ちる)ので一旦コメントなし
         //
         // .  の ND_MEMBER の場合はそのまま node->lhs->var->nameでいいが
         // -> の ND_MEMBER の場合は、node->lhsが構造体へのポインタになってるのでそれも考慮する
         // if (node->lhs->kind == ND_DEREF) {
         //   // -> の場合は、node->lhs->lhsが構造体への変数
-        //   printfln("  # ND_VAR start(struct_var_name: %s, member_name: %s)", node->lhs->lhs->var->name, node->member->name);
+        //   emitfln("  # ND_VAR start(struct_var_name: %s, member_name: %s)", node->lhs->lhs->var->name, node->member->name);
         // } else {
         //   // . の場合は、node->lhsが構造体の変数
-        //   printfln("  # ND_VAR start(struct_var_name: %s, member_name: %s)", node->lhs->var->name, node->member->name);
+        //   emitfln("  # ND_VAR start(struct_var_name: %s, member_name: %s)", node->lhs->var->name, node->member->name);
         // }
       }
+      if (is_reg_var(node)) {
+        emit_op("mov", push_reg(), var_reg(node->var));
+        emitln("  # ND_VAR end");
+        return;
+      }
       // compound-literalの場合、参照のタイミングで初期化されるので、initがあれば初期化する
       if (node->init) {
         gen(node->init);
       }
       gen_addr(node);
       if (node->ty->kind != TY_ARRAY) {
-        // 配列以外の場合は、識別子が指すアドレスにある値をスタックにつむところまでやるが、だが、
-        // 配列の場合は、識別子が指すアドレス自体をスタックにつみたいので、そうする。
+        // 配列以外の場合は、識別子が指すアドレスにある値を積むところまでやるが、だが、
+        // 配列の場合は、識別子が指すアドレス自体を積みたいので、そうする。
         load(node->ty);
       }
-      printfln("  # ND_VAR end");
+      emitln("  # ND_VAR end");
       return;
     case ND_ASSIGN:
-      printfln("  # ND_ASSIGN start");
+      emitln("  # ND_ASSIGN start");
+      if (is_reg_var(node->lhs)) {
+        // レジスタに置いた変数には型に合わせた値を入れる
+        gen(node->rhs);
+        cast(node->lhs);
+        emit_op("mov", var_reg(node->lhs->var), top_reg(0));
+        emitln("  # ND_ASSIGN end");
+        return;
+      }
       gen_addr(node->lhs);
       gen(node->rhs);
-      //rhsの結果がスタックの先頭、その次に変数のアドレスが入ってるのでそれをロード
+      //rhsの結果が値スタックの先頭、その次に変数のアドレスが入ってるのでそれをロード
       store(node->ty);
-      printfln("  # ND_ASSIGN end");
+      emitln("  # ND_ASSIGN end");
       return;
     case ND_RETURN:
-      printfln("  # ND_RETURN start");
+      emitln("  # ND_RETURN start");
       if (node->lhs) {
         gen(node->lhs);
-        printfln("  pop rax");
-        printfln("  jmp .L.return.%s", funcname);
+        need(1);
+        emit_op("mov", "rax", top_reg(0));
+        pop_reg();
+        emitln_str("  jmp .L.return.", ctx->funcname);
       } else {
-        printfln("  jmp .L.return.%s", funcname);
+        emitln_str("  jmp .L.return.", ctx->funcname);
       }
-      printfln("  # ND_RETURN end");
+      emitln("  # ND_RETURN end");
       return;
     case ND_BLOCK:
-      printfln("  # ND_BLOCK start");
+      emitln("  # ND_BLOCK start");
       // このブロックの先頭の文からコード生成
       //
       for (Node *n = node->body; n; n = n->next) {
         gen(n);
       }
-      printfln("  # ND_BLOCK end");
+      emitln("  # ND_BLOCK end");
       return;
     case ND_IF:
     case ND_TERNARY:
       {
-        printfln("  # ND_IF(ND_TERNARY) start");
+        emitln("  # ND_IF(ND_TERNARY) start");
+        // 3項演算子は then と els のどちらを通っても同じレジスタに結果が入るように、
+        // 分岐する前にレジスタを空けて、スピルの状態をそろえておく
+        reserve_reg();
+        int depth = ctx->depth;
+        int spilled = ctx->spilled;
         gen(node->cond); // 条件式のコード生成
+        cmp_zero_and_pop(); // 条件式の結果チェック
+        restore_spilled(spilled);
         if (node->els) {
           // else ありの if
-          printfln("  pop rax"); // 条件式の結果をraxにロード
-          printfln("  cmp rax, 0"); // 条件式の結果チェック
           int else_label = next_label_key();
           int end_label = next_label_key();
-          printfln("  je .L.else.%04d", else_label); // false(rax == 0)ならwhile終了なのでジャンプ
+          emitfln("  je .L.else.%s.%04d", ctx->funcname, else_label); // false(== 0)ならelseにジャンプ
           gen(node->then);                         // true節のコード生成
-          printfln("  jmp .L.end.%04d", end_label); // true節のコードが終わったのでif文抜ける
-          printfln(".L.else.%04d:", else_label); // elseのときの飛崎
+          restore_spilled(spilled);
+          emitfln("  jmp .L.end.%s.%04d", ctx->funcname, end_label); // true節のコードが終わったのでif文抜ける
+          emitfln(".L.else.%s.%04d:", ctx->funcname, else_label); // elseのときの飛崎
+          ctx->depth = depth;
           gen(node->els);                      // false節のコード生成
-          printfln(".L.end.%04d:", end_label); // elseのときの飛崎
+          restore_spilled(spilled);
+          emitfln(".L.end.%s.%04d:", ctx->funcname, end_label); // elseのときの飛崎
         } else {
           // else なしの if
-          printfln("  pop rax"); // 条件式の結果をraxにロード
-          printfln("  cmp rax, 0"); // 条件式の結果チェック
           int end_label = next_label_key();
-          printfln("  je .L.end.%04d", end_label); // false(rax == 0)ならwhile終了なのでジャンプ
+          emitfln("  je .L.end.%s.%04d", ctx->funcname, end_label); // false(== 0)ならif文を抜ける
           gen(node->then);                       // true節のコード生成
-          printfln(".L.end.%04d:", end_label); // elseのときの飛び先
+          restore_spilled(spilled);
+          emitfln(".L.end.%s.%04d:", ctx->funcname, end_label); // elseのときの飛び先
         }
-        printfln("  # ND_IF(ND_TERNARY) end");
+        emitln("  # ND_IF(ND_TERNARY) end");
       }
       return;
     case ND_WHILE:
       {
-        printfln("  # ND_WHILE start");
+        emitln("  # ND_WHILE start");
         int begin_label = next_label_key();
         int while_body_label = next_label_key();
-        int continue_seq_backup = current_continue_jump_seq;
-        current_continue_jump_seq = begin_label;
+        int continue_seq_backup = ctx->continue_seq;
+        ctx->continue_seq = begin_label;
         if (node->is_do_while) {
           // do while分の場合は初回の条件式のチェックはスキップしてbodyのコードにジャンプ
-          printfln("  jmp .L.while_body.%04d", while_body_label);
+          emitfln("  jmp .L.while_body.%s.%04d", ctx->funcname, while_body_label);
         }
-        printfln(".L.continue.%04d:", begin_label);
-        printfln("  # ND_WHILE condition start");
+        emitfln(".L.continue.%s.%04d:", ctx->funcname, begin_label);
+        emitln("  # ND_WHILE condition start");
         gen(node->cond); // 条件式のコード生成
-        printfln("  # ND_WHILE condition end");
-        printfln("  pop rax"); // 条件式の結果をraxにロード
-        printfln("  cmp rax, 0"); // 条件式の結果チェック
+        emitln("  # ND_WHILE condition end");
+        cmp_zero_and_pop(); // 条件式の結果チェック
         int end_label = next_label_key();
         // breakのノードでジャンプできるようにこのラベルの値をこのループでのスコープみたいに使う
-        int break_seq_backup = current_break_jump_seq;
-        current_break_jump_seq = end_label;
-        printfln("  je .L.break.%04d", end_label); // false(rax == 0)ならwhile終了なのでジャンプ
-        printfln("  # ND_WHILE body start");
-        printfln(".L.while_body.%04d:", while_body_label); // do 〜 while() のときに実行開始位置(初回の条件チェックを省く)
+        int break_seq_backup = ctx->break_seq;
+        ctx->break_seq = end_label;
+        emitfln("  je .L.break.%s.%04d", ctx->funcname, end_label); // false(== 0)ならwhile終了なのでジャンプ
+        emitln("  # ND_WHILE body start");
+        emitfln(".L.while_body.%s.%04d:", ctx->funcname, while_body_label); // do 〜 while() のときに実行開始位置(初回の条件チェックを省く)
         gen(node->body); // whileの本体実行
-        printfln("  # ND_WHILE body end");
-        printfln("  jmp .L.continue.%04d", begin_label); //繰り返し
-        printfln(".L.break.%04d:", end_label);
-        printfln("  # ND_WHILE end");
+        emitln("  # ND_WHILE body end");
+        emitfln("  jmp .L.continue.%s.%04d", ctx->funcname, begin_label); //繰り返し
+        emitfln(".L.break.%s.%04d:", ctx->funcname, end_label);
+        emitln("  # ND_WHILE end");
         // break用のseqを元に戻す
-        current_break_jump_seq = break_seq_backup;
-        current_continue_jump_seq = continue_seq_backup;
+        ctx->break_seq = break_seq_backup;
+        ctx->continue_seq = continue_seq_backup;
       }
       return;
     case ND_FOR:
       {
-        printfln("  # ND_FOR start");
+        emitln("  # ND_FOR start");
         int begin_label = next_label_key();
         int end_label = next_label_key();
         int continue_label = next_label_key();
 
         // breakのノードでジャンプできるようにこのラベルの値をこのループでのスコープみたいに使う
-        int break_seq_backup = current_break_jump_seq;
-        current_break_jump_seq = end_label;
+        int break_seq_backup = ctx->break_seq;
+        ctx->break_seq = end_label;
 
-        int continue_seq_backup = current_continue_jump_seq;
-        current_continue_jump_seq = continue_label;
+        int continue_seq_backup = ctx->continue_seq;
+        ctx->continue_seq = continue_label;
 
         // 初期化式
         if (node->init) {
           gen(node->init);
         }
-        printfln(".L.begin.%04d:", begin_label);
+        emitfln(".L.begin.%s.%04d:", ctx->funcname, begin_label);
         // 条件式
         if (node->cond) {
           gen(node->cond);
-          printfln("  pop rax"); // 条件式の結果をraxにロード
-          printfln("  cmp rax, 0"); // 条件式の結果チェック
-          printfln("  je .L.break.%04d", end_label); // false(rax == 0)ならwhile終了なのでジャンプ
+          cmp_zero_and_pop(); // 条件式の結果チェック
+          emitfln("  je .L.break.%s.%04d", ctx->funcname, end_label); // false(== 0)ならfor終了なのでジャンプ
         }
         // for の中身のアセンブラ
         gen(node->body);
 
         // continue用に継続式の直前にジャンプするラベルを作っておく
-        printfln(".L.continue.%04d:", continue_label);
+        emitfln(".L.continue.%s.%04d:", ctx->funcname, continue_label);
         // 継続式
         if (node->inc) {
           gen(node->inc);
         }
-        printfln("  jmp .L.begin.%04d", begin_label); //繰り返し
-        printfln(".L.break.%04d:", end_label);
+        emitfln("  jmp .L.begin.%s.%04d", ctx->funcname, begin_label); //繰り返し
+        emitfln(".L.break.%s.%04d:", ctx->funcname, end_label);
 
         // break用のseqを元に戻す
-        current_break_jump_seq = break_seq_backup;
-        current_continue_jump_seq = continue_seq_backup;
+        ctx->break_seq = break_seq_backup;
+        ctx->continue_seq = continue_seq_backup;
 
-        printfln("  # ND_FOR end");
+        emitln("  # ND_FOR end");
       }
       return;
     case ND_SWITCH:
       {
-        printfln("  # ND_SWITCH start");
+        emitln("  # ND_SWITCH start");
 
-        int break_seq_backup = current_break_jump_seq;
-        int case_label = current_break_jump_seq = next_label_key();
+        int break_seq_backup = ctx->break_seq;
+        int case_label = ctx->break_seq = next_label_key();
 
         //switchの条件式のコードを生成
         gen(node->lhs);
-        printfln("  pop rax");
+        need(1);
+        char *r = top_reg(0);
+        pop_reg();
         // まずdefault以外のジャンプを生成
         for (Node *n = node->case_next; n; n = n->case_next) {
             // caseの式に等しい場合該当のコードへジャンプする式を生成
-            printfln("  cmp rax, %ld", n->case_cond_val);
-            printfln("  je .L.case.%04d.%ld", case_label, n->case_cond_val);
+            emit_op_num("cmp", r, n->case_cond_val);
+            emitfln("  je .L.case.%s.%04d.%ld", ctx->funcname, case_label, n->case_cond_val);
         }
         if (node->default_case) {
           // defaultがあれば、defaultへのジャンプ式を生成して抜ける
-          printfln("  jmp .L.case.%04d.default", case_label);
+          emitfln("  jmp .L.case.%s.%04d.default", ctx->funcname, case_label);
         } else {
           // defaultがなければswitchの最後にジャンプ
-          printfln("  jmp .L.break.%04d", current_break_jump_seq);
+          emitfln("  jmp .L.break.%s.%04d", ctx->funcname, ctx->break_seq);
         }
         // switchの中身のコード生成
         gen(node->body);
 
         // switch中でのブレイクの飛び先のラベル生成
-        printfln(".L.break.%04d:", current_break_jump_seq);
-        current_break_jump_seq = break_seq_backup;
-        printfln("  # ND_SWITCH end");
+        emitfln(".L.break.%s.%04d:", ctx->funcname, ctx->break_seq);
+        ctx->break_seq = break_seq_backup;
+        emitln("  # ND_SWITCH end");
       }
       return;
     case ND_CASE:
       if (node->is_default_case) {
-        printfln(".L.case.%04d.default:", current_break_jump_seq);
+        emitfln(".L.case.%s.%04d.default:", ctx->funcname, ctx->break_seq);
       } else {
-        printfln(".L.case.%04d.%ld:", current_break_jump_seq, node->case_cond_val);
+        emitfln(".L.case.%s.%04d.%ld:", ctx->funcname, ctx->break_seq, node->case_cond_val);
       }
       gen(node->lhs);
       return;
     case ND_BREAK:
-      if (!current_break_jump_seq) {
+      if (!ctx->break_seq) {
         error("不正なbreakです");
       }
-      printfln("  jmp .L.break.%04d", current_break_jump_seq);
+      emitfln("  jmp .L.break.%s.%04d", ctx->funcname, ctx->break_seq);
       return;
     case ND_CONTINUE:
-      if (!current_continue_jump_seq) {
+      if (!ctx->continue_seq) {
         error("不正なcontinueです");
       }
-      printfln("  jmp .L.continue.%04d", current_continue_jump_seq);
+      emitfln("  jmp .L.continue.%s.%04d", ctx->funcname, ctx->continue_seq);
       return;
     case ND_GOTO:
-      printfln("  jmp .L.goto.%s.%s", funcname, node->label_name);
+      emitfln("  jmp .L.goto.%s.%s", ctx->funcname, node->label_name);
       return;
     case ND_LABEL:
-      printfln(".L.goto.%s.%s:", funcname, node->label_name);
+      emitfln(".L.goto.%s.%s:", ctx->funcname, node->label_name);
       gen(node->lhs);
       return;
     case ND_CALL:
       {
-        if (!strcmp(node->funcname, "__builtin_va_start")) {
-          printfln("  # __builtin_va_start");
-          printfln("  pop rax");
-          printfln("  mov r10, [rbp]"); // va_list を呼んだ関数のrbp取得
-          printfln("  mov edi, [r10-8]"); // 引数の数*8の値
+        if (node->funcname == builtin_va_start_name) {
+          emitln("  # __builtin_va_start");
+          // 引数の va_list のアドレスをそのままこの式の値にする
+          gen(node->arg);
+          need(1);
+          emit_op("mov", "rax", top_reg(0));
+          emitln("  mov rdx, [rbp]"); // va_list を呼んだ関数のrbp取得
+          emitln("  mov ecx, [rdx-8]"); // 引数の数*8の値
 
           // gp_offset
-          printfln("  mov dword ptr [rax], edi");
+          emitln("  mov dword ptr [rax], ecx");
 
           // fp_offset
-          printfln("  mov dword ptr [rax+4], 48");
+          emitln("  mov dword ptr [rax+4], 48");
 
           // overflow_arg_area
           // gcc でrbpの16バイト手前を渡してたので同じようにする
           // rbpの場所からみて16バイト上(リターンアドレス8バイトはさんでさらに8バイト上のアドレス)がスタック経由で渡される引数(７番目以降になる)
-          printfln("  mov qword ptr [rax+8], r10");
-          printfln("  add qword ptr [rax+8], 16");
+          emitln("  mov qword ptr [rax+8], rdx");
+          emitln("  add qword ptr [rax+8], 16");
 
           // reg_save_area
           // 引数をのレジスタをスタックに保存した先頭アドレス
           // rbpから レジスタの数(6) + 引数の個数情報(1) の (6+1)*8=56の位置から始まる
-          printfln("  mov qword ptr [rax+16], r10");
-          printfln("  sub qword ptr [rax+16], 56");
+          emitln("  mov qword ptr [rax+16], rdx");
+          emitln("  sub qword ptr [rax+16], 56");
           return;
         }
 
@@ -471,31 +827,42 @@ static void gen(Node *node) {
         // の
         // Figure 3.4: Register Usage
         // を参照(引数1から引数6までは rdi, rsi, rdx, rcx, r8, r9の順に積む)
-        printfln("  # ND_CALL start");
+        emitln("  # ND_CALL start");
+        int base = ctx->depth;
         if (node->funcarg_num > 0) {
           Node *cur = node->arg;
 
           for (int i = 0; i < node->funcarg_num; i++) {
-            // 引数のアセンブリを出力(どんどん引数の式の値がスタックに積まれる)
-            // 逆順に評価してスタックに詰んでいく(node->argが呼び出し時の引数の逆順のリストになっている)
-            printfln("  # func call argument %d", (node->funcarg_num - i));
+            // 引数のアセンブリを出力(どんどん引数の式の値が値スタックに積まれる)
+            // 逆順に評価して積んでいく(node->argが呼び出し時の引数の逆順のリストになっている)
+            emitln_num("  # func call argument ", (node->funcarg_num - i));
             gen(cur);
             cur = cur->next;
           }
+        }
 
-          // スタックから引数用のレジスタに値をロード
-          for (int i = 0; i < node->funcarg_num; i++) {
-            if (i >= 6) {
-              // 7個目以上の引数はそのままスタックに載せた状態で関数にわたす
-              //
-              // とりあえずスタックに載せた状態にしておくが、実際に関数呼び出しの際は、
-              // さらに16バイト境界のアラインメント調整がrspにかかるので、その調整後のrspが７番目の引数を指すように後で調整し直す。
-              break;
-            }
-            printfln("  # load argument %d to register", i + 1);
-            printfln("  pop %s", ARGUMENT_REGISTERS_SIZE8[i]);
+        // 値スタックのレジスタは関数呼び出しで壊れるので、引数も含めて全部ハードウェアのスタックに退避する
+        // (引数は第1引数がスタックの先頭に来る)
+        while (ctx->spilled < ctx->depth) {
+          spill_bottom();
+        }
+
+        // スタックから引数用のレジスタに値をロード
+        for (int i = 0; i < node->funcarg_num; i++) {
+          if (i >= 6) {
+            // 7個目以上の引数はそのままスタックに載せた状態で関数にわたす
+            //
+            // とりあえずスタックに載せた状態にしておくが、実際に関数呼び出しの際は、
+            // さらに16バイト境界のアラインメント調整がrspにかかるので、その調整後のrspが７番目の引数を指すように後で調整し直す。
+            break;
           }
+          emitfln("  # load argument %d to register", i + 1);
+          emitln_str("  pop ", ARGUMENT_REGISTERS_SIZE8[i]);
         }
+        // 引数の分は値スタックから取り除く(退避した値はスタック渡しの引数の下に残っている)
+        ctx->depth = base;
+        ctx->spilled = base;
+
         // 関数呼び出し前にスタックポインタ(rsp)が16バイト境界にあるように調整する
         // rspの下位4bitが0かどうか(=16の倍数かどうか調べた上で)
         // - 16の倍数だった
@@ -505,22 +872,22 @@ static void gen(Node *node) {
         //    1 0 0 0
         //   なので、スタックをさらに8バイト伸ばせして(=rspを減らして)16の倍数にしたうえでcallして戻ってきてからもとに戻す
         int seq = next_label_key();
-        printfln("  mov rax, rsp");
-        printfln("  and rax, 15"); // 15 == 0b1111
-        printfln("  jnz .L.stack_adjusted_call.%04d", seq); // 0じゃない==16の倍数じゃない、ので調整してから呼ぶ方にジャンプ
+        emitln("  mov rax, rsp");
+        emitln("  and rax, 15"); // 15 == 0b1111
+        emitfln("  jnz .L.stack_adjusted_call.%s.%04d", ctx->funcname, seq); // 0じゃない==16の倍数じゃない、ので調整してから呼ぶ方にジャンプ
         // ここに来た場合は、rspが16バイト境界にあるので、単にコールする
         // printfを呼ぶときは、 al レジスタに浮動小数点の可変長引数の数をalレジスタに入れておく必要があるが
         // 現状は浮動小数点が無いので、固定で0をいれておく
-        printfln("  xor al, al");
-        printfln("  call %s", node->funcname);
+        emitln("  xor al, al");
+        emitln_str("  call ", node->funcname);
         // 関数呼び出しの後のコードにジャンプ
-        printfln("  jmp .L.end_call.%04d", seq);
+        emitfln("  jmp .L.end_call.%s.%04d", ctx->funcname, seq);
         // ここに来た場合は、rspが16バイト境界にないので調整してから関数呼び出しする
-        printfln(".L.stack_adjusted_call.%04d:", seq);
-        printfln("  sub rsp, 8"); // rspが8の倍数になっているので、8バイト伸ばして16の倍数に調整
+        emitfln(".L.stack_adjusted_call.%s.%04d:", ctx->funcname, seq);
+        emitln("  sub rsp, 8"); // rspが8の倍数になっているので、8バイト伸ばして16の倍数に調整
 
         // ここでスタックを8バイト伸ばしたことによって、関数呼び出し前のスタックトップにのっていた7番目以降の引数の場所がずれてしまうので、7番目以降の引数を8バイトずつずらす
-        printfln("# adjust 7th arg pos start");
+        emitln("# adjust 7th arg pos start");
 
         // この処理の直前の sub rsp, 8 によって
         //
@@ -548,42 +915,42 @@ static void gen(Node *node) {
 
         int rest_args = node->funcarg_num - 6;
         for (int i = 0; i < rest_args; i++) {
-          printfln(" mov rax, [rsp + %d]", 8 * (i + 1));
-          printfln(" mov [rsp + %d], rax", 8 * i);
+          emitfln(" mov rax, [rsp + %d]", 8 * (i + 1));
+          emitfln(" mov [rsp + %d], rax", 8 * i);
         }
-        printfln("# adjust 7th arg pos end");
+        emitln("# adjust 7th arg pos end");
 
-        printfln("  xor al, al"); // alのクリアについては上のcall命令参照
-        printfln("  call %s", node->funcname);
-        printfln("  add rsp, 8"); // 関数呼び出し後、rspをもとに戻す
-        printfln(".L.end_call.%04d:", seq);
+        emitln("  xor al, al"); // alのクリアについては上のcall命令参照
+        emitln_str("  call ", node->funcname);
+        emitln("  add rsp, 8"); // 関数呼び出し後、rspをもとに戻す
+        emitfln(".L.end_call.%s.%04d:", ctx->funcname, seq);
         if (node->ty->kind == TY_BOOL) {
           // boolを返す場合にx86-64の規約で、値として意味がある下位8bit以外の上位56bitを全部ゼロにしないといけないらしい
-          printfln("  movzb rax, al");
+          emitln("  movzb rax, al");
         }
         // スタック渡しで渡していた７個目移行の引数の領域を破棄する
         if (node->funcarg_num > 6) {
-          printfln("  add rsp, %d", (node->funcarg_num - 6) * 8);
+          emitln_num("  add rsp, ", (node->funcarg_num - 6) * 8);
         }
 
-        printfln("  push rax"); // 関数の戻り値をスタックに積む
-        printfln("  # ND_CALL end");
+        emit_op("mov", push_reg(), "rax"); // 関数の戻り値を値スタックに積む
+        emitln("  # ND_CALL end");
       }
       return;
     case ND_ADDR:
-      printfln("  # ND_ADDR start");
+      emitln("  # ND_ADDR start");
       gen_addr(node->lhs);
-      printfln("  # ND_ADDR end");
+      emitln("  # ND_ADDR end");
       return;
     case ND_DEREF:
-      printfln("  # ND_DEREF start");
+      emitln("  # ND_DEREF start");
       gen(node->lhs);
       if (node->ty->kind != TY_ARRAY) {
-        // 配列以外の場合は、識別子が指すアドレスにある値(がアドレスなので)それをスタックにつむところまでやるが、だが、
-        // 配列の場合は、識別子が指すアドレス自体をスタックにつみたいので、そうする。
+        // 配列以外の場合は、識別子が指すアドレスにある値(がアドレスなので)それを積むところまでやるが、だが、
+        // 配列の場合は、識別子が指すアドレス自体を積みたいので、そうする。
         load(node->ty);
       }
-      printfln("  # ND_DEREF end");
+      emitln("  # ND_DEREF end");
       return;
     case ND_VAR_DECL:
       if (node->initializer) {
@@ -593,7 +960,7 @@ static void gen(Node *node) {
     case ND_EXPR_STMT:
       gen(node->lhs);
       // 式文なので、結果を捨てる
-      printfln("  add rsp, 8");
+      pop_reg();
       return;
     case ND_CAST:
       gen(node->lhs);
@@ -604,33 +971,49 @@ static void gen(Node *node) {
       gen(node->rhs);
       return;
     case ND_PRE_INC:
+      if (is_reg_var(node->lhs)) {
+        gen_reg_var_inc(node->lhs->var, inc_size(node->ty), false);
+        return;
+      }
       gen_addr(node->lhs);
-      printfln("  push [rsp]");
+      dup_top();
       load(node->ty);
       inc(node->ty);
       store(node->ty);
       return;
     case ND_PRE_DEC:
+      if (is_reg_var(node->lhs)) {
+        gen_reg_var_inc(node->lhs->var, -inc_size(node->ty), false);
+        return;
+      }
       gen_addr(node->lhs);
-      printfln("  push [rsp]");
+      dup_top();
       load(node->ty);
       dec(node->ty);
       store(node->ty);
       return;
     case ND_POST_INC:
+      if (is_reg_var(node->lhs)) {
+        gen_reg_var_inc(node->lhs->var, inc_size(node->ty), true);
+        return;
+      }
       gen_addr(node->lhs);
-      printfln("  push [rsp]");
+      dup_top();
       load(node->ty);
       inc(node->ty);
       store(node->ty);
       // x = i++;
       // のようなケースでは、 変数iの値自体はインクリメントするが、
-      // xに設定される値としては、インクリメント前の値なのでスタックの値だけデクリメントしてもとに戻す
+      // xに設定される値としては、インクリメント前の値なので値だけデクリメントしてもとに戻す
       dec(node->ty);
       return;
     case ND_POST_DEC:
+      if (is_reg_var(node->lhs)) {
+        gen_reg_var_inc(node->lhs->var, -inc_size(node->ty), true);
+        return;
+      }
       gen_addr(node->lhs);
-      printfln("  push [rsp]");
+      dup_top();
       load(node->ty);
       dec(node->ty);
       store(node->ty);
@@ -638,71 +1021,77 @@ static void gen(Node *node) {
       return;
     case ND_NOT:
       gen(node->lhs);
-      printfln("  pop rax");
-      printfln("  cmp rax, 0");
-      // cmp の比較で rax == 0 のときだけ raxの下位8bitに1をセット
-      printfln("  sete al");
-      // raxの上位56bitはクリアして1を代入
-      printfln("  movzb rax, al");
-      printfln("  push rax");
+      need(1);
+      emit_op("cmp", top_reg(0), "0");
+      // cmp の比較で == 0 のときだけ alに1をセット
+      emitln("  sete al");
+      // 上位56bitはクリアして1を代入
+      emit_op("movzb", top_reg(0), "al");
       return;
     case ND_BIT_NOT:
       gen(node->lhs);
-      printfln("  pop rax");
-      printfln("  not rax");
-      printfln("  push rax");
+      need(1);
+      emitln_str("  not ", top_reg(0));
       return;
     case ND_OR:
       {
         // 左の項が0じゃなかったらその時点で右の項は評価せずに1を返すようにする
         int label_key = next_label_key();
+        // どの経路から合流しても結果が同じレジスタに入るように、結果のレジスタを先に空けておく
+        reserve_reg();
+        int spilled = ctx->spilled;
         // 左の項のチェック
         gen(node->lhs);
-        printfln("  pop rax");
-        printfln("  cmp rax, 0");
-        // 0じゃなかったらtrue(1)をスタックに乗せる
-        printfln("  jne .L._true.%04d._true", label_key);
+        cmp_zero_and_pop();
+        restore_spilled(spilled);
+        // 0じゃなかったらtrue(1)を積む
+        emitfln("  jne .L._true.%s.%04d._true", ctx->funcname, label_key);
         // 右の項のチェック
         gen(node->rhs);
-        printfln("  pop rax");
-        printfln("  cmp rax, 0");
-        printfln("  jne .L._true.%04d._true", label_key);
+        cmp_zero_and_pop();
+        restore_spilled(spilled);
+        emitfln("  jne .L._true.%s.%04d._true", ctx->funcname, label_key);
         // 左も右も両方0だったのでorの結果として0をいれて終了ラベルに飛ぶ
-        printfln("  push 0");
-        printfln("  jmp .L.end.%04d._true", label_key);
-        printfln(".L._true.%04d._true:", label_key);
-        printfln("  push 1");
-        printfln(".L.end.%04d._true:", label_key);
+        char *r = push_reg();
+        emit_op("mov", r, "0");
+        emitfln("  jmp .L.end.%s.%04d._true", ctx->funcname, label_key);
+        emitfln(".L._true.%s.%04d._true:", ctx->funcname, label_key);
+        emit_op("mov", r, "1");
+        emitfln(".L.end.%s.%04d._true:", ctx->funcname, label_key);
       }
       return;
     case ND_AND:
       {
         // 左の項が0だったらその時点で右の項は評価せずに0を返すようにする
         int label_key = next_label_key();
+        // どの経路から合流しても結果が同じレジスタに入るように、結果のレジスタを先に空けておく
+        reserve_reg();
+        int spilled = ctx->spilled;
         // 左の項のチェック
         gen(node->lhs);
-        printfln("  pop rax");
-        printfln("  cmp rax, 0");
-        // 0だったらfalse(0)をスタックに乗せる
-        printfln("  je .L._false.%04d._true", label_key);
+        cmp_zero_and_pop();
+        restore_spilled(spilled);
+        // 0だったらfalse(0)を積む
+        emitfln("  je .L._false.%s.%04d._true", ctx->funcname, label_key);
         // 右の項のチェック
         gen(node->rhs);
-        printfln("  pop rax");
-        printfln("  cmp rax, 0");
-        // 0だったらfalse(0)をスタックに乗せる
-        printfln("  je .L._false.%04d._true", label_key);
+        cmp_zero_and_pop();
+        restore_spilled(spilled);
+        // 0だったらfalse(0)を積む
+        emitfln("  je .L._false.%s.%04d._true", ctx->funcname, label_key);
         // 左も右も0じゃなかったので、andの結果として1を入れて終了ラベルに飛ぶ
-        printfln("  push 1");
-        printfln("  jmp .L.end.%04d._true", label_key);
-        printfln(".L._false.%04d._true:", label_key);
-        printfln("  push 0");
-        printfln(".L.end.%04d._true:", label_key);
+        char *r = push_reg();
+        emit_op("mov", r, "1");
+        emitfln("  jmp .L.end.%s.%04d._true", ctx->funcname, label_key);
+        emitfln(".L._false.%s.%04d._true:", ctx->funcname, label_key);
+        emit_op("mov", r, "0");
+        emitfln(".L.end.%s.%04d._true:", ctx->funcname, label_key);
 
       }
       return;
     case ND_NULL:
       // typedef でパース時のみ発生し具体的なコード生成が無いノード
-      printfln("  # ND_NULL ");
+      emitln("  # ND_NULL ");
       return;
     default:
       // 上記以外の場合二項演算
@@ -715,23 +1104,24 @@ static void gen_bin_op(Node *node) {
   gen(node->lhs);
   gen(node->rhs);
 
-  printfln("  pop rdi");
-  printfln("  pop rax");
+  need(2);
+  char *rd = top_reg(1); // 左辺の値(結果もここに入れる)
+  char *rs = top_reg(0); // 右辺の値
 
   switch (node->kind) {
     case ND_ADD:
-      printfln("  add rax, rdi");
+      emit_op("add", rd, rs);
       break;
     case ND_PTR_ADD:
-      printfln("  imul rdi, %d", node->ty->ptr_to->size);
-      printfln("  add rax, rdi");
+      emit_op_num("imul", rs, node->ty->ptr_to->size);
+      emit_op("add", rd, rs);
       break;
     case ND_SUB:
-      printfln("  sub rax, rdi");
+      emit_op("sub", rd, rs);
       break;
     case ND_PTR_SUB:
-      printfln("  imul rdi, %d", node->ty->ptr_to->size);
-      printfln("  sub rax, rdi");
+      emit_op_num("imul", rs, node->ty->ptr_to->size);
+      emit_op("sub", rd, rs);
       break;
     case ND_PTR_DIFF:
       // 普通に引き算した結果をポインタの指す先の型のサイズで割って、個数に変換
@@ -741,85 +1131,108 @@ static void gen_bin_op(Node *node) {
       // int z = third - ary;
       // z が 3になるようにする。
       //
-      // rax - rdi
-      // の結果が
-      // rax
-      // に入るので、
-      // raxをlhsのポインターが指す型のサイズで割った商をraxに入れる。
-      // このため、割る数(rdi)に「ポインターが指す方のサイズ」を設定する必要がある
-      printfln("  sub rax, rdi");
-      printfln("  cqo");
-      printfln("  mov rdi, %d", node->lhs->ty->ptr_to->size);
-      printfln("  idiv rdi");
+      // 引き算の結果をlhsのポインターが指す型のサイズで割った商を結果にする。
+      // このため、割る数(rcx)に「ポインターが指す方のサイズ」を設定する必要がある
+      emit_op("sub", rd, rs);
+      emit_op("mov", "rax", rd);
+      emitln("  cqo");
+      emitln_num("  mov rcx, ", node->lhs->ty->ptr_to->size);
+      emitln("  idiv rcx");
+      emit_op("mov", rd, "rax");
       break;
     case ND_MUL:
-      printfln("  imul rax, rdi");
+      emit_op("imul", rd, rs);
       break;
     case ND_DIV:
-      printfln("  cqo");
-      printfln("  idiv rdi");
+      emit_op("mov", "rax", rd);
+      emitln("  cqo");
+      emitln_str("  idiv ", rs);
+      emit_op("mov", rd, "rax");
       break;
     case ND_MOD:
-      printfln("  cqo");
-      printfln("  idiv rdi");
-      printfln("  mov rax, rdx");
+      emit_op("mov", "rax", rd);
+      emitln("  cqo");
+      emitln_str("  idiv ", rs);
+      emit_op("mov", rd, "rdx");
       break;
     case ND_LT:
-      printfln("  cmp rax, rdi");
-      printfln("  setl al");
-      printfln("  movzb rax, al");
+      emit_op("cmp", rd, rs);
+      emitln("  setl al");
+      emit_op("movzb", rd, "al");
       break;
     case ND_LTE:
-      printfln("  cmp rax, rdi");
-      printfln("  setle al");
-      printfln("  movzb rax, al");
+      emit_op("cmp", rd, rs);
+      emitln("  setle al");
+      emit_op("movzb", rd, "al");
       break;
     case ND_EQL:
-      printfln("  cmp rax, rdi");
-      printfln("  sete al");
-      printfln("  movzb rax, al");
+      emit_op("cmp", rd, rs);
+      emitln("  sete al");
+      emit_op("movzb", rd, "al");
       break;
     case ND_NOT_EQL:
-      printfln("  cmp rax, rdi");
-      printfln("  setne al");
-      printfln("  movzb rax, al");
+      emit_op("cmp", rd, rs);
+      emitln("  setne al");
+      emit_op("movzb", rd, "al");
       break;
     case ND_BIT_AND:
-      printfln("  and rax, rdi");
+      emit_op("and", rd, rs);
       break;
     case ND_BIT_OR:
-      printfln("  or rax, rdi");
+      emit_op("or", rd, rs);
       break;
     case ND_BIT_XOR:
-      printfln("  xor rax, rdi");
+      emit_op("xor", rd, rs);
       break;
     case ND_A_LSHIFT:
       // シフトする数はcl(rcxの下位8bit)に設定すると決まってるらしい
-      printfln("  mov cl, dil");
-      printfln("  sal rax, cl");
+      emit_op("mov", "rcx", rs);
+      emit_op("sal", rd, "cl");
       break;
     case ND_A_RSHIFT:
-      printfln("  mov cl, dil");
-      printfln("  sar rax, cl");
+      emit_op("mov", "rcx", rs);
+      emit_op("sar", rd, "cl");
       break;
     default:
       error("予期しないNodeです。 kind: %d", node->kind);
   }
-  printfln("  push rax");
+  pop_reg();
 }
 
 static void codegen_func(Function *func) {
-  funcname = func->name;
+  run_ast_passes(func);
+
+  if (opt_level >= 1 && ir_supported(func)) {
+    // 可変長引数を扱う関数以外はIRを経由してコード生成する
+    ir_codegen_func(func);
+    return;
+  }
+
+  CodegenContext func_ctx = {};
+  func_ctx.funcname = func->name;
+  // break可能なseq(forやwhileに入った後に使われるbreak)を判断できるように
+  // 初期値を1にして0の場合はトップレベルに出てきたbreak(=不正なbreak)とみなす
+  func_ctx.label_index = 1;
+  ctx = &func_ctx;
+
+  pass_begin(PASS_REGVAR);
+  int nregs = assign_var_registers(func);
+  pass_end(PASS_REGVAR);
+
   if (!func->is_staitc) {
-    printfln(".global %s", func->name);
+    emitln_str(".global ", func->name);
   }
-  printfln("%s:", func->name);
+  emitfln("%s:", func->name);
   // プロローグ
   // rbp初期化とローカル変数確保
-  printfln("  push rbp"); // 前の関数呼び出しでのrbpをスタックに対比
-  printfln("  mov rbp, rsp"); // この関数呼び出しでのベースポインタ設定
+  emitln("  push rbp"); // 前の関数呼び出しでのrbpをスタックに対比
+  emitln("  mov rbp, rsp"); // この関数呼び出しでのベースポインタ設定
   // 使用されているローカル変数の数分、領域確保(ここに引数の値を保存する領域も確保される)
-  printfln("  sub rsp, %d", func->stack_size);
+  // 変数を置く callee-saved レジスタの元の値はローカル変数の下に保存する
+  emitln_num("  sub rsp, ", func->stack_size + nregs * 8);
+  for (int i = 0; i < nregs; i++) {
+    emitfln("  mov [rbp-%d], %s", func->stack_size + (i + 1) * 8, VAR_REGISTERS_SIZE8[i]);
+  }
 
   // paramsが引数を逆順に保持しているので、ロードするレジスタも逆順にする。そのため一度引数の数を数える
   int param_len = 0;
@@ -829,35 +1242,43 @@ static void codegen_func(Function *func) {
 
   // レジスタから引数の情報をスタックに確保
   if (func->has_vararg) {
-    printfln("  mov dword ptr [rbp-8], %d", param_len * 8);
-    printfln("  mov [rbp-16], r9");
-    printfln("  mov [rbp-24], r8");
-    printfln("  mov [rbp-32], rcx");
-    printfln("  mov [rbp-40], rdx");
-    printfln("  mov [rbp-48], rsi");
-    printfln("  mov [rbp-56], rdi");
+    emitln_num("  mov dword ptr [rbp-8], ", param_len * 8);
+    emitln("  mov [rbp-16], r9");
+    emitln("  mov [rbp-24], r8");
+    emitln("  mov [rbp-32], rcx");
+    emitln("  mov [rbp-40], rdx");
+    emitln("  mov [rbp-48], rsi");
+    emitln("  mov [rbp-56], rdi");
   }
 
   int i = param_len - 1;
   for (VarList *v = func->params; v; v = v->next) {
-    if (i >= 6) {
+    if (v->var->reg) {
+      // レジスタに置く引数は引数の型の値にそろえておく
+      if (i >= 6) {
+        emitfln("  mov %s, [rbp+%d]", var_reg(v->var), 16 + (i - 6) * 8);
+      } else {
+        emit_op("mov", var_reg(v->var), ARGUMENT_REGISTERS_SIZE8[i]);
+      }
+      extend_var_reg(v->var);
+    } else if (i >= 6) {
       // 7個以上(indexベースでいうと6以上)の引数は、スタックから取得する
 
       // 7個目の引数は、この関数のスタックフレームの外(呼び出した側のスタック)にあるので、
       // リターンアドレス(=rbp + 8)の次(rbp + 16)からのオフセットで7個目以上の引数のアドレスを計算
-      printfln("  mov rax, [rbp+%d]", 16 + (i - 6) * 8);
-      printfln("  mov [rbp-%d], rax", v->var->offset);
+      emitfln("  mov rax, [rbp+%d]", 16 + (i - 6) * 8);
+      emitfln("  mov [rbp-%d], rax", v->var->offset);
     } else {
       int sz = v->var->type->size;
       if (sz == 1) {
-        printfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE1[i]);
+        emitfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE1[i]);
       } else if (sz == 2) {
-        printfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE2[i]);
+        emitfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE2[i]);
       } else if (sz == 4) {
-        printfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE4[i]);
+        emitfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE4[i]);
       } else if (sz == 8) {
         assert(sz == 8);
-        printfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE8[i]);
+        emitfln("  mov [rbp-%d], %s", v->var->offset, ARGUMENT_REGISTERS_SIZE8[i]);
       } else {
         assert(false);
       }
@@ -869,22 +1290,51 @@ static void codegen_func(Function *func) {
   // 先頭の文からコード生成
   for (Node *n = func->body; n; n = n->next) {
     gen(n);
+    // 文の終わりでは値スタックは空になっている
+    assert(ctx->depth == 0 && ctx->spilled == 0);
   }
 
   // エピローグ
   // rbpの復元と戻り値設定
   // 最後の演算結果が、rax(forの最後でpopしてるやつ)にロードされてるのでそれをmainの戻り値として返す
-  printfln(".L.return.%s:", func->name);
-  printfln("  mov rsp, rbp");
-  printfln("  pop rbp");
-  printfln("  ret");
+  emitfln(".L.return.%s:", func->name);
+  for (int i = 0; i < nregs; i++) {
+    emitfln("  mov %s, [rbp-%d]", VAR_REGISTERS_SIZE8[i], func->stack_size + (i + 1) * 8);
+  }
+  emitln("  mov rsp, rbp");
+  emitln("  pop rbp");
+  emitln("  ret");
+}
+
+// 関数のコードがキャッシュにあればそれを出力し、なければ生成してキャッシュにも書く
+static void codegen_func_cached(Function *func) {
+  if (!func->cache_entry) {
+    codegen_func(func);
+    return;
+  }
+  if (cache_fetch_function(func->cache_entry)) {
+    return;
+  }
+
+  char *temp_path = cache_temp_path(func->cache_entry);
+  FILE *fp = fopen(temp_path, "w");
+  if (!fp) {
+    error("cannot open %s: %s", temp_path, strerror(errno));
+  }
+  emit_switch(fileno(fp));
+  codegen_func(func);
+  emit_restore();
+  fclose(fp);
+  cache_store(temp_path, func->cache_entry);
+  cache_emit(func->cache_entry);
+  free(temp_path);
 }
 
 static void codegen_data(Program *pgm) {
   for (VarList *v = pgm->global_var; v; v = v->next) {
     Var *var = v->var;
     if (!var->is_static) {
-      printfln(".global %s", var->name);
+      emitln_str(".global ", var->name);
     }
   }
 
@@ -897,7 +1347,7 @@ static void codegen_data(Program *pgm) {
   // http://blog.kmckk.com/archives/1242072.html
   // > .dataセクションに割り当られた変数はRAMだけでなく、その初期値の保持のためにROMも占有します。
   // とのことらしい
-  printfln(".bss");
+  emitln(".bss");
   for (VarList *v = pgm->global_var; v; v = v->next) {
     Var *var = v->var;
     if (!var->initializer) {
@@ -907,46 +1357,156 @@ static void codegen_data(Program *pgm) {
       // http://www.swlab.cs.okayama-u.ac.jp/~nom/lect/p3/what-is-directive.html
       // 参照
       // 上の説明では、mipsなので 「.align n が 2のn乗にアライン」とあるが、x86では単に「nバイトアライン」という意味らしい
-      printfln(".align %d", var->type->align);
-      printfln("%s:", var->name);
-      printfln("  .zero %d", var->type->size);
+      emitln_num(".align ", var->type->align);
+      emitfln("%s:", var->name);
+      emitln_num("  .zero ", var->type->size);
       continue;
     }
   }
 
-  printfln(".data");
+  emitln(".data");
   for (VarList *v = pgm->global_var; v; v = v->next) {
     Var *var = v->var;
     if (!var->initializer) {
       continue;
     }
 
-    printfln(".align %d", var->type->align);
-    printfln("%s:", var->name);
+    emitln_num(".align ", var->type->align);
+    emitfln("%s:", var->name);
     for (Initializer *i = var->initializer; i; i = i->next) {
       if (i->label) {
         // 別のグローバル変数の参照の場合
-        printfln("  .quad %s+%ld", i->label, i->addend);
+        emitfln("  .quad %s+%ld", i->label, i->addend);
       } else if (i->sz == 1) {
         // 文字の場合
-        printfln("  .byte %ld", i->val);
+        emitln_num("  .byte ", i->val);
       } else {
-        printfln("  .%dbyte %ld", i->sz, i->val);
+        emitfln("  .%dbyte %ld", i->sz, i->val);
+      }
+    }
+  }
+}
+
+// jobs 個のワーカープロセスで関数のコードを並列に生成する
+//
+// 関数は先頭から1個ずつ順番にワーカーに配り(大きな関数が1つのワーカーに偏らないように)、
+// 各ワーカーは担当した関数のコードを自分用の一時ファイルに、関数ごとのバイト数を別の一時ファイルに書く。
+// 全部のワーカーが終わったら、元の関数の順番で一時ファイルから出力にコピーする。
+static void codegen_text_parallel(Program *pgm, int nfuncs, int jobs) {
+  FILE **outs = calloc(jobs, sizeof(FILE *));
+  FILE **sizes = calloc(jobs, sizeof(FILE *));
+  int *pids = calloc(jobs, sizeof(int));
+
+  // 親のバッファに残っている分がワーカーに引き継がれないように先に書き出しておく
+  emit_flush();
+
+  for (int w = 0; w < jobs; w++) {
+    outs[w] = tmpfile();
+    sizes[w] = tmpfile();
+    if (!outs[w] || !sizes[w]) {
+      error("cannot create temporary file: %s", strerror(errno));
+    }
+
+    int pid = fork();
+    if (pid < 0) {
+      error("fork: %s", strerror(errno));
+    }
+    if (pid == 0) {
+      emit_redirect(fileno(outs[w]));
+      reset_pass_stats();
+      int worker = 0;
+      for (Function *f = pgm->functions; f; f = f->next) {
+        if (worker == w) {
+          long start = emit_size();
+          codegen_func_cached(f);
+          long size = emit_size() - start;
+          fwrite(&size, sizeof(long), 1, sizes[w]);
+        }
+        worker++;
+        if (worker == jobs) {
+          worker = 0;
+        }
+      }
+      emit_flush();
+      if (time_report_enabled()) {
+        // 関数ごとのバイト数の後ろに、--time-report 用にこのワーカーで使った時間を書く
+        write_worker_usage(sizes[w]);
+        write_pass_stats(sizes[w]);
       }
+      fclose(sizes[w]);
+      _exit(0);
+    }
+    pids[w] = pid;
+  }
+
+  bool failed = false;
+  for (int w = 0; w < jobs; w++) {
+    int status;
+    if (waitpid(pids[w], &status, 0) < 0 || status != 0) {
+      // エラーの内容はワーカーが表示している
+      failed = true;
+    }
+  }
+  if (failed) {
+    exit(1);
+  }
+
+  for (int w = 0; w < jobs; w++) {
+    lseek(fileno(outs[w]), 0, SEEK_SET);
+    fseek(sizes[w], 0, SEEK_SET);
+  }
+  int worker = 0;
+  for (int i = 0; i < nfuncs; i++) {
+    long size;
+    if (fread(&size, sizeof(long), 1, sizes[worker]) != 1) {
+      error("cannot read the size of generated code");
+    }
+    emit_copy(fileno(outs[worker]), size);
+    worker++;
+    if (worker == jobs) {
+      worker = 0;
     }
   }
+  if (time_report_enabled()) {
+    for (int w = 0; w < jobs; w++) {
+      add_worker_usage(sizes[w], PHASE_CODEGEN);
+      add_pass_stats(sizes[w]);
+    }
+  }
+
+  for (int w = 0; w < jobs; w++) {
+    fclose(outs[w]);
+    fclose(sizes[w]);
+  }
+  free(outs);
+  free(sizes);
+  free(pids);
 }
 
-static void codegen_text(Program *pgm) {
-  printfln(".text");
+static void codegen_text(Program *pgm, int jobs) {
+  emitln(".text");
+
+  int nfuncs = 0;
+  for (Function *f = pgm->functions; f; f = f->next) {
+    nfuncs++;
+  }
+  if (jobs > nfuncs) {
+    jobs = nfuncs;
+  }
+  if (jobs > 1) {
+    codegen_text_parallel(pgm, nfuncs, jobs);
+    return;
+  }
+
   for (Function *f = pgm->functions; f; f = f->next) {
-    codegen_func(f);
+    codegen_func_cached(f);
   }
 }
 
-void codegen(Program *pgm) {
-  printfln(".intel_syntax noprefix");
+// jobs が2以上なら関数のコード生成をその数のプロセスで並列に行う(出力は直列の場合と同じ)
+void codegen(Program *pgm, int jobs) {
+  emitln(".intel_syntax noprefix");
 
   codegen_data(pgm);
-  codegen_text(pgm);
+  codegen_text(pgm, jobs);
 }
@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ynicc.h"
+#include <unistd.h>
+
+// アセンブリの出力バッファ
+//
+// 以前は1行ごとに vprintf + putchar で標準出力に書いていたが、stdioのロックと書式の解析が
+// 命令1個ごとに走って遅いので、自前のバッファにためておき、いっぱいになったら write でまとめて書き出す。
+// 命令のほとんどは書式なしの固定文字列なので、emitln などの書式を解析しない関数で書き込む。
+
+enum {
+  // 出力バッファのサイズ
+  EMIT_BUFFER_SIZE = 1 << 16,
+  // emitfln でこれより空きが少なければ先に書き出しておく
+  EMIT_LINE_RESERVE = 1 << 10,
+};
+
+static char *emit_buf;
+static int emit_len;
+// 書き出し済みのバイト数
+static long emit_written;
+
+// 出力先のファイル(標準出力の場合はNULL)
+static FILE *emit_fp;
+static int emit_fd;
+
+// emit_switch で切り替える前の出力先
+static int saved_fd;
+static long saved_written;
+
+// 出力先を開く(path が NULL なら標準出力に書く)
+void emit_open(char *path) {
+  // --ast などでprintfした分を先に出しておかないと順番が入れ替わる
+  fflush(stdout);
+
+  if (path) {
+    emit_fp = fopen(path, "w");
+    if (!emit_fp) {
+      error("cannot open %s: %s", path, strerror(errno));
+    }
+    emit_fd = fileno(emit_fp);
+  } else {
+    emit_fp = NULL;
+    emit_fd = 1;
+  }
+
+  if (!emit_buf) {
+    emit_buf = calloc(EMIT_BUFFER_SIZE, sizeof(char));
+  }
+  emit_len = 0;
+  emit_written = 0;
+}
+
+// 以降の出力を fd に書く(並列にコード生成するワーカーが自分用の一時ファイルに書くのに使う)
+// 呼ぶ前にバッファは書き出しておくこと
+void emit_redirect(int fd) {
+  emit_fp = NULL;
+  emit_fd = fd;
+  emit_len = 0;
+  emit_written = 0;
+}
+
+// 一時的に出力先を fd に切り替える(emit_restore で元に戻す)
+void emit_switch(int fd) {
+  emit_flush();
+  saved_fd = emit_fd;
+  saved_written = emit_written;
+  emit_fd = fd;
+  emit_written = 0;
+}
+
+void emit_restore(void) {
+  emit_flush();
+  emit_fd = saved_fd;
+  emit_written = saved_written;
+}
+
+// 今までに出力したバイト数
+long emit_size(void) {
+  return emit_written + emit_len;
+}
+
+// fd の今の位置から len バイト読んでそのまま出力する
+void emit_copy(int fd, long len) {
+  while (len > 0) {
+    if (emit_len == EMIT_BUFFER_SIZE) {
+      emit_flush();
+    }
+    long size = EMIT_BUFFER_SIZE - emit_len;
+    if (size > len) {
+      size = len;
+    }
+    long n = read(fd, emit_buf + emit_len, size);
+    if (n <= 0) {
+      error("cannot read assembly: %s", strerror(errno));
+    }
+    emit_len = emit_len + n;
+    len = len - n;
+  }
+}
+
+void emit_flush(void) {
+  int written = 0;
+  while (written < emit_len) {
+    long n = write(emit_fd, emit_buf + written, emit_len - written);
+    if (n < 0) {
+      error("cannot write assembly: %s", strerror(errno));
+    }
+    written = written + n;
+  }
+  emit_written = emit_written + emit_len;
+  emit_len = 0;
+}
+
+// バッファを書き出して出力先を閉じる
+void emit_close(void) {
+  emit_flush();
+  if (emit_fp) {
+    fclose(emit_fp);
+    emit_fp = NULL;
+  }
+}
+
+static void emit_bytes(char *s, int len) {
+  if (emit_len + len > EMIT_BUFFER_SIZE) {
+    emit_flush();
+    if (len > EMIT_BUFFER_SIZE) {
+      // バッファより大きいものは直接書き出す
+      char *saved = emit_buf;
+      emit_buf = s;
+      emit_len = len;
+      emit_flush();
+      emit_buf = saved;
+      return;
+    }
+  }
+  memcpy(emit_buf + emit_len, s, len);
+  emit_len = emit_len + len;
+}
+
+static void emit_char(char c) {
+  if (emit_len == EMIT_BUFFER_SIZE) {
+    emit_flush();
+  }
+  emit_buf[emit_len++] = c;
+}
+
+// 文字列(命令、レジスタ名、ラベル名など)をそのまま書く
+void emit(char *s) {
+  emit_bytes(s, strlen(s));
+}
+
+// 整数を10進数で書く
+void emit_num(long val) {
+  char buf[24];
+  int i = sizeof(buf);
+
+  // LONG_MINでもあふれないように負の数のまま1桁ずつ取り出す
+  bool neg = val < 0;
+  if (!neg) {
+    val = -val;
+  }
+  do {
+    long q = val / 10;
+    buf[--i] = '0' - (val - q * 10);
+    val = q;
+  } while (val);
+  if (neg) {
+    buf[--i] = '-';
+  }
+  emit_bytes(buf + i, sizeof(buf) - i);
+}
+
+// s を1行として書く
+void emitln(char *s) {
+  emit(s);
+  emit_char('\n');
+}
+
+// prefix の後に整数を続けて1行として書く("  push 1" など)
+void emitln_num(char *prefix, long val) {
+  emit(prefix);
+  emit_num(val);
+  emit_char('\n');
+}
+
+// prefix の後に文字列(レジスタ名、ラベル名など)を続けて1行として書く("  pop rdi" など)
+void emitln_str(char *prefix, char *s) {
+  emit(prefix);
+  emit(s);
+  emit_char('\n');
+}
+
+// printf形式の書式で1行書く(書式が必要な行のみに使う)
+void emitfln(char *fmt, ...) {
+  if (EMIT_BUFFER_SIZE - emit_len < EMIT_LINE_RESERVE) {
+    emit_flush();
+  }
+
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(emit_buf + emit_len, EMIT_BUFFER_SIZE - emit_len, fmt, ap);
+  va_end(ap);
+
+  if (n >= EMIT_BUFFER_SIZE - emit_len) {
+    // 空きに収まらなかったので、バッファを空にして書き直す
+    emit_flush();
+    if (n >= EMIT_BUFFER_SIZE) {
+      error("too long assembly line (%d bytes)", n);
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(emit_buf, EMIT_BUFFER_SIZE, fmt, ap);
+    va_end(ap);
+  }
+  emit_len = emit_len + n;
+  emit_char('\n');
+}
@@ -0,0 +1,409 @@
+#include "ynicc.h"
+
+// 関数の本体の定数畳み込み
+//
+// 関数の本体の構文木をたどって、オペランドが全部定数の整数の演算を ND_NUM に置き換える。
+// 実行時の整数の演算は add_type の型どおり long (64bit) で行い、キャストや変数への代入の時に型の幅に切り詰めるので、
+// 畳み込みも long で計算して、キャストでは同じように切り詰める。
+// 0 での割り算のように実行時にしか結果が決まらないものはそのままにする。
+//
+// 定数で初期化したローカル変数のうち、ほかに代入がなくアドレスも取られないものは、
+// 宣言より後で読んでいるところをその定数に置き換える(宣言の初期化はそのまま残す)。
+// x * 1, x + 0, x << 0 のような、片方が定数で結果がもう片方と同じになる演算はもう片方に置き換える
+// (もう片方の型が演算の型と違えば、演算の型へのキャストにする)。
+//
+// 複合代入(x += y)の左辺のノードは右辺の演算と共有されているので、ノードを書き換えるのは
+// 定数かキャストにする時だけにして(左辺になるノードは定数にもキャストにもならない)、それ以外は親から指す先を付け替える。
+
+// 値を ty の型に変換した時の値(キャストのコード生成と同じく、_Bool は0か1に、4バイト以下の型は符号拡張する)
+static long cast_value(long val, Type *ty) {
+  if (ty->kind == TY_BOOL) {
+    return val != 0;
+  }
+  if (ty->size == 1) {
+    return (char)val;
+  }
+  if (ty->size == 2) {
+    return (short)val;
+  }
+  if (ty->size == 4) {
+    return (int)val;
+  }
+  return val;
+}
+
+static bool is_int_type(Type *ty) {
+  return ty && (ty->kind == TY_BOOL || ty->kind == TY_CHAR || ty->kind == TY_SHORT || ty->kind == TY_INT ||
+                ty->kind == TY_LONG || ty->kind == TY_ENUM);
+}
+
+static bool is_num(Node *node, long val) {
+  return node->kind == ND_NUM && node->val == val;
+}
+
+// node を定数 val にする
+static Node *to_num(Node *node, long val) {
+  node->kind = ND_NUM;
+  node->val = val;
+  node->ty = long_type;
+  node->lhs = NULL;
+  node->rhs = NULL;
+  node->var = NULL;
+  return node;
+}
+
+//
+// 代入の回数を数える
+//
+
+static void count_assign(Node *lhs, int n) {
+  if (lhs->kind == ND_VAR) {
+    lhs->var->nassigns = lhs->var->nassigns + n;
+  }
+}
+
+static void count_assigns(Node *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+      case ND_ASSIGN:
+        count_assign(node->lhs, 1);
+        break;
+      case ND_ADDR:
+      case ND_PRE_INC:
+      case ND_PRE_DEC:
+      case ND_POST_INC:
+      case ND_POST_DEC:
+        count_assign(node->lhs, 2);
+        break;
+    }
+    count_assigns(node->lhs);
+    count_assigns(node->rhs);
+    count_assigns(node->init);
+    if (node_has_stmt_part(node->kind)) {
+      count_assigns(node->cond);
+      count_assigns(node->then);
+      count_assigns(node->els);
+      count_assigns(node->body);
+      count_assigns(node->inc);
+      count_assigns(node->initializer);
+      count_assigns(node->arg);
+    }
+  }
+}
+
+//
+// 畳み込み
+//
+
+static Node *fold(Node *node);
+
+// 代入先などのアドレスを使うノード(変数そのものは定数に置き換えない)
+static Node *fold_lvalue(Node *node) {
+  if (node->kind == ND_VAR) {
+    return node;
+  }
+  return fold(node);
+}
+
+// next でつないだノードの並びを畳み込む
+static Node *fold_list(Node *node) {
+  Node head = {};
+  Node *cur = &head;
+  while (node) {
+    Node *next = node->next;
+    cur->next = fold(node);
+    cur = cur->next;
+    cur->next = next;
+    node = next;
+  }
+  return head.next;
+}
+
+// スカラーの変数1個の初期化(int x = 式;)なら、その代入のノード
+static Node *scalar_initializer(Node *node) {
+  Node *init = node->initializer;
+  if (!init || !init->body || init->body->next || init->body->kind != ND_EXPR_STMT) {
+    return NULL;
+  }
+  Node *assign = init->body->lhs;
+  if (assign->kind != ND_ASSIGN || assign->lhs->kind != ND_VAR || assign->lhs->var != node->var) {
+    return NULL;
+  }
+  return assign;
+}
+
+// long の最大値と最小値
+static long long_max = 9223372036854775807;
+static long long_min = -9223372036854775807 - 1;
+
+// a + b, a - b, a * b が long からあふれるかどうか
+static bool add_overflows(long a, long b) {
+  if (b > 0) {
+    return a > long_max - b;
+  }
+  return a < long_min - b;
+}
+
+static bool sub_overflows(long a, long b) {
+  if (b < 0) {
+    return a > long_max + b;
+  }
+  return a < long_min + b;
+}
+
+static bool mul_overflows(long a, long b) {
+  if (a == 0 || b == 0) {
+    return false;
+  }
+  if (a > 0) {
+    return b > 0 ? a > long_max / b : b < long_min / a;
+  }
+  return b > 0 ? a < long_min / b : b < long_max / a;
+}
+
+// 両方のオペランドが定数の二項演算を計算する(計算しないものは false を返す)
+// あふれる演算は実行時と同じ値(2の補数で折り返した値)を long で計算できないので、畳み込まずに実行時に計算する
+static bool eval_binary(NodeKind kind, long a, long b, long *result) {
+  switch (kind) {
+    case ND_ADD:
+      if (add_overflows(a, b)) {
+        return false;
+      }
+      *result = a + b;
+      return true;
+    case ND_SUB:
+      if (sub_overflows(a, b)) {
+        return false;
+      }
+      *result = a - b;
+      return true;
+    case ND_MUL:
+      if (mul_overflows(a, b)) {
+        return false;
+      }
+      *result = a * b;
+      return true;
+    case ND_DIV:
+      // LONG_MIN / -1 はあふれる
+      if (b == 0 || (a == long_min && b == -1)) {
+        return false;
+      }
+      *result = a / b;
+      return true;
+    case ND_MOD:
+      if (b == 0) {
+        return false;
+      }
+      *result = b == -1 ? 0 : a % b;
+      return true;
+    case ND_BIT_AND:
+      *result = a & b;
+      return true;
+    case ND_BIT_OR:
+      *result = a | b;
+      return true;
+    case ND_BIT_XOR:
+      *result = a ^ b;
+      return true;
+    case ND_A_LSHIFT:
+      {
+        // シフト命令はシフトする数の下位6ビットだけを使う。負の数やあふれる場合もあるので 2 の累乗を掛けて計算する
+        long shift = b & 63;
+        if (shift == 63) {
+          if (a) {
+            return false;
+          }
+          *result = 0;
+          return true;
+        }
+        long pow = (long)1 << shift;
+        if (mul_overflows(a, pow)) {
+          return false;
+        }
+        *result = a * pow;
+        return true;
+      }
+    case ND_A_RSHIFT:
+      *result = a >> (b & 63);
+      return true;
+    case ND_EQL:
+      *result = a == b;
+      return true;
+    case ND_NOT_EQL:
+      *result = a != b;
+      return true;
+    case ND_LT:
+      *result = a < b;
+      return true;
+    case ND_LTE:
+      *result = a <= b;
+      return true;
+    case ND_AND:
+      *result = a && b;
+      return true;
+    case ND_OR:
+      *result = a || b;
+      return true;
+  }
+  return false;
+}
+
+// 片方だけが定数の演算で、結果がもう片方と同じになるものはそれを返す(なければNULL)
+static Node *simplify_identity(Node *node) {
+  Node *lhs = node->lhs;
+  Node *rhs = node->rhs;
+  switch (node->kind) {
+    case ND_ADD:
+    case ND_BIT_OR:
+    case ND_BIT_XOR:
+      if (is_num(rhs, 0)) {
+        return lhs;
+      }
+      if (is_num(lhs, 0)) {
+        return rhs;
+      }
+      return NULL;
+    case ND_MUL:
+      if (is_num(rhs, 1)) {
+        return lhs;
+      }
+      if (is_num(lhs, 1)) {
+        return rhs;
+      }
+      return NULL;
+    case ND_BIT_AND:
+      if (is_num(rhs, -1)) {
+        return lhs;
+      }
+      if (is_num(lhs, -1)) {
+        return rhs;
+      }
+      return NULL;
+    case ND_SUB:
+      return is_num(rhs, 0) ? lhs : NULL;
+    case ND_DIV:
+      return is_num(rhs, 1) ? lhs : NULL;
+    case ND_A_LSHIFT:
+    case ND_A_RSHIFT:
+      if (rhs->kind == ND_NUM && (rhs->val & 63) == 0) {
+        return lhs;
+      }
+      return NULL;
+  }
+  return NULL;
+}
+
+// node を畳み込んだ結果のノードを返す(node 自身を書き換えることもある)
+static Node *fold(Node *node) {
+  if (!node) {
+    return NULL;
+  }
+
+  switch (node->kind) {
+    case ND_ASSIGN:
+    case ND_ADDR:
+    case ND_PRE_INC:
+    case ND_PRE_DEC:
+    case ND_POST_INC:
+    case ND_POST_DEC:
+      node->lhs = fold_lvalue(node->lhs);
+      break;
+    default:
+      node->lhs = fold(node->lhs);
+  }
+  node->rhs = fold(node->rhs);
+  node->init = fold(node->init);
+  if (node_has_stmt_part(node->kind)) {
+    node->cond = fold(node->cond);
+    node->then = fold(node->then);
+    node->els = fold(node->els);
+    node->body = fold_list(node->body);
+    node->inc = fold(node->inc);
+    node->initializer = fold(node->initializer);
+    node->arg = fold_list(node->arg);
+  }
+
+  switch (node->kind) {
+    case ND_VAR_DECL:
+      {
+        // 初期化式が定数で、ほかに代入がなければ、ここから後はその定数を変数の値にする
+        Var *var = node->var;
+        Node *assign = scalar_initializer(node);
+        if (assign && var->nassigns == 1 && is_int_type(var->type) && assign->rhs->kind == ND_NUM) {
+          var->is_const = true;
+          var->const_val = cast_value(assign->rhs->val, var->type);
+        }
+      }
+      return node;
+    case ND_VAR:
+      if (node->var->is_const && !node->init) {
+        return to_num(node, node->var->const_val);
+      }
+      return node;
+    case ND_CAST:
+      if (node->lhs->kind == ND_NUM && is_int_type(node->ty)) {
+        return to_num(node, cast_value(node->lhs->val, node->ty));
+      }
+      return node;
+    case ND_NOT:
+      if (node->lhs->kind == ND_NUM) {
+        return to_num(node, !node->lhs->val);
+      }
+      return node;
+    case ND_BIT_NOT:
+      if (node->lhs->kind == ND_NUM) {
+        return to_num(node, ~node->lhs->val);
+      }
+      return node;
+    case ND_TERNARY:
+      if (node->cond->kind == ND_NUM) {
+        return node->cond->val ? node->then : node->els;
+      }
+      return node;
+    case ND_AND:
+      // 左辺で結果が決まる場合は右辺を計算しない
+      if (is_num(node->lhs, 0)) {
+        return to_num(node, 0);
+      }
+      break;
+    case ND_OR:
+      if (node->lhs->kind == ND_NUM && node->lhs->val) {
+        return to_num(node, 1);
+      }
+      break;
+  }
+
+  if (!node->lhs || !node->rhs || !is_int_type(node->ty)) {
+    return node;
+  }
+  long val;
+  if (node->lhs->kind == ND_NUM && node->rhs->kind == ND_NUM &&
+      eval_binary(node->kind, node->lhs->val, node->rhs->val, &val)) {
+    return to_num(node, val);
+  }
+  Node *operand = simplify_identity(node);
+  if (!operand) {
+    return node;
+  }
+  if (operand->ty->kind == node->ty->kind && operand->ty->size == node->ty->size) {
+    return operand;
+  }
+  // char c; c + 0 のように演算で型が変わる場合は、演算の型へのキャストにして型を変えない
+  node->kind = ND_CAST;
+  node->lhs = operand;
+  node->rhs = NULL;
+  return node;
+}
+
+void fold_function(Function *func) {
+  for (VarList *v = func->locals; v; v = v->next) {
+    v->var->nassigns = 0;
+    v->var->is_const = false;
+  }
+  // 引数は呼び出し元で代入されている
+  for (VarList *v = func->params; v; v = v->next) {
+    v->var->nassigns = 2;
+  }
+  count_assigns(func->body);
+  func->body = fold_list(func->body);
+}
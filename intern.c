@@ -0,0 +1,92 @@
+#include "ynicc.h"
+
+// 識別子の intern テーブル
+//
+// 同じ綴りの識別子に対して常に同じポインタを返すので、intern した名前同士は
+// strcmp しなくてもポインタの比較だけで同じ名前かどうかを判定できる。
+// テーブルはオープンアドレス法(線形探索)のハッシュテーブルで、半分埋まったら倍に広げる。
+
+enum {
+  // テーブルの初期サイズ(2のべき乗)
+  INTERN_INITIAL_CAPACITY = 1 << 10,
+};
+
+typedef struct InternEntry InternEntry;
+struct InternEntry {
+  char *str; // intern した文字列(NULLなら空きスロット)
+  int len;
+  long hash;
+};
+
+char *builtin_va_start_name;
+
+static InternEntry *intern_table;
+static int intern_capacity;
+static int intern_count;
+
+// FNV-1a (32bit)
+static long intern_hash(char *str, int len) {
+  long h = 2166136261;
+  for (int i = 0; i < len; i++) {
+    h = ((h ^ (str[i] & 0xff)) * 16777619) & 0xffffffff;
+  }
+  return h;
+}
+
+static InternEntry *intern_slot(InternEntry *table, int capacity, char *str, int len, long hash) {
+  int i = hash & (capacity - 1);
+  for (;;) {
+    InternEntry *e = &table[i];
+    if (!e->str) {
+      return e;
+    }
+    if (e->hash == hash && e->len == len && memcmp(e->str, str, len) == 0) {
+      return e;
+    }
+    i = (i + 1) & (capacity - 1);
+  }
+}
+
+static void intern_grow(void) {
+  int new_capacity = intern_capacity ? intern_capacity * 2 : INTERN_INITIAL_CAPACITY;
+  InternEntry *new_table = calloc(new_capacity, sizeof(InternEntry));
+
+  for (int i = 0; i < intern_capacity; i++) {
+    InternEntry *e = &intern_table[i];
+    if (e->str) {
+      memcpy(intern_slot(new_table, new_capacity, e->str, e->len, e->hash), e, sizeof(InternEntry));
+    }
+  }
+
+  free(intern_table);
+  intern_table = new_table;
+  intern_capacity = new_capacity;
+}
+
+// str から len バイトの識別子を intern して、NULL終端された一意な文字列を返す
+char *intern(char *str, int len) {
+  if ((intern_count + 1) * 2 > intern_capacity) {
+    intern_grow();
+  }
+
+  long hash = intern_hash(str, len);
+  InternEntry *e = intern_slot(intern_table, intern_capacity, str, len, hash);
+  if (e->str) {
+    return e->str;
+  }
+
+  char *s = arena_alloc(ARENA_IDENT, len + 1);
+  memcpy(s, str, len);
+  s[len] = '\0';
+
+  e->str = s;
+  e->len = len;
+  e->hash = hash;
+  intern_count++;
+  return s;
+}
+
+// コンパイラ自身が名前で判定する識別子をあらかじめinternしておく
+void init_intern(void) {
+  builtin_va_start_name = intern("__builtin_va_start", 18);
+}
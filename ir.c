@@ -0,0 +1,1359 @@
+#include "ynicc.h"
+
+// 中間表現(IR)
+//
+// 関数の本体の構文木を、基本ブロックとSSA形式の値(命令)からなるIRに変換する。
+// アドレスを取られないスカラーのローカル変数(引数も含む)はSSAの値にして、ブロックの合流点ではphiで受け取る。
+// それ以外のローカル変数はスタックに置いて IR_LOAD / IR_STORE で読み書きする。
+//
+// SSAへの変換は Braun らの "Simple and Efficient Construction of Static Single Assignment Form" の方法で、
+// 構文木をたどりながら直接phiを作る。前のブロックが全部決まったブロックを「封印」して、
+// 封印していないブロックで変数を読んだ時は中身が未定のphiを置いておき、封印した時に引数を埋める。
+// 引数が全部同じ値(か自分自身)になる自明なphiは、最後にまとめて消す。
+//
+// IRは ARENA_CODEGEN に作る(関数1個のコード生成が終わったら捨てる)。
+
+// IRを作っている関数と、今命令を追加しているブロック
+static IrFunc *fn;
+static IrBlock *cur;
+
+// break, continue の飛び先
+static IrBlock *break_block;
+static IrBlock *continue_block;
+
+// switch の case のノードと、その case のブロック
+static Node **case_nodes;
+static IrBlock **case_blocks;
+static int ncases;
+static int cases_cap;
+
+// goto のラベル名(internしてあるのでポインタで比べる)と、そのラベルのブロック
+static char **label_names;
+static IrBlock **label_blocks;
+static int nlabels;
+static int labels_cap;
+// ラベル名のポインタから label_names の番号+1 を引くハッシュ表(0なら空き、大きさは labels_cap の2倍)
+static int *label_table;
+
+static char *ir_op_names[] = {
+  "const", "param", "local", "global", "load", "store",
+  "add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl", "sar",
+  "eq", "ne", "lt", "le", "not", "ext", "call", "phi", "jmp", "br", "ret",
+};
+
+static void *ir_alloc(long size) {
+  return arena_alloc(ARENA_CODEGEN, size);
+}
+
+// 要素数 n の配列 array を cap の大きさに広げたものを返す
+static void *grow_array(void *array, int n, int cap) {
+  void **new_array = ir_alloc(cap * sizeof(void *));
+  if (n) {
+    memcpy(new_array, array, n * sizeof(void *));
+  }
+  return new_array;
+}
+
+IrBlock *ir_new_block(IrFunc *f) {
+  IrBlock *bb = ir_alloc(sizeof(IrBlock));
+  bb->id = f->nblocks++;
+  bb->rpo = -1;
+  if (f->last_block) {
+    f->last_block->next = bb;
+  } else {
+    f->blocks = bb;
+  }
+  f->last_block = bb;
+  return bb;
+}
+
+IrValue *ir_new_value(IrFunc *f, IrOp op) {
+  IrValue *v = ir_alloc(sizeof(IrValue));
+  v->op = op;
+  v->id = f->nvalues++;
+  return v;
+}
+
+void ir_append(IrBlock *bb, IrValue *v) {
+  v->block = bb;
+  v->prev = bb->last;
+  v->next = NULL;
+  if (bb->last) {
+    bb->last->next = v;
+  } else {
+    bb->first = v;
+  }
+  bb->last = v;
+}
+
+// pos の前に v を入れる
+void ir_insert_before(IrValue *pos, IrValue *v) {
+  IrBlock *bb = pos->block;
+  v->block = bb;
+  v->next = pos;
+  v->prev = pos->prev;
+  if (pos->prev) {
+    pos->prev->next = v;
+  } else {
+    bb->first = v;
+  }
+  pos->prev = v;
+}
+
+// v をブロックから外す
+void ir_remove(IrValue *v) {
+  IrBlock *bb = v->block;
+  if (v->prev) {
+    v->prev->next = v->next;
+  } else {
+    bb->first = v->next;
+  }
+  if (v->next) {
+    v->next->prev = v->prev;
+  } else {
+    bb->last = v->prev;
+  }
+  v->block = NULL;
+  v->prev = NULL;
+  v->next = NULL;
+}
+
+void ir_add_arg(IrFunc *f, IrValue *v, IrValue *arg) {
+  if (v->nargs == v->args_cap) {
+    v->args_cap = v->args_cap ? v->args_cap * 2 : 2;
+    v->args = grow_array(v->args, v->nargs, v->args_cap);
+  }
+  v->args[v->nargs++] = arg;
+}
+
+static void add_pred(IrBlock *bb, IrBlock *pred) {
+  if (bb->npreds == bb->preds_cap) {
+    bb->preds_cap = bb->preds_cap ? bb->preds_cap * 2 : 2;
+    bb->preds = grow_array(bb->preds, bb->npreds, bb->preds_cap);
+  }
+  bb->preds[bb->npreds++] = pred;
+}
+
+bool ir_is_terminator(IrValue *v) {
+  return v->op == IR_JMP || v->op == IR_BR || v->op == IR_RET;
+}
+
+// 他の命令の引数にできる値を作る命令かどうか
+bool ir_has_value(IrValue *v) {
+  return v->op != IR_STORE && !ir_is_terminator(v);
+}
+
+// bb の後に続くブロックを succs に入れて、その数を返す
+int ir_successors(IrBlock *bb, IrBlock **succs) {
+  IrValue *t = bb->last;
+  if (!t || t->op == IR_RET) {
+    return 0;
+  }
+  if (t->op == IR_JMP) {
+    succs[0] = t->target;
+    return 1;
+  }
+  succs[0] = t->target;
+  succs[1] = t->els;
+  return 2;
+}
+
+// 今のブロックに命令を追加する
+static IrValue *emit_ir(IrOp op) {
+  IrValue *v = ir_new_value(fn, op);
+  ir_append(cur, v);
+  return v;
+}
+
+static IrValue *emit_unary(IrOp op, IrValue *a) {
+  IrValue *v = emit_ir(op);
+  ir_add_arg(fn, v, a);
+  return v;
+}
+
+static IrValue *emit_binary(IrOp op, IrValue *a, IrValue *b) {
+  IrValue *v = emit_ir(op);
+  ir_add_arg(fn, v, a);
+  ir_add_arg(fn, v, b);
+  return v;
+}
+
+static IrValue *emit_const(long val) {
+  IrValue *v = emit_ir(IR_CONST);
+  v->val = val;
+  return v;
+}
+
+// 今のブロックを bb に飛ぶ命令で終える
+static void emit_jmp(IrBlock *bb) {
+  IrValue *v = emit_ir(IR_JMP);
+  v->target = bb;
+  add_pred(bb, cur);
+}
+
+static void emit_br(IrValue *cond, IrBlock *then, IrBlock *els) {
+  IrValue *v = emit_unary(IR_BR, cond);
+  v->target = then;
+  v->els = els;
+  add_pred(then, cur);
+  add_pred(els, cur);
+}
+
+// return, break などの後ろに続く(どこからも飛んでこない)コードを置くブロックに移る
+static void start_unreachable_block(void) {
+  cur = ir_new_block(fn);
+  cur->sealed = true;
+}
+
+//
+// SSAの変数
+//
+
+static IrValue **block_defs(IrBlock *bb) {
+  if (!bb->defs) {
+    bb->defs = ir_alloc(fn->nvars * sizeof(IrValue *));
+  }
+  return bb->defs;
+}
+
+static void write_var(Var *var, IrBlock *bb, IrValue *v) {
+  block_defs(bb)[var->ir_index - 1] = v;
+}
+
+// bb の先頭に var のためのphiを作る
+static IrValue *new_phi(IrBlock *bb, Var *var) {
+  IrValue *phi = ir_new_value(fn, IR_PHI);
+  phi->var = var;
+  if (bb->first) {
+    ir_insert_before(bb->first, phi);
+  } else {
+    ir_append(bb, phi);
+  }
+  return phi;
+}
+
+static IrValue *read_var(Var *var, IrBlock *bb);
+
+static void add_phi_operands(IrValue *phi) {
+  IrBlock *bb = phi->block;
+  for (int i = 0; i < bb->npreds; i++) {
+    ir_add_arg(fn, phi, read_var(phi->var, bb->preds[i]));
+  }
+}
+
+// bb の終わりでの変数 var の値
+static IrValue *read_var(Var *var, IrBlock *bb) {
+  IrValue *v = block_defs(bb)[var->ir_index - 1];
+  if (v) {
+    return v;
+  }
+
+  if (!bb->sealed) {
+    // 前のブロックがまだ全部わからないので、引数は封印する時に埋める
+    v = new_phi(bb, var);
+    v->incomplete = true;
+  } else if (bb->npreds == 0) {
+    // 代入される前に読んでいる
+    v = fn->undef;
+  } else if (bb->npreds == 1) {
+    v = read_var(var, bb->preds[0]);
+  } else {
+    // ループで自分自身に戻ってきた時のために、先にphiを変数の値にしておく
+    v = new_phi(bb, var);
+    write_var(var, bb, v);
+    add_phi_operands(v);
+  }
+  write_var(var, bb, v);
+  return v;
+}
+
+// bb にこれ以上前のブロックが増えないので、未定のphiの引数を埋める
+static void seal_block(IrBlock *bb) {
+  for (IrValue *v = bb->first; v && v->op == IR_PHI; v = v->next) {
+    if (v->incomplete) {
+      v->incomplete = false;
+      add_phi_operands(v);
+    }
+  }
+  bb->sealed = true;
+}
+
+// phi を消した時に置き換えた先をたどる
+static IrValue *resolve(IrValue *v) {
+  while (v->replaced) {
+    v = v->replaced;
+  }
+  return v;
+}
+
+// 引数が全部同じ値(か自分自身)の自明なphiを消して、それを使っている命令の引数を置き換える
+static void remove_trivial_phis(void) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+      IrValue *next;
+      for (IrValue *v = bb->first; v && v->op == IR_PHI; v = next) {
+        next = v->next;
+        IrValue *same = NULL;
+        bool trivial = true;
+        for (int i = 0; i < v->nargs; i++) {
+          IrValue *arg = resolve(v->args[i]);
+          if (arg == same || arg == v) {
+            continue;
+          }
+          if (same) {
+            trivial = false;
+            break;
+          }
+          same = arg;
+        }
+        if (trivial) {
+          v->replaced = same ? same : fn->undef;
+          ir_remove(v);
+          changed = true;
+        }
+      }
+    }
+  }
+
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      for (int i = 0; i < v->nargs; i++) {
+        v->args[i] = resolve(v->args[i]);
+      }
+    }
+  }
+}
+
+//
+// SSAの値にする変数を決める
+//
+
+static bool is_ssa_type(Type *ty) {
+  return ty->kind == TY_BOOL || ty->kind == TY_CHAR || ty->kind == TY_SHORT || ty->kind == TY_INT ||
+         ty->kind == TY_LONG || ty->kind == TY_PTR || ty->kind == TY_ENUM;
+}
+
+// アドレスを取られている(か compound literal の)ローカル変数の ir_index を -1 にする
+static void mark_address_taken(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_VAR && node->var && node->var->is_local && node->init) {
+      node->var->ir_index = -1;
+    }
+    if (node->kind == ND_ADDR && node->lhs->kind == ND_VAR && node->lhs->var->is_local) {
+      node->lhs->var->ir_index = -1;
+    }
+    mark_address_taken(node->init);
+    mark_address_taken(node->lhs);
+    mark_address_taken(node->rhs);
+    if (node_has_stmt_part(node->kind)) {
+      mark_address_taken(node->cond);
+      mark_address_taken(node->then);
+      mark_address_taken(node->els);
+      mark_address_taken(node->body);
+      mark_address_taken(node->inc);
+      mark_address_taken(node->initializer);
+      mark_address_taken(node->arg);
+    }
+  }
+}
+
+static void assign_ssa_vars(Function *func) {
+  int nlocals = 0;
+  for (VarList *v = func->locals; v; v = v->next) {
+    v->var->ir_index = 0;
+    nlocals++;
+  }
+  mark_address_taken(func->body);
+
+  // アドレスを取ったローカル変数からのポインタ演算で隣の変数を読み書きするコードもあるので、
+  // どれか1つでもアドレスを取られていれば、全部の変数をスタックに置く
+  bool address_taken = false;
+  for (VarList *v = func->locals; v; v = v->next) {
+    if (v->var->ir_index < 0) {
+      address_taken = true;
+    }
+  }
+
+  fn->vars = ir_alloc((nlocals + 1) * sizeof(Var *));
+  for (VarList *v = func->locals; v; v = v->next) {
+    Var *var = v->var;
+    if (!address_taken && is_ssa_type(var->type)) {
+      fn->vars[fn->nvars++] = var;
+      var->ir_index = fn->nvars;
+    } else {
+      var->ir_index = 0;
+    }
+  }
+}
+
+//
+// 構文木からIRへの変換
+//
+
+static IrValue *lower_expr(Node *node);
+static void lower_stmt(Node *node);
+
+// v を ty の型の値にする(コード生成の cast と同じ変換)
+static IrValue *emit_ext(IrValue *v, Type *ty) {
+  if (ty->kind != TY_BOOL && ty->size != 1 && ty->size != 2 && ty->size != 4) {
+    return v;
+  }
+  IrValue *ext = emit_unary(IR_EXT, v);
+  ext->size = ty->size;
+  ext->is_bool = ty->kind == TY_BOOL;
+  return ext;
+}
+
+static IrValue *emit_load(IrValue *addr, Type *ty) {
+  if (ty->size != 1 && ty->size != 2 && ty->size != 4 && ty->size != 8) {
+    error("IRに変換できない型の値を読んでいます(size: %d)", ty->size);
+  }
+  IrValue *v = emit_unary(IR_LOAD, addr);
+  v->size = ty->size;
+  return v;
+}
+
+static void emit_store(IrValue *addr, IrValue *val, Type *ty) {
+  if (ty->size != 1 && ty->size != 2 && ty->size != 4 && ty->size != 8) {
+    error("IRに変換できない型の値を書いています(size: %d)", ty->size);
+  }
+  IrValue *v = emit_binary(IR_STORE, addr, val);
+  v->size = ty->size;
+}
+
+static bool is_ssa_var(Node *node) {
+  return node->kind == ND_VAR && node->var->is_local && node->var->ir_index > 0;
+}
+
+// 左辺値のアドレスを計算する
+static IrValue *lower_addr(Node *node) {
+  switch (node->kind) {
+    case ND_VAR:
+      {
+        if (node->init) {
+          lower_stmt(node->init);
+        }
+        if (is_ssa_var(node)) {
+          error("SSAの値にした変数のアドレスは取れません: %s", node->var->name);
+        }
+        if (node->var->is_local) {
+          IrValue *v = emit_ir(IR_LOCAL);
+          v->var = node->var;
+          return v;
+        }
+        IrValue *v = emit_ir(IR_GLOBAL);
+        v->name = node->var->name;
+        return v;
+      }
+    case ND_DEREF:
+      return lower_expr(node->lhs);
+    case ND_MEMBER:
+      return emit_binary(IR_ADD, lower_addr(node->lhs), emit_const(node->member->offset));
+  }
+  error("代入の左辺値が変数ではありません");
+  return NULL;
+}
+
+// ++, -- (delta だけ増やして、post なら変更前の値を、そうでなければ変更後の値を返す)
+static IrValue *lower_inc(Node *node, long delta, bool post) {
+  if (is_ssa_var(node->lhs)) {
+    Var *var = node->lhs->var;
+    IrValue *old = read_var(var, cur);
+    IrValue *new = emit_ext(emit_binary(IR_ADD, old, emit_const(delta)), var->type);
+    write_var(var, cur, new);
+    return post ? old : new;
+  }
+  IrValue *addr = lower_addr(node->lhs);
+  IrValue *old = emit_load(addr, node->ty);
+  IrValue *new = emit_binary(IR_ADD, old, emit_const(delta));
+  emit_store(addr, new, node->ty);
+  return post ? old : new;
+}
+
+static long inc_size(Type *ty) {
+  return ty->ptr_to ? ty->ptr_to->size : 1;
+}
+
+// && と || (is_and なら &&)
+static IrValue *lower_logical(Node *node, bool is_and) {
+  IrValue *lhs = lower_expr(node->lhs);
+  // 右辺を評価しない場合の値
+  IrValue *short_value = emit_const(is_and ? 0 : 1);
+  IrBlock *lhs_end = cur;
+  IrBlock *rhs_block = ir_new_block(fn);
+  IrBlock *join = ir_new_block(fn);
+  if (is_and) {
+    emit_br(lhs, rhs_block, join);
+  } else {
+    emit_br(lhs, join, rhs_block);
+  }
+  seal_block(rhs_block);
+
+  cur = rhs_block;
+  IrValue *rhs = emit_binary(IR_NE, lower_expr(node->rhs), emit_const(0));
+  emit_jmp(join);
+  seal_block(join);
+
+  cur = join;
+  IrValue *phi = new_phi(join, NULL);
+  for (int i = 0; i < join->npreds; i++) {
+    ir_add_arg(fn, phi, join->preds[i] == lhs_end ? short_value : rhs);
+  }
+  return phi;
+}
+
+// if 文と3項演算子(3項演算子なら結果の値を返す)
+static IrValue *lower_if(Node *node) {
+  IrValue *cond = lower_expr(node->cond);
+  IrBlock *then = ir_new_block(fn);
+  IrBlock *els = node->els ? ir_new_block(fn) : NULL;
+  IrBlock *join = ir_new_block(fn);
+  emit_br(cond, then, els ? els : join);
+  seal_block(then);
+  if (els) {
+    seal_block(els);
+  }
+
+  cur = then;
+  IrValue *then_value = NULL;
+  if (node->kind == ND_TERNARY) {
+    then_value = lower_expr(node->then);
+  } else {
+    lower_stmt(node->then);
+  }
+  emit_jmp(join);
+
+  IrValue *els_value = NULL;
+  if (els) {
+    cur = els;
+    if (node->kind == ND_TERNARY) {
+      els_value = lower_expr(node->els);
+    } else {
+      lower_stmt(node->els);
+    }
+    emit_jmp(join);
+  }
+  seal_block(join);
+  cur = join;
+
+  if (!then_value || !els_value) {
+    return NULL;
+  }
+  // then から来たか else から来たかで値を選ぶ
+  IrValue *phi = new_phi(join, NULL);
+  ir_add_arg(fn, phi, then_value);
+  ir_add_arg(fn, phi, els_value);
+  return phi;
+}
+
+static IrValue *lower_call(Node *node) {
+  if (node->funcname == builtin_va_start_name) {
+    error("__builtin_va_start はIRに変換できません");
+  }
+
+  // 引数は最後のものから評価する(node->arg が逆順になっている)
+  IrValue **args = ir_alloc((node->funcarg_num + 1) * sizeof(IrValue *));
+  Node *arg = node->arg;
+  for (int i = node->funcarg_num - 1; i >= 0; i--) {
+    args[i] = lower_expr(arg);
+    arg = arg->next;
+  }
+
+  IrValue *v = emit_ir(IR_CALL);
+  v->name = node->funcname;
+  v->is_bool = node->ty->kind == TY_BOOL;
+  for (int i = 0; i < node->funcarg_num; i++) {
+    ir_add_arg(fn, v, args[i]);
+  }
+  return v;
+}
+
+static IrValue *lower_binary(Node *node) {
+  IrValue *lhs = lower_expr(node->lhs);
+  IrValue *rhs = lower_expr(node->rhs);
+
+  switch (node->kind) {
+    case ND_ADD:
+      return emit_binary(IR_ADD, lhs, rhs);
+    case ND_SUB:
+      return emit_binary(IR_SUB, lhs, rhs);
+    case ND_PTR_ADD:
+      return emit_binary(IR_ADD, lhs, emit_binary(IR_MUL, rhs, emit_const(node->ty->ptr_to->size)));
+    case ND_PTR_SUB:
+      return emit_binary(IR_SUB, lhs, emit_binary(IR_MUL, rhs, emit_const(node->ty->ptr_to->size)));
+    case ND_PTR_DIFF:
+      return emit_binary(IR_DIV, emit_binary(IR_SUB, lhs, rhs), emit_const(node->lhs->ty->ptr_to->size));
+    case ND_MUL:
+      return emit_binary(IR_MUL, lhs, rhs);
+    case ND_DIV:
+      return emit_binary(IR_DIV, lhs, rhs);
+    case ND_MOD:
+      return emit_binary(IR_MOD, lhs, rhs);
+    case ND_LT:
+      return emit_binary(IR_LT, lhs, rhs);
+    case ND_LTE:
+      return emit_binary(IR_LE, lhs, rhs);
+    case ND_EQL:
+      return emit_binary(IR_EQ, lhs, rhs);
+    case ND_NOT_EQL:
+      return emit_binary(IR_NE, lhs, rhs);
+    case ND_BIT_AND:
+      return emit_binary(IR_AND, lhs, rhs);
+    case ND_BIT_OR:
+      return emit_binary(IR_OR, lhs, rhs);
+    case ND_BIT_XOR:
+      return emit_binary(IR_XOR, lhs, rhs);
+    case ND_A_LSHIFT:
+      return emit_binary(IR_SHL, lhs, rhs);
+    case ND_A_RSHIFT:
+      return emit_binary(IR_SAR, lhs, rhs);
+  }
+  error("予期しないNodeです。 kind: %d", node->kind);
+  return NULL;
+}
+
+// 式の値を計算する命令を作って、その値を返す(値のない式ならNULL)
+static IrValue *lower_expr(Node *node) {
+  switch (node->kind) {
+    case ND_NUM:
+      return emit_const(node->val);
+    case ND_VAR:
+    case ND_MEMBER:
+      if (is_ssa_var(node)) {
+        return read_var(node->var, cur);
+      }
+      if (node->ty->kind == TY_ARRAY) {
+        // 配列は先頭のアドレスを値にする
+        return lower_addr(node);
+      }
+      return emit_load(lower_addr(node), node->ty);
+    case ND_ASSIGN:
+      {
+        if (is_ssa_var(node->lhs)) {
+          IrValue *v = emit_ext(lower_expr(node->rhs), node->lhs->ty);
+          write_var(node->lhs->var, cur, v);
+          return v;
+        }
+        IrValue *addr = lower_addr(node->lhs);
+        IrValue *v = lower_expr(node->rhs);
+        if (node->ty->kind == TY_BOOL) {
+          v = emit_ext(v, node->ty);
+        }
+        emit_store(addr, v, node->ty);
+        return v;
+      }
+    case ND_TERNARY:
+      return lower_if(node);
+    case ND_CALL:
+      return lower_call(node);
+    case ND_ADDR:
+      return lower_addr(node->lhs);
+    case ND_DEREF:
+      if (node->ty->kind == TY_ARRAY) {
+        return lower_expr(node->lhs);
+      }
+      return emit_load(lower_expr(node->lhs), node->ty);
+    case ND_CAST:
+      return emit_ext(lower_expr(node->lhs), node->ty);
+    case ND_COMMA:
+      lower_expr(node->lhs);
+      return lower_expr(node->rhs);
+    case ND_PRE_INC:
+      return lower_inc(node, inc_size(node->ty), false);
+    case ND_PRE_DEC:
+      return lower_inc(node, -inc_size(node->ty), false);
+    case ND_POST_INC:
+      return lower_inc(node, inc_size(node->ty), true);
+    case ND_POST_DEC:
+      return lower_inc(node, -inc_size(node->ty), true);
+    case ND_NOT:
+      return emit_binary(IR_EQ, lower_expr(node->lhs), emit_const(0));
+    case ND_BIT_NOT:
+      return emit_unary(IR_NOT, lower_expr(node->lhs));
+    case ND_AND:
+      return lower_logical(node, true);
+    case ND_OR:
+      return lower_logical(node, false);
+    case ND_EXPR_STMT:
+    case ND_VAR_DECL:
+    case ND_NULL:
+    case ND_BLOCK:
+      lower_stmt(node);
+      return NULL;
+  }
+  return lower_binary(node);
+}
+
+static IrBlock *find_case_block(Node *node) {
+  for (int i = 0; i < ncases; i++) {
+    if (case_nodes[i] == node) {
+      return case_blocks[i];
+    }
+  }
+  error("switch の外の case です");
+  return NULL;
+}
+
+static void add_case_block(Node *node, IrBlock *bb) {
+  if (ncases == cases_cap) {
+    cases_cap = cases_cap ? cases_cap * 2 : 16;
+    case_nodes = grow_array(case_nodes, ncases, cases_cap);
+    case_blocks = grow_array(case_blocks, ncases, cases_cap);
+  }
+  case_nodes[ncases] = node;
+  case_blocks[ncases] = bb;
+  ncases++;
+}
+
+// ラベル名のポインタからハッシュ表の最初に見る位置を決める
+static int label_hash(char *name) {
+  long p = (long)name;
+  return ((p >> 3) ^ (p >> 11) ^ (p >> 19)) & (labels_cap * 2 - 1);
+}
+
+// name のラベルがハッシュ表で入っている(入れる)位置
+static int label_slot(char *name) {
+  int i = label_hash(name);
+  while (label_table[i] && label_names[label_table[i] - 1] != name) {
+    i = (i + 1) & (labels_cap * 2 - 1);
+  }
+  return i;
+}
+
+static IrBlock *label_block(char *name) {
+  if (labels_cap) {
+    int i = label_table[label_slot(name)];
+    if (i) {
+      return label_blocks[i - 1];
+    }
+  }
+  if (nlabels == labels_cap) {
+    labels_cap = labels_cap ? labels_cap * 2 : 8;
+    label_names = grow_array(label_names, nlabels, labels_cap);
+    label_blocks = grow_array(label_blocks, nlabels, labels_cap);
+    // ハッシュ表は広げた大きさで作り直す
+    label_table = ir_alloc(labels_cap * 2 * sizeof(int));
+    for (int i = 0; i < nlabels; i++) {
+      label_table[label_slot(label_names[i])] = i + 1;
+    }
+  }
+  label_names[nlabels] = name;
+  label_blocks[nlabels] = ir_new_block(fn);
+  label_table[label_slot(name)] = nlabels + 1;
+  return label_blocks[nlabels++];
+}
+
+static void lower_switch(Node *node) {
+  IrValue *cond = lower_expr(node->lhs);
+  IrBlock *exit = ir_new_block(fn);
+  int first_case = ncases;
+
+  // 値が等しい case に飛ぶ比較を並べる
+  for (Node *n = node->case_next; n; n = n->case_next) {
+    IrBlock *bb = ir_new_block(fn);
+    add_case_block(n, bb);
+    IrBlock *next = ir_new_block(fn);
+    emit_br(emit_binary(IR_EQ, cond, emit_const(n->case_cond_val)), bb, next);
+    seal_block(next);
+    cur = next;
+  }
+  if (node->default_case) {
+    IrBlock *bb = ir_new_block(fn);
+    add_case_block(node->default_case, bb);
+    emit_jmp(bb);
+  } else {
+    emit_jmp(exit);
+  }
+
+  IrBlock *break_backup = break_block;
+  break_block = exit;
+  start_unreachable_block();
+  lower_stmt(node->body);
+  emit_jmp(exit);
+  break_block = break_backup;
+
+  // case のブロックにはフォールスルーでも入ってくるので、本体が終わってから封印する
+  for (int i = first_case; i < ncases; i++) {
+    seal_block(case_blocks[i]);
+  }
+  seal_block(exit);
+  cur = exit;
+}
+
+static void lower_while(Node *node) {
+  IrBlock *cond = ir_new_block(fn);
+  IrBlock *body = ir_new_block(fn);
+  IrBlock *exit = ir_new_block(fn);
+
+  IrBlock *break_backup = break_block;
+  IrBlock *continue_backup = continue_block;
+  break_block = exit;
+  continue_block = cond;
+
+  if (node->is_do_while) {
+    // do 〜 while は条件式より先に本体を実行する
+    emit_jmp(body);
+    cur = body;
+    lower_stmt(node->body);
+    emit_jmp(cond);
+    seal_block(cond);
+    cur = cond;
+    emit_br(lower_expr(node->cond), body, exit);
+    seal_block(body);
+  } else {
+    emit_jmp(cond);
+    cur = cond;
+    emit_br(lower_expr(node->cond), body, exit);
+    seal_block(body);
+    cur = body;
+    lower_stmt(node->body);
+    emit_jmp(cond);
+    seal_block(cond);
+  }
+
+  break_block = break_backup;
+  continue_block = continue_backup;
+  seal_block(exit);
+  cur = exit;
+}
+
+static void lower_for(Node *node) {
+  if (node->init) {
+    lower_stmt(node->init);
+  }
+  IrBlock *cond = ir_new_block(fn);
+  IrBlock *body = ir_new_block(fn);
+  IrBlock *cont = ir_new_block(fn);
+  IrBlock *exit = ir_new_block(fn);
+
+  emit_jmp(cond);
+  cur = cond;
+  if (node->cond) {
+    emit_br(lower_expr(node->cond), body, exit);
+  } else {
+    emit_jmp(body);
+  }
+  seal_block(body);
+
+  IrBlock *break_backup = break_block;
+  IrBlock *continue_backup = continue_block;
+  break_block = exit;
+  continue_block = cont;
+  cur = body;
+  lower_stmt(node->body);
+  emit_jmp(cont);
+  seal_block(cont);
+  break_block = break_backup;
+  continue_block = continue_backup;
+
+  cur = cont;
+  if (node->inc) {
+    lower_stmt(node->inc);
+  }
+  emit_jmp(cond);
+  seal_block(cond);
+  seal_block(exit);
+  cur = exit;
+}
+
+static void lower_stmt(Node *node) {
+  switch (node->kind) {
+    case ND_NULL:
+      return;
+    case ND_EXPR_STMT:
+      lower_expr(node->lhs);
+      return;
+    case ND_VAR_DECL:
+      if (node->initializer) {
+        lower_stmt(node->initializer);
+      }
+      return;
+    case ND_BLOCK:
+      for (Node *n = node->body; n; n = n->next) {
+        lower_stmt(n);
+      }
+      return;
+    case ND_RETURN:
+      {
+        IrValue *v = emit_ir(IR_RET);
+        if (node->lhs) {
+          // 戻り値の式は RET の前に評価する
+          ir_remove(v);
+          IrValue *val = lower_expr(node->lhs);
+          ir_append(cur, v);
+          if (val) {
+            ir_add_arg(fn, v, val);
+          }
+        }
+        start_unreachable_block();
+      }
+      return;
+    case ND_IF:
+      lower_if(node);
+      return;
+    case ND_WHILE:
+      lower_while(node);
+      return;
+    case ND_FOR:
+      lower_for(node);
+      return;
+    case ND_SWITCH:
+      lower_switch(node);
+      return;
+    case ND_CASE:
+      {
+        IrBlock *bb = find_case_block(node);
+        emit_jmp(bb);
+        cur = bb;
+        lower_stmt(node->lhs);
+      }
+      return;
+    case ND_BREAK:
+      if (!break_block) {
+        error("不正なbreakです");
+      }
+      emit_jmp(break_block);
+      start_unreachable_block();
+      return;
+    case ND_CONTINUE:
+      if (!continue_block) {
+        error("不正なcontinueです");
+      }
+      emit_jmp(continue_block);
+      start_unreachable_block();
+      return;
+    case ND_GOTO:
+      emit_jmp(label_block(node->label_name));
+      start_unreachable_block();
+      return;
+    case ND_LABEL:
+      {
+        IrBlock *bb = label_block(node->label_name);
+        emit_jmp(bb);
+        cur = bb;
+        lower_stmt(node->lhs);
+      }
+      return;
+  }
+  lower_expr(node);
+}
+
+// bb の i 番目の前のブロックを取り除く(phi の引数も取り除く)
+static void remove_pred(IrBlock *bb, int i) {
+  for (IrValue *v = bb->first; v && v->op == IR_PHI; v = v->next) {
+    for (int j = i; j + 1 < v->nargs; j++) {
+      v->args[j] = v->args[j + 1];
+    }
+    v->nargs--;
+  }
+  for (int j = i; j + 1 < bb->npreds; j++) {
+    bb->preds[j] = bb->preds[j + 1];
+  }
+  bb->npreds--;
+}
+
+// 入口から到達できないブロックを取り除く
+static void remove_unreachable_blocks(void) {
+  ir_compute_rpo(fn);
+
+  IrBlock *succs[2];
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    if (bb->rpo >= 0) {
+      continue;
+    }
+    int n = ir_successors(bb, succs);
+    for (int i = 0; i < n; i++) {
+      IrBlock *s = succs[i];
+      for (int j = 0; j < s->npreds; j++) {
+        if (s->preds[j] == bb) {
+          remove_pred(s, j);
+          break;
+        }
+      }
+    }
+  }
+
+  IrBlock head = {};
+  IrBlock *last = &head;
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    if (bb->rpo >= 0) {
+      last->next = bb;
+      last = bb;
+    }
+  }
+  last->next = NULL;
+  fn->blocks = head.next;
+  fn->last_block = last;
+}
+
+// 関数をIRに変換できるかどうか(可変長引数を扱う関数はASTからコード生成する)
+static bool uses_va_start(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_CALL && node->funcname == builtin_va_start_name) {
+      return true;
+    }
+    if (uses_va_start(node->init) || uses_va_start(node->lhs) || uses_va_start(node->rhs)) {
+      return true;
+    }
+    if (node_has_stmt_part(node->kind)) {
+      if (uses_va_start(node->cond) || uses_va_start(node->then) || uses_va_start(node->els) ||
+          uses_va_start(node->body) || uses_va_start(node->inc) || uses_va_start(node->initializer) ||
+          uses_va_start(node->arg)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool ir_supported(Function *func) {
+  return !func->has_vararg && !uses_va_start(func->body);
+}
+
+IrFunc *ir_lower(Function *func) {
+  fn = ir_alloc(sizeof(IrFunc));
+  fn->func = func;
+  assign_ssa_vars(func);
+  ncases = 0;
+  cases_cap = 0;
+  nlabels = 0;
+  labels_cap = 0;
+  break_block = NULL;
+  continue_block = NULL;
+
+  fn->entry = ir_new_block(fn);
+  fn->entry->sealed = true;
+  cur = fn->entry;
+  fn->undef = emit_const(0);
+
+  // 引数(params は逆順になっている)
+  int nparams = 0;
+  for (VarList *v = func->params; v; v = v->next) {
+    nparams++;
+  }
+  int i = nparams - 1;
+  for (VarList *v = func->params; v; v = v->next) {
+    IrValue *param = emit_ir(IR_PARAM);
+    param->val = i;
+    if (v->var->ir_index > 0) {
+      write_var(v->var, cur, emit_ext(param, v->var->type));
+    } else {
+      IrValue *addr = emit_ir(IR_LOCAL);
+      addr->var = v->var;
+      emit_store(addr, param, v->var->type);
+    }
+    i--;
+  }
+
+  for (Node *n = func->body; n; n = n->next) {
+    lower_stmt(n);
+  }
+  // 最後まで来たら戻り値なしで返る
+  emit_ir(IR_RET);
+
+  for (int j = 0; j < nlabels; j++) {
+    seal_block(label_blocks[j]);
+  }
+
+  remove_unreachable_blocks();
+  remove_trivial_phis();
+  ir_compute_rpo(fn);
+  return fn;
+}
+
+//
+// 解析
+//
+
+// 入口から到達できるブロックを逆後順に並べて rpo に番号を振る(到達できないブロックは -1)
+// 後続は後ろのものから訪問するので、br の0以外の時の飛び先がなるべくそのブロックの直後に来る
+void ir_compute_rpo(IrFunc *f) {
+  for (IrBlock *bb = f->blocks; bb; bb = bb->next) {
+    bb->rpo = -1;
+  }
+
+  // 深さ優先探索を明示的なスタックで行う(visit_index はそのブロックの次に見る後続の番号)
+  IrBlock **stack = ir_alloc((f->nblocks + 1) * sizeof(IrBlock *));
+  int *visit_index = ir_alloc((f->nblocks + 1) * sizeof(int));
+  IrBlock **postorder = ir_alloc((f->nblocks + 1) * sizeof(IrBlock *));
+  int npost = 0;
+  int sp = 0;
+  IrBlock *succs[2];
+
+  f->entry->rpo = 0; // 訪問済みの印
+  stack[sp] = f->entry;
+  visit_index[sp] = 0;
+  sp++;
+  while (sp > 0) {
+    IrBlock *bb = stack[sp - 1];
+    int n = ir_successors(bb, succs);
+    if (visit_index[sp - 1] < n) {
+      IrBlock *s = succs[n - 1 - visit_index[sp - 1]];
+      visit_index[sp - 1]++;
+      if (s->rpo < 0) {
+        s->rpo = 0;
+        stack[sp] = s;
+        visit_index[sp] = 0;
+        sp++;
+      }
+      continue;
+    }
+    postorder[npost++] = bb;
+    sp--;
+  }
+
+  f->rpo = ir_alloc((npost + 1) * sizeof(IrBlock *));
+  f->nrpo = npost;
+  for (int i = 0; i < npost; i++) {
+    IrBlock *bb = postorder[npost - 1 - i];
+    bb->rpo = i;
+    f->rpo[i] = bb;
+  }
+}
+
+static IrBlock *intersect(IrBlock *a, IrBlock *b) {
+  while (a != b) {
+    while (a->rpo > b->rpo) {
+      a = a->idom;
+    }
+    while (b->rpo > a->rpo) {
+      b = b->idom;
+    }
+  }
+  return a;
+}
+
+// 支配木を作る(Cooper, Harvey, Kennedy の "A Simple, Fast Dominance Algorithm")
+// ir_compute_rpo の後に呼ぶこと
+void ir_compute_dominators(IrFunc *f) {
+  for (int i = 0; i < f->nrpo; i++) {
+    f->rpo[i]->idom = NULL;
+  }
+  f->entry->idom = f->entry;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < f->nrpo; i++) {
+      IrBlock *bb = f->rpo[i];
+      IrBlock *idom = NULL;
+      for (int j = 0; j < bb->npreds; j++) {
+        IrBlock *p = bb->preds[j];
+        if (p->rpo < 0 || !p->idom) {
+          continue;
+        }
+        idom = idom ? intersect(p, idom) : p;
+      }
+      if (idom != bb->idom) {
+        bb->idom = idom;
+        changed = true;
+      }
+    }
+  }
+
+  // 支配木をたどって番号を振り、ir_dominates を番号の比較だけでできるようにする
+  for (int i = 0; i < f->nrpo; i++) {
+    f->rpo[i]->dom_child = NULL;
+  }
+  for (int i = f->nrpo - 1; i >= 1; i--) {
+    IrBlock *bb = f->rpo[i];
+    bb->dom_sibling = bb->idom->dom_child;
+    bb->idom->dom_child = bb;
+  }
+  // stack[i] の子のうち次にたどるものが next[i]
+  IrBlock **stack = ir_alloc((f->nrpo + 1) * sizeof(IrBlock *));
+  IrBlock **next = ir_alloc((f->nrpo + 1) * sizeof(IrBlock *));
+  int num = 0;
+  f->entry->dom_pre = num++;
+  stack[0] = f->entry;
+  next[0] = f->entry->dom_child;
+  int sp = 1;
+  while (sp > 0) {
+    IrBlock *child = next[sp - 1];
+    if (child) {
+      next[sp - 1] = child->dom_sibling;
+      child->dom_pre = num++;
+      stack[sp] = child;
+      next[sp] = child->dom_child;
+      sp++;
+      continue;
+    }
+    stack[sp - 1]->dom_post = num++;
+    sp--;
+  }
+}
+
+// a が b を支配しているかどうか(ir_compute_dominators の後に呼ぶこと)
+bool ir_dominates(IrBlock *a, IrBlock *b) {
+  return a->dom_pre <= b->dom_pre && b->dom_post <= a->dom_post;
+}
+
+//
+// 検査
+//
+
+static void verify_error(IrBlock *bb, IrValue *v, char *msg) {
+  ir_print(fn);
+  if (v) {
+    error("IRが不正です(%s, bb%d, v%d): %s", fn->func->name, bb->id, v->id, msg);
+  }
+  error("IRが不正です(%s, bb%d): %s", fn->func->name, bb->id, msg);
+}
+
+static bool has_pred(IrBlock *bb, IrBlock *pred) {
+  for (int i = 0; i < bb->npreds; i++) {
+    if (bb->preds[i] == pred) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// def が、bb の中の pos の位置(NULLならブロックの終わり)で使える値かどうか
+static bool available_at(IrValue *def, IrBlock *bb, IrValue *pos) {
+  if (def->block != bb) {
+    return ir_dominates(def->block, bb);
+  }
+  return !pos || def->pos < pos->pos;
+}
+
+// IRの形が正しいか調べて、正しくなければエラーにする
+void ir_verify(IrFunc *f) {
+  fn = f;
+  ir_compute_rpo(f);
+  ir_compute_dominators(f);
+
+  // ブロックの中での順番
+  for (IrBlock *bb = f->blocks; bb; bb = bb->next) {
+    int pos = 0;
+    for (IrValue *v = bb->first; v; v = v->next) {
+      v->pos = pos++;
+    }
+  }
+
+  IrBlock *succs[2];
+  for (IrBlock *bb = f->blocks; bb; bb = bb->next) {
+    if (bb->rpo < 0) {
+      verify_error(bb, NULL, "入口から到達できないブロックがあります");
+    }
+    if (!bb->last || !ir_is_terminator(bb->last)) {
+      verify_error(bb, NULL, "ブロックが jmp, br, ret で終わっていません");
+    }
+
+    int n = ir_successors(bb, succs);
+    for (int i = 0; i < n; i++) {
+      if (!has_pred(succs[i], bb)) {
+        verify_error(bb, bb->last, "飛び先のブロックの preds にありません");
+      }
+    }
+    for (int i = 0; i < bb->npreds; i++) {
+      IrBlock *p = bb->preds[i];
+      int m = ir_successors(p, succs);
+      if (!(m > 0 && succs[0] == bb) && !(m > 1 && succs[1] == bb)) {
+        verify_error(bb, NULL, "preds のブロックから飛んできません");
+      }
+    }
+
+    bool in_phis = true;
+    for (IrValue *v = bb->first; v; v = v->next) {
+      if (v->block != bb) {
+        verify_error(bb, v, "命令の block が正しくありません");
+      }
+      if (ir_is_terminator(v) && v != bb->last) {
+        verify_error(bb, v, "ブロックの途中に jmp, br, ret があります");
+      }
+      if (v->op == IR_PHI) {
+        if (!in_phis) {
+          verify_error(bb, v, "phi がブロックの先頭にありません");
+        }
+        if (v->nargs != bb->npreds) {
+          verify_error(bb, v, "phi の引数の数が preds の数と違います");
+        }
+      } else {
+        in_phis = false;
+      }
+
+      for (int i = 0; i < v->nargs; i++) {
+        IrValue *arg = v->args[i];
+        if (!arg || !arg->block) {
+          verify_error(bb, v, "消された値を使っています");
+        }
+        if (!ir_has_value(arg)) {
+          verify_error(bb, v, "値のない命令を引数にしています");
+        }
+        if (v->op == IR_PHI) {
+          if (!available_at(arg, bb->preds[i], NULL)) {
+            verify_error(bb, v, "phi の引数が前のブロックの終わりで使えません");
+          }
+        } else if (!available_at(arg, bb, v)) {
+          verify_error(bb, v, "引数の値が定義より前で使われています");
+        }
+      }
+    }
+  }
+}
+
+//
+// 表示
+//
+
+static void print_value(IrValue *v) {
+  if (ir_has_value(v)) {
+    printf("##   v%d = %s", v->id, ir_op_names[v->op]);
+  } else {
+    printf("##   %s", ir_op_names[v->op]);
+  }
+  if (v->op == IR_LOAD || v->op == IR_STORE || v->op == IR_EXT) {
+    printf(".%s%d", v->is_bool ? "bool" : "", v->size);
+  }
+
+  switch (v->op) {
+    case IR_CONST:
+    case IR_PARAM:
+      printf(" %ld", v->val);
+      break;
+    case IR_LOCAL:
+      printf(" %s", v->var->name);
+      break;
+    case IR_GLOBAL:
+    case IR_CALL:
+      printf(" %s", v->name);
+      break;
+  }
+
+  for (int i = 0; i < v->nargs; i++) {
+    printf("%s", i == 0 && v->op != IR_CALL && v->op != IR_GLOBAL ? " " : ", ");
+    if (v->op == IR_PHI) {
+      printf("[bb%d: v%d]", v->block->preds[i]->id, v->args[i]->id);
+    } else {
+      printf("v%d", v->args[i]->id);
+    }
+  }
+
+  if (v->op == IR_JMP) {
+    printf(" bb%d", v->target->id);
+  } else if (v->op == IR_BR) {
+    printf(", bb%d, bb%d", v->target->id, v->els->id);
+  }
+  printf("\n");
+}
+
+// IRを表示する(--ir)
+void ir_print(IrFunc *f) {
+  printf("## ir %s\n", f->func->name);
+  for (IrBlock *bb = f->blocks; bb; bb = bb->next) {
+    printf("## bb%d:", bb->id);
+    if (bb->npreds) {
+      printf(" ; preds");
+      for (int i = 0; i < bb->npreds; i++) {
+        printf(" bb%d", bb->preds[i]->id);
+      }
+    }
+    printf("\n");
+    for (IrValue *v = bb->first; v; v = v->next) {
+      print_value(v);
+    }
+  }
+}
@@ -0,0 +1,1184 @@
+#include "ynicc.h"
+
+// IRからのコード生成(-O1)
+//
+// ir_lower で作ったSSA形式のIRから、関数1個分のアセンブリを出力する。
+//
+// 1. 使われない値を消し、br の直前にある比較は cmp + jcc にまとめる
+// 2. 危険辺(後続が複数あるブロックから前が複数あるブロックへの辺)を分割して、phi の値を渡す移動を
+//    前のブロックの jmp の直前に置けるようにする
+// 3. ブロックを逆後順に並べて命令に位置を振り、生存解析をして、値ごとの生存区間を求める
+//    (区間は生きている位置全体を覆う1つの区間にする)
+// 4. 線形スキャンでレジスタを割り当てる。関数呼び出しをまたいで生きる値は callee-saved のレジスタに置き、
+//    レジスタが足りなければ一番先まで生きる値をスタックに追い出す
+//
+// 定数、ローカル変数やグローバル変数のアドレスはレジスタを割り当てず、使う所で毎回作る。
+
+// 値を置くレジスタと作業用のレジスタ
+//
+// 1 〜 ALLOC_REG_NUM 番目を値に割り当てる(FIRST_CALLEE_SAVED 番目からは callee-saved)。
+// rdx, rcx, rax は idiv、シフト、関数の引数や戻り値、移動の一時置き場に使うので値には割り当てない。
+enum {
+  ALLOC_REG_NUM = 11,
+  FIRST_CALLEE_SAVED = 7,
+  REG_RDX = 12,
+  REG_RCX = 13,
+  REG_RAX = 14,
+};
+
+static char *REGISTERS_SIZE8[] = {
+  "", "rdi", "rsi", "r8", "r9", "r10", "r11", "rbx", "r12", "r13", "r14", "r15", "rdx", "rcx", "rax",
+};
+
+static char *REGISTERS_SIZE4[] = {
+  "", "edi", "esi", "r8d", "r9d", "r10d", "r11d", "ebx", "r12d", "r13d", "r14d", "r15d", "edx", "ecx", "eax",
+};
+
+static char *REGISTERS_SIZE2[] = {
+  "", "di", "si", "r8w", "r9w", "r10w", "r11w", "bx", "r12w", "r13w", "r14w", "r15w", "dx", "cx", "ax",
+};
+
+static char *REGISTERS_SIZE1[] = {
+  "", "dil", "sil", "r8b", "r9b", "r10b", "r11b", "bl", "r12b", "r13b", "r14b", "r15b", "dl", "cl", "al",
+};
+
+// 引数を渡すレジスタの番号(rdi, rsi, rdx, rcx, r8, r9)
+static int ARGUMENT_REGISTERS[] = {1, 2, 12, 13, 3, 4};
+
+// コード生成中の関数
+static IrFunc *fn;
+static char *funcname;
+
+// ブロックを並べた順番
+static IrBlock **layout;
+static int nlayout;
+
+// 命令の位置の数
+static int npos;
+// calls_before[p] は位置 p より前にある関数呼び出しの数
+static int *calls_before;
+// 生存区間を求める時にさかのぼるブロックのスタック
+static IrBlock **walk_stack;
+
+// スタックに追い出した値の数と、使った callee-saved のレジスタ
+static int nspills;
+static bool used_registers[ALLOC_REG_NUM + 1];
+
+static void *ir_alloc(long size) {
+  return arena_alloc(ARENA_CODEGEN, size);
+}
+
+// "  op dst, src" の1行を書く
+static void emit_op(char *op, char *dst, char *src) {
+  emit("  ");
+  emit(op);
+  emit(" ");
+  emit(dst);
+  emit(", ");
+  emitln(src);
+}
+
+static void emit_op_num(char *op, char *dst, long imm) {
+  emit("  ");
+  emit(op);
+  emit(" ");
+  emit(dst);
+  emit(", ");
+  emit_num(imm);
+  emit("\n");
+}
+
+static char *num_str(long val) {
+  char *buf = ir_alloc(24);
+  sprintf(buf, "%ld", val);
+  return buf;
+}
+
+static char *mem_str(int offset) {
+  char *buf = ir_alloc(32);
+  sprintf(buf, "QWORD PTR [rbp-%d]", offset);
+  return buf;
+}
+
+static bool is_compare(IrValue *v) {
+  return v->op == IR_EQ || v->op == IR_NE || v->op == IR_LT || v->op == IR_LE;
+}
+
+// レジスタかスタックに値を置く必要があるかどうか
+static bool needs_location(IrValue *v) {
+  if (!ir_has_value(v) || v->fused || v->uses == 0) {
+    return false;
+  }
+  return v->op != IR_CONST && v->op != IR_LOCAL && v->op != IR_GLOBAL;
+}
+
+static bool is_imm32(IrValue *v) {
+  return v->op == IR_CONST && v->val == (int)v->val;
+}
+
+// val の下位 size バイトを符号拡張した値
+static long truncate(long val, int size) {
+  if (size == 1) {
+    return (char)val;
+  }
+  if (size == 2) {
+    return (short)val;
+  }
+  if (size == 4) {
+    return (int)val;
+  }
+  return val;
+}
+
+//
+// 前処理
+//
+
+// 各値の使われている数を数える
+static void count_uses(void) {
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      v->uses = 0;
+    }
+  }
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      for (int i = 0; i < v->nargs; i++) {
+        v->args[i]->uses++;
+      }
+    }
+  }
+}
+
+// 直後の命令でしか使わない値は、その命令とまとめてコードを出す
+// br の条件の比較は cmp + jcc に、メモリを読み書きするアドレスの加算は [base+index] にする
+static void fuse_values(void) {
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      IrValue *prev = v->prev;
+      if (!prev || v->nargs == 0 || v->args[0] != prev || prev->uses != 1) {
+        continue;
+      }
+      if (v->op == IR_BR && is_compare(prev)) {
+        prev->fused = true;
+      }
+      if ((v->op == IR_LOAD || v->op == IR_STORE) && prev->op == IR_ADD) {
+        prev->fused = true;
+      }
+    }
+  }
+}
+
+// from から *slot への辺の間に jmp だけのブロックを入れる
+static void split_edge(IrBlock *from, IrBlock **slot) {
+  IrBlock *to = *slot;
+  IrBlock *bb = ir_new_block(fn);
+  IrValue *jmp = ir_new_value(fn, IR_JMP);
+  jmp->target = to;
+  ir_append(bb, jmp);
+
+  bb->preds = ir_alloc(sizeof(IrBlock *));
+  bb->preds[0] = from;
+  bb->npreds = 1;
+  bb->preds_cap = 1;
+  bb->sealed = true;
+  // phi の引数の順番が変わらないように、同じ位置の pred を置き換える
+  for (int i = 0; i < to->npreds; i++) {
+    if (to->preds[i] == from) {
+      to->preds[i] = bb;
+      break;
+    }
+  }
+  *slot = bb;
+}
+
+static void split_critical_edges(void) {
+  IrBlock *last = fn->last_block;
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    IrValue *br = bb->last;
+    if (br->op == IR_BR) {
+      if (br->target->npreds > 1) {
+        split_edge(bb, &br->target);
+      }
+      if (br->els->npreds > 1) {
+        split_edge(bb, &br->els);
+      }
+    }
+    if (bb == last) {
+      // 分割で追加したブロックは jmp で終わるので見なくてよい
+      break;
+    }
+  }
+}
+
+// bb から phi のある to に来た時の、phi の引数の番号
+static int pred_index(IrBlock *to, IrBlock *bb) {
+  for (int i = 0; i < to->npreds; i++) {
+    if (to->preds[i] == bb) {
+      return i;
+    }
+  }
+  error("%s: bb%d は bb%d の前のブロックではありません", funcname, bb->id, to->id);
+  return -1;
+}
+
+//
+// 生存区間
+//
+
+// ブロックを並べて、命令に位置を振る(phi はブロックの先頭、引数は関数の先頭の位置にする)
+static void number_positions(void) {
+  ir_compute_rpo(fn);
+  layout = fn->rpo;
+  nlayout = fn->nrpo;
+
+  int pos = 0;
+  for (int i = 0; i < nlayout; i++) {
+    IrBlock *bb = layout[i];
+    bb->layout_next = i + 1 < nlayout ? layout[i + 1] : NULL;
+    bb->start = pos;
+    for (IrValue *v = bb->first; v; v = v->next) {
+      if (v->op == IR_PHI) {
+        v->pos = bb->start;
+      } else if (v->op == IR_PARAM) {
+        v->pos = 0;
+      } else {
+        pos = pos + 2;
+        v->pos = pos;
+      }
+    }
+    bb->end = pos + 1;
+    pos = pos + 2;
+  }
+  npos = pos + 1;
+
+  int nedges = 0;
+  for (int i = 0; i < nlayout; i++) {
+    nedges = nedges + layout[i]->npreds;
+  }
+  walk_stack = ir_alloc((nedges + 1) * sizeof(IrBlock *));
+
+  calls_before = ir_alloc((npos + 1) * sizeof(int));
+  char *is_call = ir_alloc(npos + 1);
+  for (int i = 0; i < nlayout; i++) {
+    for (IrValue *v = layout[i]->first; v; v = v->next) {
+      if (v->op == IR_CALL) {
+        is_call[v->pos] = true;
+      }
+    }
+  }
+  for (int p = 0; p < npos; p++) {
+    calls_before[p + 1] = calls_before[p] + is_call[p];
+  }
+}
+
+static void extend_interval(IrValue *v, int pos) {
+  if (pos < v->start) {
+    v->start = pos;
+  }
+  if (pos > v->end) {
+    v->end = pos;
+  }
+}
+
+// v が bb の入口で生きている時に、定義のあるブロックまで前のブロックをさかのぼって生存区間を広げる
+static void extend_live_in(IrValue *v, IrBlock *bb) {
+  int sp = 0;
+  walk_stack[sp++] = bb;
+  while (sp > 0) {
+    IrBlock *b = walk_stack[--sp];
+    if (b == v->block || b->live_mark == v->id + 1) {
+      continue;
+    }
+    b->live_mark = v->id + 1;
+    extend_interval(v, b->start);
+    for (int i = 0; i < b->npreds; i++) {
+      extend_interval(v, b->preds[i]->end);
+      walk_stack[sp++] = b->preds[i];
+    }
+  }
+}
+
+// 値ごとに、定義から各使用までの間で生きている位置を全部覆う区間を求める
+// (値を使う所から定義まで前のブロックへさかのぼるので、かかる時間は生きている範囲の大きさに比例する)
+static void build_intervals(void) {
+  // 値ごとにそれを使う命令と引数の番号を並べる(値 v を使うものは use_begin[v->id] 〜 use_begin[v->id + 1] 番目)
+  int *use_begin = ir_alloc((fn->nvalues + 1) * sizeof(int));
+  int nuses = 0;
+  for (int i = 0; i < nlayout; i++) {
+    for (IrValue *v = layout[i]->first; v; v = v->next) {
+      v->start = v->pos;
+      v->end = v->pos;
+      for (int j = 0; j < v->nargs; j++) {
+        use_begin[v->args[j]->id + 1]++;
+        nuses++;
+      }
+    }
+  }
+  for (int id = 0; id < fn->nvalues; id++) {
+    use_begin[id + 1] = use_begin[id + 1] + use_begin[id];
+  }
+  IrValue **users = ir_alloc((nuses + 1) * sizeof(IrValue *));
+  int *user_args = ir_alloc((nuses + 1) * sizeof(int));
+  int *filled = ir_alloc((fn->nvalues + 1) * sizeof(int));
+  for (int i = 0; i < nlayout; i++) {
+    for (IrValue *v = layout[i]->first; v; v = v->next) {
+      for (int j = 0; j < v->nargs; j++) {
+        int id = v->args[j]->id;
+        int k = use_begin[id] + filled[id];
+        filled[id]++;
+        users[k] = v;
+        user_args[k] = j;
+      }
+    }
+  }
+
+  // 入口で生きている印はブロックに1つしか付けられないので、値ごとに全部の使用をまとめて処理する
+  for (int i = 0; i < nlayout; i++) {
+    for (IrValue *v = layout[i]->first; v; v = v->next) {
+      if (!needs_location(v)) {
+        continue;
+      }
+      for (int k = use_begin[v->id]; k < use_begin[v->id + 1]; k++) {
+        IrValue *user = users[k];
+        if (user->op == IR_PHI) {
+          // phi の値は前のブロックの jmp の直前で渡す
+          IrBlock *pred = user->block->preds[user_args[k]];
+          extend_interval(v, pred->last->pos);
+          extend_live_in(v, pred);
+        } else {
+          extend_interval(v, user->pos);
+          extend_live_in(v, user->block);
+        }
+      }
+    }
+  }
+}
+
+//
+// レジスタ割り当て
+//
+
+static bool crosses_call(IrValue *v) {
+  return calls_before[v->end] - calls_before[v->start + 1] > 0;
+}
+
+static void spill(IrValue *v) {
+  v->reg = 0;
+  nspills++;
+  v->offset = fn->func->stack_size + nspills * 8;
+}
+
+// v を置きたいレジスタ(0ならなし)
+// 1番目の引数と同じレジスタなら mov が要らず、phi とその引数が同じレジスタならブロックの間の移動が要らない
+static int register_hint(IrValue *v) {
+  if (v->op == IR_PHI) {
+    for (int i = 0; i < v->nargs; i++) {
+      if (v->args[i]->reg) {
+        return v->args[i]->reg;
+      }
+    }
+    return 0;
+  }
+  if (v->nargs > 0) {
+    return v->args[0]->reg;
+  }
+  return 0;
+}
+
+static void allocate_registers(void) {
+  nspills = 0;
+  for (int r = 0; r <= ALLOC_REG_NUM; r++) {
+    used_registers[r] = false;
+  }
+
+  // 生存区間を始まる位置ごとに分ける
+  IrValue **starts = ir_alloc(npos * sizeof(IrValue *));
+  for (int i = 0; i < nlayout; i++) {
+    for (IrValue *v = layout[i]->first; v; v = v->next) {
+      if (needs_location(v)) {
+        v->interval_next = starts[v->start];
+        starts[v->start] = v;
+      }
+    }
+  }
+
+  // active[r] はレジスタ r に今置いている値
+  IrValue **active = ir_alloc((ALLOC_REG_NUM + 1) * sizeof(IrValue *));
+  for (int p = 0; p < npos; p++) {
+    for (IrValue *v = starts[p]; v; v = v->interval_next) {
+      // 命令は引数を読んでから結果を書くので、ここで使い終わる値のレジスタは結果に使える
+      for (int r = 1; r <= ALLOC_REG_NUM; r++) {
+        if (active[r] && active[r]->end <= v->start) {
+          active[r] = NULL;
+        }
+      }
+
+      // 関数呼び出しをまたぐ値は callee-saved のレジスタにしか置けない
+      int first = crosses_call(v) ? FIRST_CALLEE_SAVED : 1;
+      int reg = register_hint(v);
+      if (reg < first || active[reg]) {
+        reg = 0;
+      }
+      for (int r = first; r <= ALLOC_REG_NUM && !reg; r++) {
+        if (!active[r]) {
+          reg = r;
+        }
+      }
+
+      if (!reg) {
+        // 空きがなければ一番先まで生きる値をスタックに追い出す
+        int victim = first;
+        for (int r = first; r <= ALLOC_REG_NUM; r++) {
+          if (active[r]->end > active[victim]->end) {
+            victim = r;
+          }
+        }
+        if (active[victim]->end <= v->end) {
+          spill(v);
+          continue;
+        }
+        spill(active[victim]);
+        reg = victim;
+      }
+
+      v->reg = reg;
+      active[reg] = v;
+      used_registers[reg] = true;
+    }
+  }
+}
+
+// レジスタを割り当てずに、場所の要る値を全部スタックに置く
+static void spill_all(void) {
+  nspills = 0;
+  for (int r = 0; r <= ALLOC_REG_NUM; r++) {
+    used_registers[r] = false;
+  }
+  for (int i = 0; i < nlayout; i++) {
+    for (IrValue *v = layout[i]->first; v; v = v->next) {
+      if (needs_location(v)) {
+        spill(v);
+      }
+    }
+  }
+}
+
+//
+// 値の読み書き
+//
+
+// 値の場所(正ならレジスタの番号、負ならスタックの rbp からのオフセットを負にしたもの)
+static int loc_of(IrValue *v) {
+  return v->reg ? v->reg : -v->offset;
+}
+
+static char *loc_str(int loc) {
+  return loc > 0 ? REGISTERS_SIZE8[loc] : mem_str(-loc);
+}
+
+// v の値をレジスタ r に入れる
+static void load_to(int r, IrValue *v) {
+  char *dst = REGISTERS_SIZE8[r];
+  switch (v->op) {
+    case IR_CONST:
+      if (is_imm32(v)) {
+        emit_op_num("mov", dst, v->val);
+      } else {
+        emit_op_num("movabs", dst, v->val);
+      }
+      return;
+    case IR_LOCAL:
+      emit("  lea ");
+      emit(dst);
+      emit(", [rbp-");
+      emit_num(v->var->offset);
+      emitln("]");
+      return;
+    case IR_GLOBAL:
+      emit("  mov ");
+      emit(dst);
+      emit(", offset ");
+      emitln(v->name);
+      return;
+  }
+  if (loc_of(v) != r) {
+    emit_op("mov", dst, loc_str(loc_of(v)));
+  }
+}
+
+// v の値を命令の2番目のオペランドとして書いた文字列(定数は即値、場所がないものは scratch に作る)
+static char *src_operand(IrValue *v, int scratch) {
+  if (is_imm32(v)) {
+    return num_str(v->val);
+  }
+  if (v->op == IR_GLOBAL) {
+    char *buf = ir_alloc(strlen(v->name) + 8);
+    sprintf(buf, "offset %s", v->name);
+    return buf;
+  }
+  if (!needs_location(v)) {
+    load_to(scratch, v);
+    return REGISTERS_SIZE8[scratch];
+  }
+  return loc_str(loc_of(v));
+}
+
+// v の値を置くレジスタに結果を作る時の、作業するレジスタ
+static int dst_reg(IrValue *v) {
+  return v->reg ? v->reg : REG_RAX;
+}
+
+// レジスタ r に作った v の値を v の場所に置く
+static void finish(IrValue *v, int r) {
+  if (!needs_location(v)) {
+    return;
+  }
+  if (v->reg != r) {
+    emit_op("mov", loc_str(loc_of(v)), REGISTERS_SIZE8[r]);
+  }
+}
+
+// v の値が入っているレジスタ(レジスタになければ scratch に入れる)
+static int value_reg(IrValue *v, int scratch) {
+  if (v->reg) {
+    return v->reg;
+  }
+  load_to(scratch, v);
+  return scratch;
+}
+
+// メモリを読み書きする時の、アドレスのオペランド(scratch と rdx を使うことがある)
+static char *addr_operand(IrValue *addr, int scratch) {
+  char *buf = ir_alloc(64);
+  if (addr->op == IR_LOCAL) {
+    sprintf(buf, "[rbp-%d]", addr->var->offset);
+    return buf;
+  }
+  if (!addr->fused) {
+    sprintf(buf, "[%s]", REGISTERS_SIZE8[value_reg(addr, scratch)]);
+    return buf;
+  }
+
+  // アドレスの加算をまとめる
+  IrValue *base = addr->args[0];
+  IrValue *index = addr->args[1];
+  if (is_imm32(base)) {
+    base = addr->args[1];
+    index = addr->args[0];
+  }
+  long disp = 0;
+  char *base_str;
+  if (base->op == IR_LOCAL) {
+    base_str = "rbp";
+    disp = -base->var->offset;
+  } else {
+    base_str = REGISTERS_SIZE8[value_reg(base, scratch)];
+  }
+  char *index_str = "";
+  if (is_imm32(index) && disp + index->val == (int)(disp + index->val)) {
+    disp = disp + index->val;
+  } else {
+    index_str = REGISTERS_SIZE8[value_reg(index, REG_RDX)];
+  }
+  if (disp) {
+    sprintf(buf, "[%s%s%s%+ld]", base_str, *index_str ? "+" : "", index_str, disp);
+  } else {
+    sprintf(buf, "[%s%s%s]", base_str, *index_str ? "+" : "", index_str);
+  }
+  return buf;
+}
+
+// 場所から場所への64bitの移動
+static void emit_move(int dst, int src) {
+  if (dst == src) {
+    return;
+  }
+  if (dst < 0 && src < 0) {
+    emit_op("mov", "rcx", mem_str(-src));
+    emit_op("mov", mem_str(-dst), "rcx");
+    return;
+  }
+  emit_op("mov", loc_str(dst), loc_str(src));
+}
+
+// 場所を持たない値 v を場所 dst に作る
+static void materialize(int dst, IrValue *v) {
+  if (dst > 0) {
+    load_to(dst, v);
+  } else if (is_imm32(v)) {
+    emit_op_num("mov", mem_str(-dst), v->val);
+  } else {
+    load_to(REG_RAX, v);
+    emit_op("mov", mem_str(-dst), "rax");
+  }
+}
+
+// from[i] から dst[i] への移動を同時に行う(from[i] が0なら srcs[i] の値を作る)
+// 他の移動がまだ読む場所には書かないように順番を決め、循環していれば1つを rax に逃がす。
+static void parallel_move(int *dst, int *from, IrValue **srcs, int n) {
+  bool *done = ir_alloc(n + 1);
+  for (int i = 0; i < n; i++) {
+    if (from[i] == dst[i]) {
+      done[i] = true;
+    }
+  }
+
+  for (;;) {
+    bool remaining = false;
+    bool progress = false;
+    for (int i = 0; i < n; i++) {
+      if (done[i] || !from[i]) {
+        continue;
+      }
+      remaining = true;
+      bool blocked = false;
+      for (int j = 0; j < n; j++) {
+        if (j != i && !done[j] && from[j] == dst[i]) {
+          blocked = true;
+        }
+      }
+      if (!blocked) {
+        emit_move(dst[i], from[i]);
+        done[i] = true;
+        progress = true;
+      }
+    }
+    if (!remaining) {
+      break;
+    }
+    if (!progress) {
+      // 移動が循環しているので、移動先の1つの今の値を rax に逃がす
+      int i = 0;
+      while (done[i] || !from[i]) {
+        i++;
+      }
+      emit_move(REG_RAX, dst[i]);
+      for (int j = 0; j < n; j++) {
+        if (!done[j] && from[j] == dst[i]) {
+          from[j] = REG_RAX;
+        }
+      }
+    }
+  }
+
+  // 定数などは最後に作る(作るのに rax を使うことがあるので)
+  for (int i = 0; i < n; i++) {
+    if (!done[i]) {
+      materialize(dst[i], srcs[i]);
+    }
+  }
+}
+
+// bb から to に飛ぶ前に、to の phi に値を渡す
+static void gen_phi_moves(IrBlock *bb, IrBlock *to) {
+  int nphis = 0;
+  for (IrValue *phi = to->first; phi && phi->op == IR_PHI; phi = phi->next) {
+    nphis++;
+  }
+  if (nphis == 0) {
+    return;
+  }
+
+  int idx = pred_index(to, bb);
+  int *dst = ir_alloc(nphis * sizeof(int));
+  int *from = ir_alloc(nphis * sizeof(int));
+  IrValue **srcs = ir_alloc(nphis * sizeof(IrValue *));
+  int n = 0;
+  for (IrValue *phi = to->first; phi && phi->op == IR_PHI; phi = phi->next) {
+    if (!needs_location(phi)) {
+      continue;
+    }
+    IrValue *arg = phi->args[idx];
+    dst[n] = loc_of(phi);
+    from[n] = needs_location(arg) ? loc_of(arg) : 0;
+    srcs[n] = arg;
+    n++;
+  }
+  parallel_move(dst, from, srcs, n);
+}
+
+//
+// 命令ごとのコード生成
+//
+
+static void gen_binary(IrValue *v, char *op) {
+  IrValue *a = v->args[0];
+  IrValue *b = v->args[1];
+  int d = dst_reg(v);
+  if (b->reg && b->reg == d && a != b) {
+    // 左辺を d に入れると右辺が壊れる
+    if (v->op == IR_SUB) {
+      d = REG_RAX;
+    } else {
+      IrValue *tmp = a;
+      a = b;
+      b = tmp;
+    }
+  }
+
+  load_to(d, a);
+  if (v->op == IR_MUL && is_imm32(b)) {
+    emit("  imul ");
+    emit(REGISTERS_SIZE8[d]);
+    emit(", ");
+    emit(REGISTERS_SIZE8[d]);
+    emit(", ");
+    emit_num(b->val);
+    emit("\n");
+  } else {
+    emit_op(op, REGISTERS_SIZE8[d], src_operand(b, REG_RCX));
+  }
+  finish(v, d);
+}
+
+static void gen_div(IrValue *v) {
+  load_to(REG_RAX, v->args[0]);
+  emitln("  cqo");
+  IrValue *b = v->args[1];
+  if (needs_location(b)) {
+    emitln_str("  idiv ", loc_str(loc_of(b)));
+  } else {
+    load_to(REG_RCX, b);
+    emitln("  idiv rcx");
+  }
+  finish(v, v->op == IR_DIV ? REG_RAX : REG_RDX);
+}
+
+static void gen_shift(IrValue *v, char *op) {
+  IrValue *b = v->args[1];
+  int d = dst_reg(v);
+  if (b->op == IR_CONST && b->val >= 0 && b->val < 64) {
+    load_to(d, v->args[0]);
+    emit_op_num(op, REGISTERS_SIZE8[d], b->val);
+  } else {
+    // シフトする数は cl に入れる(左辺を入れる前に読んでおく)
+    load_to(REG_RCX, b);
+    load_to(d, v->args[0]);
+    emit_op(op, REGISTERS_SIZE8[d], "cl");
+  }
+  finish(v, d);
+}
+
+// 比較の結果のフラグを見る jcc, setcc の条件(negate なら逆の条件)
+static char *cond_code(IrOp op, bool negate) {
+  switch (op) {
+    case IR_EQ:
+      return negate ? "ne" : "e";
+    case IR_NE:
+      return negate ? "e" : "ne";
+    case IR_LT:
+      return negate ? "ge" : "l";
+    case IR_LE:
+      return negate ? "g" : "le";
+  }
+  error("比較ではない命令です: %d", op);
+  return NULL;
+}
+
+static void gen_compare(IrValue *v) {
+  IrValue *a = v->args[0];
+  IrValue *b = v->args[1];
+  char *lhs;
+  if (needs_location(a)) {
+    lhs = loc_str(loc_of(a));
+  } else {
+    load_to(REG_RAX, a);
+    lhs = "rax";
+  }
+  char *rhs;
+  if (!a->reg && needs_location(a) && !b->reg && needs_location(b)) {
+    // メモリ同士は比較できない
+    load_to(REG_RCX, b);
+    rhs = "rcx";
+  } else {
+    rhs = src_operand(b, REG_RCX);
+  }
+  emit_op("cmp", lhs, rhs);
+
+  if (v->fused) {
+    // 直後の br でフラグを見る
+    return;
+  }
+  int d = dst_reg(v);
+  emit("  set");
+  emit(cond_code(v->op, false));
+  emitln(" al");
+  emit_op("movzb", REGISTERS_SIZE8[d], "al");
+  finish(v, d);
+}
+
+static void gen_ext(IrValue *v) {
+  IrValue *a = v->args[0];
+  int d = dst_reg(v);
+  if (v->is_bool) {
+    if (a->op == IR_CONST) {
+      emit_op_num("mov", REGISTERS_SIZE8[d], a->val != 0);
+    } else {
+      emit_op("cmp", src_operand(a, REG_RAX), "0");
+      emitln("  setne al");
+      emit_op("movzb", REGISTERS_SIZE8[d], "al");
+    }
+    finish(v, d);
+    return;
+  }
+
+  if (a->op == IR_CONST) {
+    emit_op_num("mov", REGISTERS_SIZE8[d], truncate(a->val, v->size));
+    finish(v, d);
+    return;
+  }
+
+  int s = value_reg(a, REG_RAX);
+  if (v->size == 1) {
+    emit_op("movsx", REGISTERS_SIZE8[d], REGISTERS_SIZE1[s]);
+  } else if (v->size == 2) {
+    emit_op("movsx", REGISTERS_SIZE8[d], REGISTERS_SIZE2[s]);
+  } else {
+    emit_op("movsxd", REGISTERS_SIZE8[d], REGISTERS_SIZE4[s]);
+  }
+  finish(v, d);
+}
+
+static void gen_load(IrValue *v) {
+  char *addr = addr_operand(v->args[0], REG_RAX);
+  int d = dst_reg(v);
+  char *dst = REGISTERS_SIZE8[d];
+  if (v->size == 1) {
+    emit("  movsx ");
+    emit(dst);
+    emit(", BYTE PTR ");
+  } else if (v->size == 2) {
+    emit("  movsx ");
+    emit(dst);
+    emit(", WORD PTR ");
+  } else if (v->size == 4) {
+    emit("  movsxd ");
+    emit(dst);
+    emit(", DWORD PTR ");
+  } else {
+    emit("  mov ");
+    emit(dst);
+    emit(", QWORD PTR ");
+  }
+  emitln(addr);
+  finish(v, d);
+}
+
+static void gen_store(IrValue *v) {
+  char *addr = addr_operand(v->args[0], REG_RAX);
+  IrValue *val = v->args[1];
+  if (val->op == IR_CONST && (v->size < 8 || is_imm32(val))) {
+    // 書き込むバイト数に切り詰めた即値を書く
+    if (v->size == 1) {
+      emit("  mov BYTE PTR ");
+    } else if (v->size == 2) {
+      emit("  mov WORD PTR ");
+    } else if (v->size == 4) {
+      emit("  mov DWORD PTR ");
+    } else {
+      emit("  mov QWORD PTR ");
+    }
+    emit(addr);
+    emit(", ");
+    emit_num(truncate(val->val, v->size));
+    emit("\n");
+    return;
+  }
+
+  int s = val->reg;
+  if (!s) {
+    load_to(REG_RCX, val);
+    s = REG_RCX;
+  }
+  if (v->size == 1) {
+    emit("  mov BYTE PTR ");
+    emit(addr);
+    emit(", ");
+    emitln(REGISTERS_SIZE1[s]);
+  } else if (v->size == 2) {
+    emit("  mov WORD PTR ");
+    emit(addr);
+    emit(", ");
+    emitln(REGISTERS_SIZE2[s]);
+  } else if (v->size == 4) {
+    emit("  mov DWORD PTR ");
+    emit(addr);
+    emit(", ");
+    emitln(REGISTERS_SIZE4[s]);
+  } else {
+    emit("  mov QWORD PTR ");
+    emit(addr);
+    emit(", ");
+    emitln(REGISTERS_SIZE8[s]);
+  }
+}
+
+static void gen_call(IrValue *v) {
+  // 7個目以降の引数はスタックに後ろから積む(rsp が16バイト境界になるように個数が奇数なら8バイト空ける)
+  int nstack = v->nargs > 6 ? v->nargs - 6 : 0;
+  int pad = nstack % 2 == 1 ? 8 : 0;
+  if (pad) {
+    emitln("  sub rsp, 8");
+  }
+  for (int i = v->nargs - 1; i >= 6; i--) {
+    IrValue *arg = v->args[i];
+    if (is_imm32(arg)) {
+      emitln_num("  push ", arg->val);
+    } else if (needs_location(arg)) {
+      emitln_str("  push ", loc_str(loc_of(arg)));
+    } else {
+      load_to(REG_RAX, arg);
+      emitln("  push rax");
+    }
+  }
+
+  int nregs = v->nargs < 6 ? v->nargs : 6;
+  int *dst = ir_alloc(6 * sizeof(int));
+  int *from = ir_alloc(6 * sizeof(int));
+  for (int i = 0; i < nregs; i++) {
+    dst[i] = ARGUMENT_REGISTERS[i];
+    from[i] = needs_location(v->args[i]) ? loc_of(v->args[i]) : 0;
+  }
+  parallel_move(dst, from, v->args, nregs);
+
+  // al に浮動小数点の可変長引数の数を入れる
+  emitln("  xor al, al");
+  emitln_str("  call ", v->name);
+  if (nstack * 8 + pad) {
+    emitln_num("  add rsp, ", nstack * 8 + pad);
+  }
+  if (v->is_bool) {
+    emitln("  movzb rax, al");
+  }
+  finish(v, REG_RAX);
+}
+
+static void emit_block_label(IrBlock *bb) {
+  emit(".L.bb.");
+  emit(funcname);
+  emit(".");
+  emit_num(bb->id);
+}
+
+static void emit_jump(char *op, IrBlock *bb) {
+  emit("  ");
+  emit(op);
+  emit(" ");
+  emit_block_label(bb);
+  emit("\n");
+}
+
+static void gen_br(IrBlock *bb, IrValue *v) {
+  IrValue *cond = v->args[0];
+  IrOp op = IR_NE;
+  if (cond->fused) {
+    op = cond->op;
+  } else if (cond->op == IR_CONST) {
+    emit_jump("jmp", cond->val ? v->target : v->els);
+    return;
+  } else {
+    emit_op("cmp", src_operand(cond, REG_RAX), "0");
+  }
+
+  char *jcc = ir_alloc(8);
+  if (v->target == bb->layout_next) {
+    sprintf(jcc, "j%s", cond_code(op, true));
+    emit_jump(jcc, v->els);
+    return;
+  }
+  sprintf(jcc, "j%s", cond_code(op, false));
+  emit_jump(jcc, v->target);
+  if (v->els != bb->layout_next) {
+    emit_jump("jmp", v->els);
+  }
+}
+
+static void gen_value(IrBlock *bb, IrValue *v) {
+  switch (v->op) {
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_LOCAL:
+    case IR_GLOBAL:
+    case IR_PHI:
+      return;
+    case IR_LOAD:
+      gen_load(v);
+      return;
+    case IR_STORE:
+      gen_store(v);
+      return;
+    case IR_ADD:
+      if (!v->fused) {
+        gen_binary(v, "add");
+      }
+      return;
+    case IR_SUB:
+      gen_binary(v, "sub");
+      return;
+    case IR_MUL:
+      gen_binary(v, "imul");
+      return;
+    case IR_AND:
+      gen_binary(v, "and");
+      return;
+    case IR_OR:
+      gen_binary(v, "or");
+      return;
+    case IR_XOR:
+      gen_binary(v, "xor");
+      return;
+    case IR_DIV:
+    case IR_MOD:
+      gen_div(v);
+      return;
+    case IR_SHL:
+      gen_shift(v, "shl");
+      return;
+    case IR_SAR:
+      gen_shift(v, "sar");
+      return;
+    case IR_EQ:
+    case IR_NE:
+    case IR_LT:
+    case IR_LE:
+      gen_compare(v);
+      return;
+    case IR_NOT:
+      {
+        int d = dst_reg(v);
+        load_to(d, v->args[0]);
+        emitln_str("  not ", REGISTERS_SIZE8[d]);
+        finish(v, d);
+      }
+      return;
+    case IR_EXT:
+      gen_ext(v);
+      return;
+    case IR_CALL:
+      gen_call(v);
+      return;
+    case IR_JMP:
+      gen_phi_moves(bb, v->target);
+      if (v->target != bb->layout_next) {
+        emit_jump("jmp", v->target);
+      }
+      return;
+    case IR_BR:
+      gen_br(bb, v);
+      return;
+    case IR_RET:
+      if (v->nargs) {
+        load_to(REG_RAX, v->args[0]);
+      }
+      if (bb->layout_next) {
+        emitln_str("  jmp .L.return.", funcname);
+      }
+      return;
+  }
+  error("%s: 予期しないIRの命令です: %d", funcname, v->op);
+}
+
+//
+// 関数
+//
+
+// 関数の先頭で、引数を割り当てた場所に移す
+static void gen_params(void) {
+  int *dst = ir_alloc(6 * sizeof(int));
+  int *from = ir_alloc(6 * sizeof(int));
+  IrValue **srcs = ir_alloc(6 * sizeof(IrValue *));
+  int n = 0;
+  for (IrValue *v = fn->entry->first; v; v = v->next) {
+    if (v->op == IR_PARAM && v->val < 6 && needs_location(v)) {
+      dst[n] = loc_of(v);
+      from[n] = ARGUMENT_REGISTERS[v->val];
+      srcs[n] = v;
+      n++;
+    }
+  }
+  parallel_move(dst, from, srcs, n);
+
+  // 7個目以降の引数は呼び出し側のスタック(リターンアドレスの上)にある
+  for (IrValue *v = fn->entry->first; v; v = v->next) {
+    if (v->op == IR_PARAM && v->val >= 6 && needs_location(v)) {
+      int d = dst_reg(v);
+      emitfln("  mov %s, [rbp+%ld]", REGISTERS_SIZE8[d], 16 + (v->val - 6) * 8);
+      finish(v, d);
+    }
+  }
+}
+
+void ir_codegen_func(Function *func) {
+  funcname = func->name;
+  fn = ir_lower(func);
+  ir_verify(fn);
+
+  run_ir_passes(fn);
+  count_uses();
+  if (pass_enabled(PASS_FUSE)) {
+    pass_begin(PASS_FUSE);
+    fuse_values();
+    pass_end(PASS_FUSE);
+  }
+  split_critical_edges();
+  number_positions();
+  if (pass_enabled(PASS_REGALLOC)) {
+    pass_begin(PASS_REGALLOC);
+    build_intervals();
+    allocate_registers();
+    pass_end(PASS_REGALLOC);
+  } else {
+    spill_all();
+  }
+
+  // スタックに追い出した値はローカル変数の下に、callee-saved のレジスタの元の値はさらにその下に置く
+  int saved_offset = func->stack_size + nspills * 8;
+  int nsaved = 0;
+  for (int r = FIRST_CALLEE_SAVED; r <= ALLOC_REG_NUM; r++) {
+    if (used_registers[r]) {
+      nsaved++;
+    }
+  }
+  int frame_size = (saved_offset + nsaved * 8 + 15) / 16 * 16;
+
+  if (!func->is_staitc) {
+    emitln_str(".global ", funcname);
+  }
+  emitfln("%s:", funcname);
+  emitln("  push rbp");
+  emitln("  mov rbp, rsp");
+  emitln_num("  sub rsp, ", frame_size);
+  int offset = saved_offset;
+  for (int r = FIRST_CALLEE_SAVED; r <= ALLOC_REG_NUM; r++) {
+    if (used_registers[r]) {
+      offset = offset + 8;
+      emitfln("  mov [rbp-%d], %s", offset, REGISTERS_SIZE8[r]);
+    }
+  }
+  gen_params();
+
+  for (int i = 0; i < nlayout; i++) {
+    IrBlock *bb = layout[i];
+    emit_block_label(bb);
+    emitln(":");
+    for (IrValue *v = bb->first; v; v = v->next) {
+      gen_value(bb, v);
+    }
+  }
+
+  emitfln(".L.return.%s:", funcname);
+  offset = saved_offset;
+  for (int r = FIRST_CALLEE_SAVED; r <= ALLOC_REG_NUM; r++) {
+    if (used_registers[r]) {
+      offset = offset + 8;
+      emitfln("  mov %s, [rbp-%d]", REGISTERS_SIZE8[r], offset);
+    }
+  }
+  emitln("  mov rsp, rbp");
+  emitln("  pop rbp");
+  emitln("  ret");
+
+  // IRは関数ごとに捨てる
+  arena_reset(ARENA_CODEGEN);
+}
@@ -0,0 +1,178 @@
+#include "ynicc.h"
+
+// IRを変形する最適化パス(pass.c から呼ばれる)
+
+static IrFunc *fn;
+
+static void *ir_alloc(long size) {
+  return arena_alloc(ARENA_CODEGEN, size);
+}
+
+// 置き換えた先をたどる
+static IrValue *resolve(IrValue *v) {
+  while (v->replaced) {
+    v = v->replaced;
+  }
+  return v;
+}
+
+//
+// 使われない値の削除
+//
+
+// 値を持つ命令のうち、どこからも使われないものを消す(消したことで使われなくなったものも消す)
+void ir_dce(IrFunc *f) {
+  fn = f;
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      v->uses = 0;
+    }
+  }
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      for (int i = 0; i < v->nargs; i++) {
+        v->args[i]->uses++;
+      }
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+      IrValue *next;
+      for (IrValue *v = bb->first; v; v = next) {
+        next = v->next;
+        if (v->uses || v->op == IR_STORE || v->op == IR_CALL || ir_is_terminator(v)) {
+          continue;
+        }
+        for (int i = 0; i < v->nargs; i++) {
+          v->args[i]->uses--;
+        }
+        ir_remove(v);
+        changed = true;
+      }
+    }
+  }
+}
+
+//
+// 共通部分式の削除
+//
+// 支配木を行きがけ順にたどり、その時点までに見た(=今のブロックを支配するブロックにある)計算をハッシュ表に入れておく。
+// 同じ命令で同じ引数の計算がすでにあれば、後の方をそれで置き換える。
+// 支配木の子をたどり終わったら、その子の中で入れた分を表から取り除く。
+// メモリを読む命令と関数呼び出しは間で値が変わりうるので対象にしない。
+//
+
+// ハッシュ表のバケツの先頭と、同じバケツの次の値(値の id で引く)
+static IrValue **buckets;
+static IrValue **chain;
+static int nbuckets;
+// 表に入れた順のバケツの番号(取り除く時に逆順に戻す)
+static int *undo_log;
+static int nundo;
+
+static bool is_pure(IrValue *v) {
+  return IR_ADD <= v->op && v->op <= IR_EXT;
+}
+
+static bool is_commutative(IrOp op) {
+  return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR || op == IR_XOR || op == IR_EQ ||
+         op == IR_NE;
+}
+
+static int expr_hash(IrValue *v) {
+  long h = v->op * 31 + v->size * 7 + v->is_bool;
+  if (is_commutative(v->op)) {
+    // 引数の順番によらないようにする
+    h = h * 31 + v->args[0]->id + v->args[1]->id;
+  } else {
+    for (int i = 0; i < v->nargs; i++) {
+      h = h * 31 + v->args[i]->id;
+    }
+  }
+  if (h < 0) {
+    h = -h;
+  }
+  return h % nbuckets;
+}
+
+static bool same_expr(IrValue *a, IrValue *b) {
+  if (a->op != b->op || a->nargs != b->nargs || a->size != b->size || a->is_bool != b->is_bool) {
+    return false;
+  }
+  if (a->nargs == 2 && is_commutative(a->op) && a->args[0] == b->args[1] && a->args[1] == b->args[0]) {
+    return true;
+  }
+  for (int i = 0; i < a->nargs; i++) {
+    if (a->args[i] != b->args[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void cse_block(IrBlock *bb) {
+  int saved = nundo;
+  IrValue *next;
+  for (IrValue *v = bb->first; v; v = next) {
+    next = v->next;
+    if (v->op == IR_PHI) {
+      continue;
+    }
+    for (int i = 0; i < v->nargs; i++) {
+      v->args[i] = resolve(v->args[i]);
+    }
+    if (!is_pure(v)) {
+      continue;
+    }
+
+    int h = expr_hash(v);
+    IrValue *found = NULL;
+    for (IrValue *e = buckets[h]; e && !found; e = chain[e->id]) {
+      if (same_expr(e, v)) {
+        found = e;
+      }
+    }
+    if (found) {
+      v->replaced = found;
+      ir_remove(v);
+      continue;
+    }
+    chain[v->id] = buckets[h];
+    buckets[h] = v;
+    undo_log[nundo++] = h;
+  }
+
+  for (IrBlock *child = bb->dom_child; child; child = child->dom_sibling) {
+    cse_block(child);
+  }
+
+  while (nundo > saved) {
+    int h = undo_log[--nundo];
+    buckets[h] = chain[buckets[h]->id];
+  }
+}
+
+void ir_cse(IrFunc *f) {
+  fn = f;
+  ir_compute_rpo(fn);
+  ir_compute_dominators(fn);
+
+  nbuckets = fn->nvalues * 2 + 1;
+  buckets = ir_alloc(nbuckets * sizeof(IrValue *));
+  chain = ir_alloc(fn->nvalues * sizeof(IrValue *));
+  undo_log = ir_alloc(fn->nvalues * sizeof(int));
+  nundo = 0;
+  cse_block(fn->entry);
+
+  // phi の引数は後のブロックで置き換えた値のこともあるので、最後に全部の引数をたどり直す
+  for (IrBlock *bb = fn->blocks; bb; bb = bb->next) {
+    for (IrValue *v = bb->first; v; v = v->next) {
+      for (int i = 0; i < v->nargs; i++) {
+        v->args[i] = resolve(v->args[i]);
+      }
+    }
+  }
+}
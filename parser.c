@@ -16,21 +16,44 @@
  *           変数がlocalsと重複しているが、このScopeの方はなまえの通りScopeの管理もしていて、ブロックスコープの管理をするために、
  *           localsの中の各変数(＋グローバル変数) に関して、その時点でのスコープにある変数のみ保持している。
  *           なので、 locals >= Scopeのvar_scope という関係になる
+ *           名前の検索は SymbolTable (internした名前のポインタをキーにしたハッシュマップ)で行う。
  */
 
+typedef struct Scope Scope;
+
+// 変数(typedef, enumの定数含む)と構造体のタグ名のハッシュマップのエントリ
+// VarScope, TagScopeの先頭に埋め込んで使う
+typedef struct ScopeEntry ScopeEntry;
+struct ScopeEntry {
+  ScopeEntry *next;        // 登録した順(新しい順)のリスト
+  ScopeEntry *bucket_next; // 同じバケットのエントリ(新しい順)
+  char *name;              // intern済みの名前
+  Scope *scope;            // このエントリを登録したブロックスコープ(グローバルならNULL)
+  int depth;
+};
+
+// 名前 -> ScopeEntry のハッシュマップ
+//
+// 同じ名前のエントリはバケットの中で新しい順に並ぶので、先に見つかった方が内側のスコープで宣言されたもの。
+// ブロックを抜ける時には Scope に印をつけるだけで、そのスコープのエントリは検索中に見つけた時点でバケットから外す。
+typedef struct SymbolTable SymbolTable;
+struct SymbolTable {
+  ScopeEntry *head;     // 今のスコープで見えているエントリ(新しい順)
+  ScopeEntry **buckets;
+  int capacity;         // bucketsの数(2のべき乗)
+  int count;            // headにつながっているエントリの数(の上限)
+};
+
 // 構造体とeumのタグ
 typedef struct TagScope TagScope;
 struct TagScope {
-  TagScope *next;
-  char *name; // タグ名
+  ScopeEntry entry;
   Type *ty; // 構造体/enumの型自身
-  int depth;
 };
 
 typedef struct VarScope VarScope;
 struct VarScope {
-  VarScope *next;
-  char *name;
+  ScopeEntry entry;
 
   // 変数の場合に設定
   Var *var;
@@ -41,14 +64,13 @@ struct VarScope {
   // enumの場合のみ設定
   Type *enum_ty;
   int enum_val;
-
-  int depth;
 };
 
-typedef struct Scope Scope;
 struct Scope {
-  VarScope *var_scope;
-  TagScope *tag_scope;
+  Scope *parent;
+  ScopeEntry *var_scope;
+  ScopeEntry *tag_scope;
+  bool is_left; // このスコープを抜けたかどうか
 };
 
 typedef enum {
@@ -57,11 +79,19 @@ typedef enum {
   EXTERN  = 1 << 2,
 } StorageClass;
 
+enum {
+  // SymbolTableのバケット数の初期値
+  SYMBOL_TABLE_INITIAL_CAPACITY = 1 << 8,
+};
+
 // 現在パース中のスコープにある変数(ローカル、グローバル含む)を管理する
-static VarScope *var_scope;
+static SymbolTable var_table;
 
 // 現在パース中のスコープにある構造体のタグ名を管理する
-static TagScope *tag_scope;
+static SymbolTable tag_table;
+
+// 現在パース中のブロックスコープ(グローバルならNULL)
+static Scope *current_scope;
 
 // 現在パース中のスコープの深さを保持
 static int scope_depth;
@@ -69,6 +99,10 @@ static int scope_depth;
 // 今パース中の関数のローカル変数(+仮引数)
 static VarList *locals = NULL;
 
+// 今パース中の関数名(関数の本体の外ならNULL)と、その関数の中で次に使うデータのラベルの番号
+static char *current_funcname;
+static int func_label_index;
+
 // グローバル変数
 static VarList *globals = NULL;
 
@@ -76,39 +110,132 @@ static VarList *globals = NULL;
 static Node *current_switch = NULL;
 
 static Scope *enter_scope(void) {
-  Scope *new_scope = calloc(1, sizeof(Scope));
+  Scope *new_scope = arena_alloc(ARENA_AST, sizeof(Scope));
 
-  new_scope->var_scope = var_scope;
-  new_scope->tag_scope = tag_scope;
+  new_scope->parent = current_scope;
+  new_scope->var_scope = var_table.head;
+  new_scope->tag_scope = tag_table.head;
+  current_scope = new_scope;
   scope_depth++;
 
   return new_scope;
 }
 
 static void leave_scope(Scope *prev_scope) {
-  var_scope = prev_scope->var_scope;
-  tag_scope = prev_scope->tag_scope;
+  // バケットからは後で検索した時に外す
+  prev_scope->is_left = true;
+  var_table.head = prev_scope->var_scope;
+  tag_table.head = prev_scope->tag_scope;
+  current_scope = prev_scope->parent;
   scope_depth--;
 }
 
+// intern済みの名前のポインタからバケットの位置を決める
+static int symbol_hash(char *name, int mask) {
+  long p = (long)name;
+  return ((p >> 3) ^ (p >> 11) ^ (p >> 19)) & mask;
+}
+
+static bool is_dead_entry(ScopeEntry *e) {
+  return e->scope && e->scope->is_left;
+}
+
+// 今見えているエントリだけでバケットを作り直す(エントリが多ければバケットを倍に広げる)
+static void symbol_table_grow(SymbolTable *t) {
+  int n = 0;
+  for (ScopeEntry *e = t->head; e; e = e->next) {
+    n++;
+  }
+  int new_capacity = t->capacity ? t->capacity : SYMBOL_TABLE_INITIAL_CAPACITY;
+  if (n * 2 > new_capacity) {
+    new_capacity *= 2;
+  }
+
+  // 古い方から順にバケットの先頭に入れ直すことで、バケット内の新しい順を保つ
+  ScopeEntry **entries = calloc(n + 1, sizeof(ScopeEntry *));
+  int i = n;
+  for (ScopeEntry *e = t->head; e; e = e->next) {
+    entries[--i] = e;
+  }
+
+  free(t->buckets);
+  t->buckets = calloc(new_capacity, sizeof(ScopeEntry *));
+  t->capacity = new_capacity;
+  for (i = 0; i < n; i++) {
+    ScopeEntry *e = entries[i];
+    int h = symbol_hash(e->name, new_capacity - 1);
+    e->bucket_next = t->buckets[h];
+    t->buckets[h] = e;
+  }
+  t->count = n;
+
+  free(entries);
+}
+
+static void symbol_table_push(SymbolTable *t, ScopeEntry *e, char *name) {
+  e->name = name;
+  e->scope = current_scope;
+  e->depth = scope_depth;
+  e->next = t->head;
+  t->head = e;
+
+  if (++t->count > t->capacity) {
+    // 広げる時にheadから入れ直すのでここでバケットにはつながない
+    symbol_table_grow(t);
+    return;
+  }
+  int h = symbol_hash(name, t->capacity - 1);
+  e->bucket_next = t->buckets[h];
+  t->buckets[h] = e;
+}
+
+// name(intern済み)のエントリをprevの次から新しい順に探す(prevがNULLなら一番新しいもの)
+static ScopeEntry *symbol_table_find(SymbolTable *t, char *name, ScopeEntry *prev) {
+  ScopeEntry **link;
+  if (prev) {
+    link = &prev->bucket_next;
+  } else {
+    if (!t->capacity) {
+      return NULL;
+    }
+    link = &t->buckets[symbol_hash(name, t->capacity - 1)];
+  }
+
+  while (*link) {
+    ScopeEntry *e = *link;
+    if (is_dead_entry(e)) {
+      // 抜けたスコープのエントリなのでバケットから外す
+      *link = e->bucket_next;
+      continue;
+    }
+    if (e->name == name) {
+      return e;
+    }
+    link = &e->bucket_next;
+  }
+  return NULL;
+}
+
+static void symbol_table_reset(SymbolTable *t) {
+  free(t->buckets);
+  t->head = NULL;
+  t->buckets = NULL;
+  t->capacity = 0;
+  t->count = 0;
+}
+
 static void push_tag_scope(Token *tag_tok, Type *type) {
-  TagScope *sc = calloc(1, sizeof(TagScope));
+  TagScope *sc = arena_alloc(ARENA_AST, sizeof(TagScope));
 
-  sc->name = my_strndup(tag_tok->str, tag_tok->len);
   sc->ty = type;
-  sc->next = tag_scope;
-  sc->depth = scope_depth;
-
-  tag_scope = sc;
+  symbol_table_push(&tag_table, &sc->entry, tag_tok->ident);
 }
 
+// name は intern済みの名前
 static VarScope *push_var_scope_helper(char *name) {
-  VarScope *sc = calloc(1, sizeof(VarScope));
+  VarScope *sc = arena_alloc(ARENA_AST, sizeof(VarScope));
 
-  sc->name = name;
-  sc->next = var_scope;
-  sc->depth = scope_depth;
-  var_scope = sc;
+  symbol_table_push(&var_table, &sc->entry, name);
 
   return sc;
 }
@@ -133,19 +260,41 @@ static void push_enum_scope(char *name, Type *enum_ty, int enum_val) {
 }
 
 static TagScope *find_tag(Token *tk) {
-  for (TagScope *sc = tag_scope; sc; sc = sc->next) {
-    if (strlen(sc->name) == tk->len && strncmp(sc->name, tk->str, tk->len) == 0) {
-      // fprintf(stderr, "tag: %s, sc_name: %s\n", my_strndup(tk->str, tk->len), sc->name);
-      return sc;
-    }
+  return (TagScope *)symbol_table_find(&tag_table, tk->ident, NULL);
+}
+
+// kind のノードが Node の body 以降のフィールド(文や関数呼び出し用)を使うかどうか
+bool node_has_stmt_part(NodeKind kind) {
+  switch (kind) {
+    case ND_BLOCK:
+    case ND_WHILE:
+    case ND_FOR:
+    case ND_IF:
+    case ND_TERNARY:
+    case ND_SWITCH:
+    case ND_CASE:
+    case ND_GOTO:
+    case ND_LABEL:
+    case ND_CALL:
+    case ND_VAR_DECL:
+      return true;
+    default:
+      return false;
   }
-  return NULL;
+}
+
+// body より前の部分だけのノードのサイズ
+static long compact_node_size(void) {
+  Node node;
+  return (char *)&node.body - (char *)&node;
 }
 
 static Node *new_node(NodeKind kind, Token *tok) {
-  Node *node = calloc(1, sizeof(Node));
+  long size = node_has_stmt_part(kind) ? (long)sizeof(Node) : compact_node_size();
+  Node *node = arena_alloc(ARENA_AST, size);
+  mem_count(MEM_NODE, size);
   node->kind = kind;
-  node->tok = tok;
+  node->loc = tok->str;
   return node;
 }
 
@@ -173,7 +322,8 @@ static Node *new_num_node(long val, Token *tk) {
 }
 
 static Var *new_var(char *name, Type *type, bool is_local) {
-  Var *var = calloc(1, sizeof(Var));
+  Var *var = arena_alloc(ARENA_AST, sizeof(Var));
+  mem_count(MEM_VAR, sizeof(Var));
   var->type = type;
   var->name = name;
   var->is_local = is_local;
@@ -188,7 +338,7 @@ static Var *new_var(char *name, Type *type, bool is_local) {
 static Var *new_lvar(char *name, Type *type) {
   Var *var = new_var(name, type, true);
 
-  VarList *v = calloc(1, sizeof(VarList));
+  VarList *v = arena_alloc(ARENA_AST, sizeof(VarList));
   v->var = var;
   v->next = locals;
 
@@ -206,7 +356,7 @@ static Var *new_gvar(char *name, Type *type, bool emit, bool is_static) {
     // VarListとして保存するが、関数定義などのND_CALLのときのチェックようにしか使わないものは
     // (new_varの中でやっている)スコープにのみいれて、
     // emit: false で呼び出してコード生成時に何も出力しないようにする。
-    VarList *v = calloc(1, sizeof(VarList));
+    VarList *v = arena_alloc(ARENA_AST, sizeof(VarList));
     v->var = var;
     v->next = globals;
     globals = v;
@@ -215,64 +365,20 @@ static Var *new_gvar(char *name, Type *type, bool emit, bool is_static) {
   return var;
 }
 
-static int error_at_line_num(char *loc) {
-  // user_input から loc までの間に何個改行があったか計算
-  char *p = user_input;
-  int num_lines = 0;
-
-  while (p != loc) {
-    if (*p == '\n') {
-      num_lines++;
-    }
-    p++;
-  }
-
-  return num_lines;
-}
-
-static int get_pos_by_line(char *loc) {
-  // locがその行で何桁目か返す
-  char *p = user_input;
-  int column = 0;
-
-  while (p != loc) {
-    if (*p == '\n') {
-      column = 0;
-    } else {
-      column++;
-    }
-    p++;
-  }
-
-  return column;
-}
-
-static char *get_error_lines(char *loc) {
-  int pos = 0;
-  char *p = user_input;
-
-  while (p != loc) {
-    pos++;
-    p++;
-  }
-
-  // locまできたら、その行の行末または文字列の最後まですすめる
-  while (*p && *p != '\n') {
-    pos++;
-    p++;
-  }
-
-  return my_strndup(user_input, pos);
-}
-
 void error_at(char *loc, char *fmt, ...) {
   va_list ap;
   va_start(ap, fmt);
 
-  int column = get_pos_by_line(loc);
-  fprintf(stderr, "file: %s\n", filename);
-  fprintf(stderr, "%s\n", get_error_lines(loc));
-  fprintf(stderr, "%*s", column, "");
+  // エラーのある行だけを表示する
+  char *line = line_start(loc);
+  char *end = line;
+  while (*end && *end != '\n') {
+    end++;
+  }
+
+  fprintf(stderr, "file: %s:%d\n", source_name(loc), line_number(loc));
+  fprintf(stderr, "%.*s\n", (int)(end - line), line);
+  fprintf(stderr, "%*s", (int)(loc - line), "");
   fprintf(stderr, "^ ");
   vfprintf(stderr, fmt, ap);
   fprintf(stderr, "\n");
@@ -305,21 +411,19 @@ static int align_to(int n, int align) {
   return ((n / align) + (n % align == 0 ? 0 : 1)) * align;
 }
 
-static bool peek_token(char *op) {
-  if (token->kind != TK_RESERVED ||
-      token->len != strlen(op) ||
-      memcmp(token->str, op, token->len)) {
-    return false;
-  }
-  return true;
+// 今のトークンが記号opかどうかを返す
+// 記号の種類はトークナイズ時に token->punct に分類済みなので整数比較だけで判定できる
+// (記号以外のトークンの punct は PK_DUMMY になっている)
+static bool peek_token(PunctKind op) {
+  return token->punct == op;
 }
 
-static Token *consume(char *op) {
+static Token *consume(PunctKind op) {
   Token *tk = token;
   if (!peek_token(op)) {
     return NULL;
   }
-  token = token->next;
+  token = next_token(token);
   return tk;
 }
 
@@ -336,7 +440,7 @@ static Token *consume_kind(TokenKind kind) {
   }
 
   Token *t = token;
-  token = token->next;
+  token = next_token(token);
 
   return t;
 }
@@ -350,20 +454,18 @@ static void expect_kind(TokenKind kind) {
 static Token *consume_ident() {
   if (token->kind == TK_IDENT) {
     Token *ret = token;
-    token = token->next;
+    token = next_token(token);
 
     return ret;
   }
   return NULL;
 }
 
-static void expect(char *op) {
-  if (token->kind != TK_RESERVED ||
-      token->len != strlen(op) ||
-      memcmp(token->str, op, token->len)) {
-    error_at(token->str, "'%c'(token->kind: %s, token->len: %d, op: %s)ではありません", op, token_kind_to_s(token->kind), token->len, op);
+static void expect(PunctKind op) {
+  if (!peek_token(op)) {
+    error_at(token->str, "'%s' ではありません(token->kind: %s, token->len: %d)", punct_kind_to_s(op), token_kind_to_s(token->kind), token->len);
   }
-  token = token->next;
+  token = next_token(token);
 }
 
 static long expect_number() {
@@ -371,7 +473,7 @@ static long expect_number() {
     error_at(token->str, "数ではありません。");
   }
   long val = token->val;
-  token = token->next;
+  token = next_token(token);
 
   return val;
 }
@@ -393,8 +495,8 @@ static char *expect_ident() {
   if (token->kind != TK_IDENT) {
     error_at(token->str, "識別子ではありません。");
   }
-  char *s = my_strndup(token->str, token->len);
-  token = token->next;
+  char *s = token->ident;
+  token = next_token(token);
   return s;
 }
 
@@ -402,17 +504,17 @@ static void expect_token(TokenKind kind) {
   if (token->kind != kind) {
     error_at(token->str, "トークンが %s ではありません。", token_kind_to_s(kind));
   }
-  token = token->next;
+  token = next_token(token);
 }
 
 // }か }, で終わると受理する
 bool consume_end() {
-  if (consume("}")) {
+  if (consume(PK_RBRACE)) {
     return true;
   }
 
   Token *tmp = token;
-  if (consume(",") && consume("}")) {
+  if (consume(PK_COMMA) && consume(PK_RBRACE)) {
     return true;;
   }
   token = tmp;
@@ -421,7 +523,7 @@ bool consume_end() {
 
 static void expect_end() {
   if (!consume_end())
-    expect("}");
+    expect(PK_RBRACE);
 }
 
 // }か }, で終わると受理する
@@ -429,9 +531,9 @@ bool peek_end() {
   Token *tmp = token;
   bool result = false;
 
-  if (consume("}")) {
+  if (consume(PK_RBRACE)) {
     result = true;
-  } else if (consume(",") && consume("}")) {
+  } else if (consume(PK_COMMA) && consume(PK_RBRACE)) {
     result =  true;;
   }
 
@@ -444,32 +546,31 @@ static bool at_eof() {
 }
 
 static VarScope *find_var(Token *token) {
-  for (VarScope *sc = var_scope; sc; sc = sc->next) {
+  char *name = token->ident;
+  for (ScopeEntry *e = symbol_table_find(&var_table, name, NULL); e; e = symbol_table_find(&var_table, name, e)) {
+    VarScope *sc = (VarScope *)e;
     if (sc->type_def) {
       // typedef は変数じゃないので無視
       continue;
     }
-
-    if (strlen(sc->name) == token->len &&
-        strncmp(sc->name, token->str, token->len) == 0) {
-      return sc;
-    }
+    return sc;
   }
   return NULL;
 }
 
 static Type *find_typedef(Token *tk) {
-  for (VarScope *sc = var_scope; sc; sc = sc->next) {
+  char *name = tk->ident;
+  if (!name) {
+    // 識別子以外はtypedef名にならない
+    return NULL;
+  }
+  for (ScopeEntry *e = symbol_table_find(&var_table, name, NULL); e; e = symbol_table_find(&var_table, name, e)) {
+    VarScope *sc = (VarScope *)e;
     if (sc->var) {
       // var はtypedefじゃないので無視
       continue;
     }
-
-    assert(sc);
-    if (strlen(sc->name) == tk->len &&
-        strncmp(sc->name, tk->str, tk->len) == 0) {
-      return sc->type_def;
-    }
+    return sc->type_def;
   }
   return NULL;
 }
@@ -646,10 +747,10 @@ static next_decl_type next_decl() {
   // toplevelでは
   // int;
   // のような式も合法で、これらは単に無視される。ので、その対応。
-  if (!consume(";")) {
+  if (!consume(PK_SEMICOLON)) {
     char *name = NULL;
     declarator(ty, &name);
-    if (consume("(")) {
+    if (consume(PK_LPAREN)) {
       token = tmp;
       return NEXT_DECL_FUNCTION_DEF;
     }
@@ -664,12 +765,13 @@ static void parse_typedef() {
   Type *ty = basetype(NULL);
   char *name;
   ty = declarator(ty, &name);
-  expect(";");
+  expect(PK_SEMICOLON);
   push_typedef_scope(name, ty);
 }
 
 static Initializer *new_init_val(Initializer *cur, int sz, long val) {
-  Initializer *initializer = calloc(1, sizeof(Initializer));
+  Initializer *initializer = arena_alloc(ARENA_AST, sizeof(Initializer));
+  mem_count(MEM_INITIALIZER, sizeof(Initializer));
   initializer->val = val;
   initializer->sz = sz;
   cur->next = initializer;
@@ -678,7 +780,8 @@ static Initializer *new_init_val(Initializer *cur, int sz, long val) {
 
 // addendは labelからのオフセットを指定するときに渡される
 static Initializer *new_init_label(Initializer *cur, char *label, long addend) {
-  Initializer *initializer = calloc(1, sizeof(Initializer));
+  Initializer *initializer = arena_alloc(ARENA_AST, sizeof(Initializer));
+  mem_count(MEM_INITIALIZER, sizeof(Initializer));
   initializer->label = label;
   initializer->addend = addend;
   cur->next = initializer;
@@ -749,7 +852,7 @@ static bool is_array_limit_over(Type *ty, int i) {
 
 static void skip_excess_elements2() {
   for (;;) {
-    if (consume("{")) {
+    if (consume(PK_LBRACE)) {
       skip_excess_elements2();
     } else {
       // brace以外の場合は何か式があるはずなので読み飛ばす
@@ -758,12 +861,12 @@ static void skip_excess_elements2() {
     if (consume_end()) {
       return;
     }
-    expect(",");
+    expect(PK_COMMA);
   }
 }
 
 static void skip_excess_elements(void) {
-  expect(",");
+  expect(PK_COMMA);
   fprintf(stderr, "省略された初期化式があります\n");
   skip_excess_elements2();
 }
@@ -792,13 +895,13 @@ static Initializer *gvar_initializer_sub(Initializer *cur, Type *ty) {
   }
 
   if (ty->kind == TY_ARRAY) {
-    bool has_open_brace = consume("{");
+    bool has_open_brace = consume(PK_LBRACE);
     int i = 0;
-    if (!peek_token("}")) {
+    if (!peek_token(PK_RBRACE)) {
       do {
         cur = gvar_initializer_sub(cur, ty->ptr_to);
         i++;
-      } while(!is_array_limit_over(ty, i) && !peek_end() && consume(","));
+      } while(!is_array_limit_over(ty, i) && !peek_end() && consume(PK_COMMA));
 
       if (has_open_brace && !consume_end()) {
         // "{" で始まってるのに、配列のサイズ個の初期化式を読んでもなおまだ初期化式が残っている場合、無視する
@@ -821,14 +924,14 @@ static Initializer *gvar_initializer_sub(Initializer *cur, Type *ty) {
   }
 
   if (ty->kind == TY_STRUCT) {
-    bool has_open_brace = consume("{");
-    if (!peek_token("}")) {
+    bool has_open_brace = consume(PK_LBRACE);
+    if (!peek_token(PK_RBRACE)) {
       Member *mem = ty->members;
       do {
         cur = gvar_initializer_sub(cur, mem->ty);
         cur = emit_struct_padding(cur, ty, mem);
         mem = mem->next;
-      } while(mem && !peek_end() && consume(","));
+      } while(mem && !peek_end() && consume(PK_COMMA));
 
       if (has_open_brace && !consume_end()) {
         // "{" で始まってるのに、配列のサイズ個の初期化式を読んでもなおまだ初期化式が残っている場合、無視する
@@ -847,7 +950,7 @@ static Initializer *gvar_initializer_sub(Initializer *cur, Type *ty) {
 
   // compound-literal で "{" 初期化式 "}" で初期化する場合に "{" が存在する
   // (int) { 1 } とか
-  bool has_open_brace = consume("{");
+  bool has_open_brace = consume(PK_LBRACE);
   Node *expr = ternary();
   if (has_open_brace) {
     expect_end();
@@ -880,7 +983,7 @@ static void global_var_decl() {
   StorageClass sclass = false;
   Type *type = basetype(&sclass);
 
-  if (consume(";")) {
+  if (consume(PK_SEMICOLON)) {
     // int; とかの場合
     return;
   }
@@ -890,7 +993,7 @@ static void global_var_decl() {
   type = declarator(type, &ident_name);
 
   if (sclass == TYPEDEF) {
-    expect(";");
+    expect(PK_SEMICOLON);
     push_typedef_scope(ident_name, type);
     return;
   }
@@ -900,18 +1003,18 @@ static void global_var_decl() {
   Var *var = new_gvar(ident_name, type, sclass != EXTERN, sclass == STATIC);
   if (sclass == EXTERN) {
     // extern の場合初期化式は書けず、宣言のみになる
-    expect(";");
+    expect(PK_SEMICOLON);
     return;
   }
-  if (!consume("=")) {
+  if (!consume(PK_ASSIGN)) {
     if (type->is_incomplete) {
       error_at(tk->str, "incomplete element type(gvar)");
     }
-    expect(";");
+    expect(PK_SEMICOLON);
     return;
   }
   var->initializer = gvar_initializer(type);
-  expect(";");
+  expect(PK_SEMICOLON);
 }
 
 
@@ -936,14 +1039,31 @@ Program *program() {
         // ここには来ないはず
         assert(false);
     }
+    // 宣言を1個読み終わったら、それより前のトークンに戻ることはないので捨てる
+    release_tokens_before(token);
   }
-  Program *program = calloc(1, sizeof(Program));
+  Program *program = arena_alloc(ARENA_AST, sizeof(Program));
   program->global_var = globals;
   program->functions = head.next;
 
   return program;
 }
 
+// programで作った構文木と型をまとめて解放する
+// (Node, Var, Type などはそれぞれのアリーナから確保しているので個別にはfreeしない)
+void free_program(Program *prg) {
+  symbol_table_reset(&var_table);
+  symbol_table_reset(&tag_table);
+  current_scope = NULL;
+  scope_depth = 0;
+  locals = NULL;
+  globals = NULL;
+  current_switch = NULL;
+
+  arena_release(ARENA_AST);
+  arena_release(ARENA_TYPE);
+}
+
 // cの宣言
 // - typedefは何回書いても1個とみなされる。またtypedefしたい型名を省略した場合intとしてtypedefされる。
 //   - 下記は全部合法で、 hogeをint型としてtypedefする
@@ -1053,7 +1173,7 @@ static Type *basetype(StorageClass *sclass) {
         // fprintf(stderr, "found typedef: %s\n", my_strndup(tk->str, tk->len));
         // fprintf(stderr, "found is_incomplete: %d\n", ty->is_incomplete);
         assert(ty);
-        token = token->next;
+        token = next_token(token);
       }
 
       // ビルトイン以外の型を読んだのでカウンターを上げる
@@ -1113,13 +1233,14 @@ static Type *basetype(StorageClass *sclass) {
  * とくに、placeholderの部分などは、この説の説明を見ないと難しい。
  */
 static Type *declarator(Type *ty, char **name) {
-  while (consume("*")) {
+  while (consume(PK_MUL)) {
     ty = pointer_to(ty);
   }
-  if (consume("(")) {
-    Type *placeholder = calloc(1, sizeof(Type));
+  if (consume(PK_LPAREN)) {
+    Type *placeholder = arena_alloc(ARENA_TYPE, sizeof(Type));
+    mem_count(MEM_TYPE, sizeof(Type));
     Type *new_ty = declarator(placeholder, name);
-    expect(")");
+    expect(PK_RPAREN);
     // 入れ子部分を全部パースした後に、その後に続く配列の [] などを含めた(type_suffix)型としてplaceholderを完成させる
     memcpy(placeholder, type_suffix(ty), sizeof(Type));
     return new_ty;
@@ -1131,13 +1252,14 @@ static Type *declarator(Type *ty, char **name) {
 
 // declarator の識別子が無い版
 static Type *abstract_declarator(Type *ty) {
-  while (consume("*")) {
+  while (consume(PK_MUL)) {
     ty = pointer_to(ty);
   }
-  if (consume("(")) {
-    Type *placeholder = calloc(1, sizeof(Type));
+  if (consume(PK_LPAREN)) {
+    Type *placeholder = arena_alloc(ARENA_TYPE, sizeof(Type));
+    mem_count(MEM_TYPE, sizeof(Type));
     Type *new_ty = abstract_declarator(placeholder);
-    expect(")");
+    expect(PK_RPAREN);
     // 入れ子部分を全部パースした後に、その後に続く配列の [] などを含めた(type_suffix)型としてplaceholderを完成させる
     memcpy(placeholder, type_suffix(ty), sizeof(Type));
     return new_ty;
@@ -1160,9 +1282,9 @@ static Member *struct_member() {
   if (type->is_incomplete) {
     error_at(tk->str, "incomplete element type(struct_member)");
   }
-  expect(";");
+  expect(PK_SEMICOLON);
 
-  Member *m = calloc(1, sizeof(Member));
+  Member *m = arena_alloc(ARENA_TYPE, sizeof(Member));
   m->name = ident;
   m->ty = type;
 
@@ -1184,7 +1306,7 @@ static Type *struct_decl() {
   // }
   // みたいなことができるので、 struct hoge; のような場合はタグ名だけ登録する
   if (tk) {
-    if (!peek_token("{")) {
+    if (!peek_token(PK_LBRACE)) {
       TagScope *sc = find_tag(tk);
       if (!sc) {
         // 無かったらこのタグ名で登録する
@@ -1203,7 +1325,7 @@ static Type *struct_decl() {
   // ここに来た場合 構造体の宣言の struct _ で(もしタグがあればそれの後) _ をこれから読もうとしている
   // chibiccを見ると struct *foo というのもcの文法としてはOKで、「不完全な無名構造体へのポインタ」という変数を定義したことになるらしい。
   // なので、 「struct」 まででその「不完全な無名構造体」とみなしてその型を返すらしい。
-  if (!consume("{")) {
+  if (!consume(PK_LBRACE)) {
     return struct_type();
   }
 
@@ -1214,7 +1336,7 @@ static Type *struct_decl() {
     sc = find_tag(tk);
   }
 
-  if (sc && sc->depth == scope_depth) {
+  if (sc && sc->entry.depth == scope_depth) {
     if (sc->ty->kind != TY_STRUCT) {
       error_at(tk->str, "%s は構造体ではありません", my_strndup(tk->str, tk->len));
     }
@@ -1237,7 +1359,7 @@ static Type *struct_decl() {
   Member head = {};
   Member *cur = &head;
 
-  while (!consume("}")) {
+  while (!consume(PK_RBRACE)) {
     cur->next = struct_member();
     cur = cur->next;
   }
@@ -1283,7 +1405,7 @@ static Type *enum_decl() {
   Token *tag_tk = consume_ident();
 
   if (tag_tk) {
-    if (!peek_token("{")) {
+    if (!peek_token(PK_LBRACE)) {
       // 構造体と同じくenum tagの次に"{"がない定義済みenum型の変数宣言になるので、tag名で探す
       TagScope *sc = find_tag(tag_tk);
       if (!sc) {
@@ -1296,12 +1418,12 @@ static Type *enum_decl() {
     }
   }
   // ここに来た場合は新規のenumの定義
-  expect("{");
+  expect(PK_LBRACE);
   Type *ty = enum_type();
   int enum_value = 0;
   for (;;) {
     char *ident = expect_ident();
-    if (consume("=")) {
+    if (consume(PK_ASSIGN)) {
       enum_value = const_expr();
     }
     push_enum_scope(ident, ty, enum_value++);
@@ -1309,7 +1431,7 @@ static Type *enum_decl() {
     if (consume_end()) {
       break;
     }
-    expect(",");
+    expect(PK_COMMA);
   }
 
   if (tag_tk) {
@@ -1321,12 +1443,12 @@ static Type *enum_decl() {
 }
 
 static void function_params(Function *func) {
-  if (consume(")")) {
+  if (consume(PK_RPAREN)) {
     return;
   }
 
   Token *tmp = token;
-  if (consume_kind(TK_VOID) && consume(")")) {
+  if (consume_kind(TK_VOID) && consume(PK_RPAREN)) {
     return;
   }
   token = tmp;
@@ -1339,15 +1461,15 @@ static void function_params(Function *func) {
     type = pointer_to(type->ptr_to);
   }
   Var *var = new_lvar(name, type);
-  VarList *var_list = calloc(1, sizeof(VarList));
+  VarList *var_list = arena_alloc(ARENA_AST, sizeof(VarList));
   var_list->var = var;
   // fprintf(stderr, "parse func param start\n");
-  while (!consume(")")) {
-    expect(",");
-    if (consume("...")) {
+  while (!consume(PK_RPAREN)) {
+    expect(PK_COMMA);
+    if (consume(PK_ELLIPSIS)) {
       func->has_vararg = true;
       // ... は引数の最後であること
-      expect(")");
+      expect(PK_RPAREN);
       break;
     }
     type = basetype(NULL);
@@ -1358,7 +1480,7 @@ static void function_params(Function *func) {
       type = pointer_to(type->ptr_to);
     }
     Var *var = new_lvar(name, type);
-    VarList *v = calloc(1, sizeof(VarList));
+    VarList *v = arena_alloc(ARENA_AST, sizeof(VarList));
     v->var = var;
     v->next = var_list;
     var_list = v;
@@ -1384,43 +1506,52 @@ static void set_stack_info(Function *f) {
 static Function *function_def_or_decl() {
   // 今からパースする関数ようにグローバルのlocalsを初期化
   locals = NULL;
+  char *src = token->str;
 
   StorageClass sclass;
   Type *ret_type = basetype(&sclass);
   char *ident;
   ret_type = declarator(ret_type, &ident);
-  Function *func = calloc(1, sizeof(Function));
+  Function *func = arena_alloc(ARENA_AST, sizeof(Function));
   func->return_type = ret_type;
   func->name = ident;
+  func->src = src;
   // 関数呼び出し時のチェック用に定義した関数も関数型としてscopeに入れる
   // is_staticに関して、関数は関数自体で別途is_staticを持っていて、そちらで .global の出力有無を制御しているので、このgvarのis_statciは何でもよい
   new_gvar(func->name, func_type(func->return_type), false, false);
 
   Scope *sc = enter_scope();
-  expect("(");
+  expect(PK_LPAREN);
   function_params(func);
 
   // ")" の後に ; が来てたら関数の定義なしで宣言のみ
-  if (consume(";")) {
+  if (consume(PK_SEMICOLON)) {
     leave_scope(sc);
     return NULL;
   }
-  expect("{");
+  func->body_src = token->str;
+  expect(PK_LBRACE);
+  current_funcname = func->name;
+  func_label_index = 0;
 
   // 関数本体
   int i = 0;
   Node head = {};
   Node *cur = &head;
   // fprintf(stderr, "parse function body start\n");
-  while (!consume("}")) {
+  while (!consume(PK_RBRACE)) {
     cur->next = stmt();
     cur = cur->next;
+    // 文を1個読み終わったら、それより前のトークンに戻ることはないので捨てる
+    release_tokens_before(token);
   }
   // fprintf(stderr, "parse function body end\n");
   func->body = head.next;
   func->locals = locals;
   func->is_staitc = (sclass == STATIC);
+  func->src_end = token->str;
   set_stack_info(func);
+  current_funcname = NULL;
 
   leave_scope(sc);
   return func;
@@ -1437,20 +1568,20 @@ static Node *stmt() {
   Token *tk;
   Node *node = NULL;
 
-  if (tk = consume(";")) {
+  if (tk = consume(PK_SEMICOLON)) {
     node = new_node(ND_NULL, tk);
   } else if (tk = consume_kind(TK_RETURN)) {
     node = new_node(ND_RETURN, tk);
-    if (!consume(";")) {
+    if (!consume(PK_SEMICOLON)) {
       node->lhs = expr();
-      expect(";");
+      expect(PK_SEMICOLON);
     }
   } else if (tk = consume_kind(TK_IF)) {
     node = new_node(ND_IF, tk);
 
-    expect("(");
+    expect(PK_LPAREN);
     node->cond = expr();
-    expect(")");
+    expect(PK_RPAREN);
     node->then = stmt();
 
     // elseがあればパース
@@ -1462,24 +1593,24 @@ static Node *stmt() {
   } else if (tk = consume_kind(TK_WHILE)) {
     node = new_node(ND_WHILE, tk);
 
-    expect("(");
+    expect(PK_LPAREN);
     node->cond = expr();
-    expect(")");
+    expect(PK_RPAREN);
     node->body = stmt();
   } else if (tk = consume_kind(TK_DO)) {
     node = new_node(ND_WHILE, tk);
     node->is_do_while = true;
     node->body = stmt();
     expect_kind(TK_WHILE);
-    expect("(");
+    expect(PK_LPAREN);
     node->cond = expr();
-    expect(")");
-    expect(";");
+    expect(PK_RPAREN);
+    expect(PK_SEMICOLON);
   } else if (tk = consume_kind(TK_FOR)) {
     node = new_node(ND_FOR, tk);
     Scope *sc = enter_scope();
-    expect("(");
-    if (consume(";")) {
+    expect(PK_LPAREN);
+    if (consume(PK_SEMICOLON)) {
       //次が";"なら初期化式なしなのでNULL入れる
       node->init = NULL;
     } else {
@@ -1488,54 +1619,55 @@ static Node *stmt() {
         node->init = var_decl();
       } else {
         node->init = read_expr_stmt();
-        expect(";");
+        expect(PK_SEMICOLON);
       }
     }
-    if (consume(";")) {
+    if (consume(PK_SEMICOLON)) {
       //次が";"なら条件式なしなのでNULL入れる
       node->cond = NULL;
     } else {
       // ";"でないなら条件式があるのでパース
       node->cond = expr();
-      expect(";");
+      expect(PK_SEMICOLON);
     }
-    if (consume(")")) {
+    if (consume(PK_RPAREN)) {
       //次が")"なら継続式なしなのでNULL入れる
       node->inc = NULL;
     } else {
       // ")"でないなら継続式があるのでパース
       node->inc = read_expr_stmt();
-      expect(")");
+      expect(PK_RPAREN);
     }
     node->body = stmt();
     leave_scope(sc);
-  } else if (tk = consume("{")) {
+  } else if (tk = consume(PK_LBRACE)) {
     node = new_node(ND_BLOCK, tk);
     Scope *sc = enter_scope();
     int i = 0;
     Node head = {};
     Node *cur = &head;
-    while (!consume("}")) {
+    while (!consume(PK_RBRACE)) {
       cur->next = stmt();
       cur = cur->next;
+      release_tokens_before(token);
     }
     node->body = head.next;
     leave_scope(sc);
   } else if (tk = consume_kind(TK_BREAK)) {
-    expect(";");
+    expect(PK_SEMICOLON);
     node = new_node(ND_BREAK, tk);
   } else if (tk = consume_kind(TK_CONTINUE)) {
-    expect(";");
+    expect(PK_SEMICOLON);
     node = new_node(ND_CONTINUE, tk);
   } else if (tk = consume_kind(TK_GOTO)) {
     char *ident = expect_ident();
-    expect(";");
+    expect(PK_SEMICOLON);
     node = new_node(ND_GOTO, tk);
     node->label_name = ident;
   } else if (tk = consume_kind(TK_SWITCH)) {
-    expect("(");
+    expect(PK_LPAREN);
     Node *switch_condition = expr();
-    expect(")");
+    expect(PK_RPAREN);
     node = new_unary_node(ND_SWITCH, switch_condition, tk);
 
     // 今のswitchを保存して現在のswitchに切り替える
@@ -1549,8 +1681,10 @@ static Node *stmt() {
       error(tk->str, "対応するswitchがありません");
     }
     int case_cond_val = const_expr();
-    expect(":");
-    node = new_unary_node(ND_CASE, stmt(), tk);
+    expect(PK_COLON);
+    // 後ろの文をパースするとトークンを使い回すので、先にノードを作る
+    node = new_unary_node(ND_CASE, NULL, tk);
+    node->lhs = stmt();
     node->case_cond_val = case_cond_val;
     node->is_default_case = false;
     node->case_next = current_switch->case_next;
@@ -1559,17 +1693,19 @@ static Node *stmt() {
     if (!current_switch) {
       error(tk->str, "対応するswitchがありません");
     }
-    expect(":");
-    node = new_unary_node(ND_CASE, stmt(), tk);
+    expect(PK_COLON);
+    node = new_unary_node(ND_CASE, NULL, tk);
+    node->lhs = stmt();
     node->is_default_case = true;
     current_switch->default_case = node;
   } else {
     Token *tmp = token;
     Token *tk = consume_ident();
-    if (consume(":")) {
+    if (consume(PK_COLON)) {
       // identの次に":" が来てたらラベル
-      node = new_unary_node(ND_LABEL, stmt(), tk);
-      node->label_name = my_strndup(tk->str, tk->len);
+      node = new_unary_node(ND_LABEL, NULL, tk);
+      node->label_name = tk->ident;
+      node->lhs = stmt();
     } else {
       // ラベルじゃなかったので、もとに戻す
       token = tmp;
@@ -1578,7 +1714,7 @@ static Node *stmt() {
       if (!node) {
         // 変数宣言でなかったら式文
         node = read_expr_stmt();
-        expect(";");
+        expect(PK_SEMICOLON);
       }
     }
   }
@@ -1590,17 +1726,17 @@ static Node *stmt() {
 // int *x[n]
 // のxの直後の[n]をパースする
 static Type *type_suffix(Type *base) {
-  if (!consume("[")) {
+  if (!consume(PK_LBRACKET)) {
     return base;
   }
 
   int array_size = 0;
   int is_incomplete = true;
-  if (!consume("]")) {
+  if (!consume(PK_RBRACKET)) {
     //[の直後に"]"が来ていない場合、配列のサイズがあるはずなので、完全な方としてis_incompleteをfalseに
     is_incomplete = false;
     array_size = const_expr();
-    expect("]");
+    expect(PK_RBRACKET);
   }
 
   Token *tk = token;
@@ -1678,10 +1814,11 @@ static Node *new_desg_node_sub(Var *var, Designator *desg, Token *tk) {
   return node;
 }
 
-static Node *new_desg_node(Var *var, Designator *desg, Node *rhs) {
-  Node *lhs = new_desg_node_sub(var, desg, rhs->tok);
-  Node *assign = new_bin_node(ND_ASSIGN, lhs, rhs, rhs->tok);
-  return new_unary_node(ND_EXPR_STMT, assign, rhs->tok);
+// tk は rhs の先頭のトークン
+static Node *new_desg_node(Var *var, Designator *desg, Node *rhs, Token *tk) {
+  Node *lhs = new_desg_node_sub(var, desg, tk);
+  Node *assign = new_bin_node(ND_ASSIGN, lhs, rhs, tk);
+  return new_unary_node(ND_EXPR_STMT, assign, tk);
 }
 
 static Node *lvar_init_zero(Node *cur, Var *var, Type *ty, Designator *dseg) {
@@ -1694,7 +1831,7 @@ static Node *lvar_init_zero(Node *cur, Var *var, Type *ty, Designator *dseg) {
     return cur;
   }
   // 配列でない場合は、単純にその変数(入れ子の配列の場合はどこかの末端の要素)に0を代入するコードをnextにつなげていく
-  cur->next = new_desg_node(var, dseg, new_num_node(0, token));
+  cur->next = new_desg_node(var, dseg, new_num_node(0, token), token);
   return cur->next;
 }
 
@@ -1720,7 +1857,7 @@ static Node *local_var_initializer_sub(Node *cur, Var *var, Type *ty, Designator
     int len = ty->array_size > str->content_length ? str->content_length : ty->array_size;
     for (int i = 0; i < len; i++) {
       Designator desg2 = {desg, i};
-      cur->next = new_desg_node(var, &desg2, new_num_node(str->contents[i], str));
+      cur->next = new_desg_node(var, &desg2, new_num_node(str->contents[i], str), str);
       cur = cur->next;
     }
 
@@ -1740,14 +1877,14 @@ static Node *local_var_initializer_sub(Node *cur, Var *var, Type *ty, Designator
   // static int count = 0;
   // fprintf(stdout, "count: %d, type: %d\n", count++, ty->kind);
   if (ty->kind == TY_ARRAY) {
-    bool has_open_brace = consume("{");
+    bool has_open_brace = consume(PK_LBRACE);
     int i = 0;
 
-    if (!peek_token("}")) {
+    if (!peek_token(PK_RBRACE)) {
       do {
         Designator desg2 = {desg, i++};
         cur = local_var_initializer_sub(cur, var, ty->ptr_to, &desg2);
-      } while(!is_array_limit_over(ty, i) && !peek_end() && consume(","));
+      } while(!is_array_limit_over(ty, i) && !peek_end() && consume(PK_COMMA));
     }
 
     if (has_open_brace && !consume_end()) {
@@ -1770,16 +1907,16 @@ static Node *local_var_initializer_sub(Node *cur, Var *var, Type *ty, Designator
   }
 
   if (ty->kind == TY_STRUCT) {
-    bool has_open_brace = consume("{");
+    bool has_open_brace = consume(PK_LBRACE);
     Member *mem = ty->members;
 
-    if (!peek_token("}")) {
+    if (!peek_token(PK_RBRACE)) {
       do {
         assert(mem);
         Designator desg2 = {desg, 0, mem};
         cur = local_var_initializer_sub(cur, var, mem->ty, &desg2);
         mem = mem->next;
-      } while(mem && !peek_end() && consume(","));
+      } while(mem && !peek_end() && consume(PK_COMMA));
     }
 
     if (has_open_brace && !consume_end()) {
@@ -1798,10 +1935,11 @@ static Node *local_var_initializer_sub(Node *cur, Var *var, Type *ty, Designator
 
   // compound-literal で "{" 初期化式 "}" で初期化する場合に "{" が存在する
   // (int) { 1 } とか
-  bool has_open_brace = consume("{");
+  bool has_open_brace = consume(PK_LBRACE);
+  Token *tk = token;
   Node *e = assign();
   // fprintf(stdout, "val: %d\n", e->val);
-  cur->next = new_desg_node(var, desg, e);
+  cur->next = new_desg_node(var, desg, e, tk);
   if (has_open_brace) {
     expect_end();
   }
@@ -1823,7 +1961,7 @@ static Node *var_decl() {
   if (is_type(token)) {
     StorageClass sclass = false;
     Type *type = basetype(&sclass);
-    if (tk = consume(";")) {
+    if (tk = consume(PK_SEMICOLON)) {
       // basetypeの直後に;が来ていたらenumやstructの型の定義だけする場合
       // また、試したところ int; という意味ない文もエラーにはならないので、
       // 特に構造体やenumに限定せず任意のbasetypeの直後の ";" もいけそう。
@@ -1835,7 +1973,7 @@ static Node *var_decl() {
     type = declarator(type, &ident_name);
 
     if (sclass == TYPEDEF) {
-      expect(";");
+      expect(PK_SEMICOLON);
       push_typedef_scope(ident_name, type);
       return new_node(ND_NULL, tk);
     }
@@ -1851,7 +1989,7 @@ static Node *var_decl() {
       // 別途スコープにident_nameでこの変数を登録
       push_var_scope(ident_name, var);
 
-      if (!consume("=")) {
+      if (!consume(PK_ASSIGN)) {
         if (type->is_incomplete) {
           error_at(tk->str, "incomplete element type(gvar)");
         }
@@ -1861,7 +1999,7 @@ static Node *var_decl() {
 
       // カンマ区切りの別の宣言もあればパース
       static_var_decl_sub(basic_type, sclass);
-      expect(";");
+      expect(PK_SEMICOLON);
       return new_node(ND_NULL, tk);
     }
 
@@ -1874,7 +2012,7 @@ static Node *var_decl() {
     }
 
     // 初期化式があるかどうかチェック
-    if (consume("=")) {
+    if (consume(PK_ASSIGN)) {
       // 今作ったlocal変数に初期化式の値を代入するノードを設定
       node->initializer = local_var_initializer(var, tk);
     }
@@ -1885,7 +2023,7 @@ static Node *var_decl() {
 
     // カンマ区切りの別の宣言もあればパース
     node = var_decl_sub(basic_type, node);
-    expect(";");
+    expect(PK_SEMICOLON);
 
     return node;
   }
@@ -1893,14 +2031,14 @@ static Node *var_decl() {
 }
 
 static void static_var_decl_sub(Type *base, StorageClass sclass) {
-  while (consume(",")) {
+  while (consume(PK_COMMA)) {
     Token *tmp_tk = token;
     char *ident_name;
     Type *type = declarator(base, &ident_name);
     Var *var = new_gvar(new_label(), type, true, sclass == STATIC);
     push_var_scope(ident_name, var);
 
-    if (!consume("=")) {
+    if (!consume(PK_ASSIGN)) {
       if (type->is_incomplete) {
         error_at(tmp_tk->str, "incomplete element type(gvar)");
       }
@@ -1911,7 +2049,7 @@ static void static_var_decl_sub(Type *base, StorageClass sclass) {
 }
 
 static Node *var_decl_sub(Type *base, Node *decl) {
-  while (consume(",")) {
+  while (consume(PK_COMMA)) {
     Token *tk = token;
     char *ident_name;
     Type *type = declarator(base, &ident_name);
@@ -1925,9 +2063,10 @@ static Node *var_decl_sub(Type *base, Node *decl) {
     }
 
     // 初期化式があるかどうかチェック
-    if (tk = consume("=")) {
+    Token *assign_tk = consume(PK_ASSIGN);
+    if (assign_tk) {
       // 今作ったlocal変数に初期化式の値を代入するノードを設定
-      node->initializer = local_var_initializer(var, tk);
+      node->initializer = local_var_initializer(var, assign_tk);
     }
 
     if (type->is_incomplete) {
@@ -1941,13 +2080,16 @@ static Node *var_decl_sub(Type *base, Node *decl) {
 
 static Node *expr() {
   Token *tk;
+  // node の先頭のトークン
+  Token *start = token;
   Node *node = assign();
 
-  while (tk = consume(",")) {
+  while (tk = consume(PK_COMMA)) {
     // カンマがある場合、最後の式の値だけスタックに積みたいので、
     // カンマより左にある式の結果は全部式文(ND_EXPR_STMT)にして計算だけして結果は捨てる
-    node = new_unary_node(ND_EXPR_STMT, node, node->tok);
+    node = new_unary_node(ND_EXPR_STMT, node, start);
     node = new_bin_node(ND_COMMA, node, assign(), tk);
+    start = tk;
   }
 
   return node;
@@ -1962,33 +2104,33 @@ static Node *assign() {
   // 難しかったので、簡単そうな i += x を構文木上 i = i + x に読み替える方式にしてみる。
   // ただそのせいで、左辺のnodeが複数のnodeで共有されてしまってfree_nodesのときに複数回freeしてしまってエラーになったので、
   // chibccに合わせて今回からastのfreeはやめる
-  if (tk = consume("=")) {
+  if (tk = consume(PK_ASSIGN)) {
     return new_bin_node(ND_ASSIGN, node, assign(), tk);
-  } else if (tk = consume("+=")) {
+  } else if (tk = consume(PK_ADD_ASSIGN)) {
     Node *n = new_add_node(node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("-=")) {
+  } else if (tk = consume(PK_SUB_ASSIGN)) {
     Node *n = new_sub_node(node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("*=")) {
+  } else if (tk = consume(PK_MUL_ASSIGN)) {
     Node *n = new_bin_node(ND_MUL, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("/=")) {
+  } else if (tk = consume(PK_DIV_ASSIGN)) {
     Node *n = new_bin_node(ND_DIV, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("<<=")) {
+  } else if (tk = consume(PK_SHL_ASSIGN)) {
     Node *n = new_bin_node(ND_A_LSHIFT, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume(">>=")) {
+  } else if (tk = consume(PK_SHR_ASSIGN)) {
     Node *n = new_bin_node(ND_A_RSHIFT, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("|=")) {
+  } else if (tk = consume(PK_OR_ASSIGN)) {
     Node *n = new_bin_node(ND_BIT_OR, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("&=")) {
+  } else if (tk = consume(PK_AND_ASSIGN)) {
     Node *n = new_bin_node(ND_BIT_AND, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
-  } else if (tk = consume("^=")) {
+  } else if (tk = consume(PK_XOR_ASSIGN)) {
     Node *n = new_bin_node(ND_BIT_XOR, node, assign(), tk);
     return new_bin_node(ND_ASSIGN, node, n, tk);
   }
@@ -1998,9 +2140,9 @@ static Node *assign() {
 static Node *ternary() {
   Token *tk;
   Node *node = logical_or();
-  if (tk = consume("?")) {
+  if (tk = consume(PK_QUESTION)) {
     Node *true_expr = expr();
-    expect(":");
+    expect(PK_COLON);
     Node *false_expr = ternary();
 
     // ifと同じ構造で式になるのでthen, elsにstmtじゃなくてexprいれたら動いたので取り敢えずこれで
@@ -2105,7 +2247,7 @@ static Node *logical_or() {
   Token *tk;
   Node *node = logical_and();
 
-  while (tk = consume("||")) {
+  while (tk = consume(PK_LOGICAL_OR)) {
     node = new_bin_node(ND_OR, node, logical_and(), tk);
   }
 
@@ -2116,7 +2258,7 @@ static Node *logical_and() {
   Token *tk;
   Node *node = bit_or();
 
-  while (tk = consume("&&")) {
+  while (tk = consume(PK_LOGICAL_AND)) {
     node = new_bin_node(ND_AND, node, bit_or(), tk);
   }
 
@@ -2127,7 +2269,7 @@ static Node *bit_or() {
   Token *tk;
   Node *node = bit_xor();
 
-  while (tk = consume("|")) {
+  while (tk = consume(PK_BIT_OR)) {
     node = new_bin_node(ND_BIT_OR, node, bit_xor(), tk);
   }
 
@@ -2138,7 +2280,7 @@ static Node *bit_xor() {
   Token *tk;
   Node *node = bit_and();
 
-  while (tk = consume("^")) {
+  while (tk = consume(PK_BIT_XOR)) {
     node = new_bin_node(ND_BIT_XOR, node, bit_and(), tk);
   }
 
@@ -2149,7 +2291,7 @@ static Node *bit_and() {
   Token *tk;
   Node *node = equality();
 
-  while (tk = consume("&")) {
+  while (tk = consume(PK_BIT_AND)) {
     node = new_bin_node(ND_BIT_AND, node, equality(), tk);
   }
 
@@ -2161,9 +2303,9 @@ static Node *equality() {
   Node *node = relational();
 
   for (;;) {
-    if (tk = consume("==")) {
+    if (tk = consume(PK_EQ)) {
       node = new_bin_node(ND_EQL, node, relational(), tk);
-    } else if (tk = consume("!=")) {
+    } else if (tk = consume(PK_NE)) {
       node = new_bin_node(ND_NOT_EQL, node, relational(), tk);
     } else {
       return node;
@@ -2176,13 +2318,13 @@ static Node *relational() {
   Node *node = shift();
 
   for (;;) {
-    if (tk = consume("<=")) {
+    if (tk = consume(PK_LE)) {
       node = new_bin_node(ND_LTE, node, shift(), tk);
-    } else if (tk = consume(">=")) {
+    } else if (tk = consume(PK_GE)) {
       node = new_bin_node(ND_LTE, shift(), node, tk);
-    } else if (tk = consume("<")) {
+    } else if (tk = consume(PK_LT)) {
       node = new_bin_node(ND_LT, node, shift(), tk);
-    } else if (tk = consume(">")) {
+    } else if (tk = consume(PK_GT)) {
       node = new_bin_node(ND_LT, shift(), node, tk);
     } else {
       return node;
@@ -2194,9 +2336,9 @@ static Node *shift() {
   Token *tk;
   Node *node = add();
   for (;;) {
-    if (tk = consume("<<")) {
+    if (tk = consume(PK_SHL)) {
       node = new_bin_node(ND_A_LSHIFT, node, add(), tk);
-    } else if (tk = consume(">>")) {
+    } else if (tk = consume(PK_SHR)) {
       node = new_bin_node(ND_A_RSHIFT, node, add(), tk);
     } else {
       return node;
@@ -2256,9 +2398,9 @@ static Node *add() {
   Node *node = mul();
 
   for (;;) {
-    if (tk = consume("+")) {
+    if (tk = consume(PK_ADD)) {
       node = new_add_node(node, mul(), tk);
-    } else if (tk = consume("-")) {
+    } else if (tk = consume(PK_SUB)) {
       node = new_sub_node(node, mul(), tk);
     } else {
       return node;
@@ -2271,11 +2413,11 @@ static Node *mul() {
   Node *node = cast();
 
   for (;;) {
-    if (tk = consume("*")) {
+    if (tk = consume(PK_MUL)) {
       node = new_bin_node(ND_MUL, node, cast(), tk);
-    } else if (tk = consume("/")) {
+    } else if (tk = consume(PK_DIV)) {
       node = new_bin_node(ND_DIV, node, cast(), tk);
-    } else if (tk = consume("%")) {
+    } else if (tk = consume(PK_MOD)) {
       node = new_bin_node(ND_MOD, node, cast(), tk);
     } else {
       return node;
@@ -2285,11 +2427,11 @@ static Node *mul() {
 
 static Node *cast() {
   Token *tk = token;
-  if (consume("(")) {
+  if (consume(PK_LPAREN)) {
     if (is_type(token)) {
       Type *ty = type_name();
-      expect(")");
-      if (!consume("{")) {
+      expect(PK_RPAREN);
+      if (!consume(PK_LBRACE)) {
         // "{" が来た場合は、キャストではなくcompound-literaruの"(" typename ")" になるので、
         // この節はスキップして、token=tmpでもとに戻した上で、postfix側で処理する
         Node *node = new_unary_node(ND_CAST, cast(), tk);
@@ -2308,30 +2450,30 @@ static Node *cast() {
 
 static Node *unary() {
   Token *tk;
-  if (consume("+")) {
+  if (consume(PK_ADD)) {
     return cast();
-  } else if (tk = consume("-")) {
+  } else if (tk = consume(PK_SUB)) {
     return new_bin_node(ND_SUB, new_num_node(0, tk), cast(), tk);
-  } else if (tk = consume("&")) {
+  } else if (tk = consume(PK_BIT_AND)) {
     return new_unary_node(ND_ADDR, cast(), tk);
-  } else if (tk = consume("*")) {
+  } else if (tk = consume(PK_MUL)) {
     return new_unary_node(ND_DEREF, cast(), tk);
-  } else if (tk = consume("++")) {
+  } else if (tk = consume(PK_INC)) {
     return new_unary_node(ND_PRE_INC, cast(), tk);
-  } else if (tk = consume("--")) {
+  } else if (tk = consume(PK_DEC)) {
     return new_unary_node(ND_PRE_DEC, cast(), tk);
-  } else if (tk = consume("!")) {
+  } else if (tk = consume(PK_NOT)) {
     return new_unary_node(ND_NOT, cast(), tk);
-  } else if (tk = consume("~")) {
+  } else if (tk = consume(PK_BIT_NOT)) {
     return new_unary_node(ND_BIT_NOT, cast(), tk);
   } else if (tk = consume_kind(TK_ALIGNOF)) {
-    expect("(");
+    expect(PK_LPAREN);
     Type *ty = type_name();
-    expect(")");
+    expect(PK_RPAREN);
     return new_num_node(ty->align, tk);
   } else if (consume_kind(TK_SIZEOF)) {
     Token *tmp = token;
-    if (consume("(")) {
+    if (consume(PK_LPAREN)) {
       if (is_type(token)) {
         Token *tk = token;
         Type *ty = type_name();
@@ -2342,10 +2484,10 @@ static Node *unary() {
           error_at(tk->str, "incomplete element type(sizeof1)");
         }
 
-        expect(")");
+        expect(PK_RPAREN);
         return new_num_node(ty->size, tk);
       }
-      // 型名じゃなかったらまた再度 "(" からパースやり直すためにconsume("(")の直前まで戻す
+      // 型名じゃなかったらまた再度 "(" からパースやり直すためにconsume(PK_LPAREN)の直前まで戻す
       token = tmp;
     }
 
@@ -2384,7 +2526,7 @@ static Member *find_member(Type *type, char *name) {
   assert(type->kind == TY_STRUCT);
 
   for (Member *m = type->members; m ; m = m->next) {
-    if (strcmp(m->name, name) == 0) {
+    if (m->name == name) {
       return m;
     }
   }
@@ -2420,30 +2562,30 @@ static Node *postfix() {
 
   node = primary();
   for (;;) {
-    if (tk = consume("[")) {
+    if (tk = consume(PK_LBRACKET)) {
       node = new_bin_node(ND_DEREF, new_add_node(node, expr(), tk), NULL, tk);
-      expect("]");
+      expect(PK_RBRACKET);
       continue;
     }
 
-    if (consume(".")) {
+    if (consume(PK_DOT)) {
       node = struct_ref(node);
       continue;
     }
 
-    if (tk = consume("->")) {
+    if (tk = consume(PK_ARROW)) {
       // x->y == (*x).y なので nodeをderefしたうえで . と同じ結果を返す
       node = new_unary_node(ND_DEREF, node, tk);
       node = struct_ref(node);
       continue;
     }
 
-    if (tk = consume("++")) {
+    if (tk = consume(PK_INC)) {
       node = new_unary_node(ND_POST_INC, node, tk);
       continue;
     }
 
-    if (tk = consume("--")) {
+    if (tk = consume(PK_DEC)) {
       node = new_unary_node(ND_POST_DEC, node, tk);
       continue;
     }
@@ -2455,14 +2597,14 @@ static Node *postfix() {
 
 static Node *compound_literal() {
   Token *tmp = token;
-  if (!consume("(") || !is_type(token)) {
+  if (!consume(PK_LPAREN) || !is_type(token)) {
     token = tmp;
     return NULL;
   }
   Type *ty = type_name();
-  expect(")");
+  expect(PK_RPAREN);
 
-  if(!peek_token("{")) {
+  if(!peek_token(PK_LBRACE)) {
     token = tmp;
     return NULL;
   }
@@ -2485,7 +2627,7 @@ static Node *compound_literal() {
 
 static Node *parse_call_func(Token *t) {
   Node *node = new_node(ND_CALL, t);
-  node->funcname = my_strndup(t->str, t->len);
+  node->funcname = t->ident;
 
   VarScope *func_var_sc = find_var(t);
   if (func_var_sc) {
@@ -2496,7 +2638,7 @@ static Node *parse_call_func(Token *t) {
     }
     // 関数の戻り値の型をND_CALLの戻り値にする
     node->ty = func_var->type->return_ty;
-  } else if (!strcmp(node->funcname, "__builtin_va_start")) {
+  } else if (node->funcname == builtin_va_start_name) {
     // var_start 用の組込み関数かをチェック
     node->ty = void_type;
   } else {
@@ -2505,7 +2647,7 @@ static Node *parse_call_func(Token *t) {
     node->ty = int_type;
   }
 
-  if (consume(")")) {
+  if (consume(PK_RPAREN)) {
     // 閉じカッコがきたら引数なし関数
     add_type(node);
     return node;
@@ -2516,7 +2658,7 @@ static Node *parse_call_func(Token *t) {
   int args = 0;
   Node *cur = assign();
   args++;
-  while (consume(",")) {
+  while (consume(PK_COMMA)) {
     Node *arg = assign();
     arg->next = cur;
     cur = arg;
@@ -2529,7 +2671,7 @@ static Node *parse_call_func(Token *t) {
 
   node->funcarg_num = args;
 
-  expect(")");
+  expect(PK_RPAREN);
 
   add_type(node);
 
@@ -2539,8 +2681,15 @@ static Node *parse_call_func(Token *t) {
 static char *new_label() {
   static int label_index = 0;
   char buf[100];
-  int n = sprintf(buf, ".L.data.%03d", label_index++);
-  return my_strndup(buf, n);
+  int n;
+  if (current_funcname) {
+    // 関数の中の文字列リテラルやstaticなローカル変数は関数ごとに番号を振る
+    // (他の関数を変更してもこの関数のコードが変わらないように)
+    n = sprintf(buf, ".L.data.%s.%03d", current_funcname, func_label_index++);
+  } else {
+    n = sprintf(buf, ".L.data.%03d", label_index++);
+  }
+  return intern(buf, n);
 }
 
 static Node *parse_string_literal(Token *str_token) {
@@ -2552,15 +2701,15 @@ static Node *parse_string_literal(Token *str_token) {
 }
 
 static Node *primary() {
-  if (consume("(")) {
+  if (consume(PK_LPAREN)) {
     Node *node = expr();
-    expect(")");
+    expect(PK_RPAREN);
     return node;
   }
 
   Token *t = consume_ident();
   if (t) {
-    if (consume("(")) {
+    if (consume(PK_LPAREN)) {
       // identに続けて"("があったら関数呼び出し
       return parse_call_func(t);
     } else {
@@ -0,0 +1,209 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ynicc.h"
+#include <time.h>
+
+// 最適化パスの管理
+//
+// 各パスは -O のレベルで有効になるかが決まり、-f<パス名> / -fno-<パス名> で個別に有効/無効にできる。
+// --passes=a,b,... を指定した場合はレベルに関係なく、指定したパスだけを有効にする
+// (パスを1つずつ有効にしてテストし、どのパスで壊れたかを調べるのに使う)。
+// --verify-passes を指定すると、IRのパスを実行するたびにIRが正しいかを検査する。
+//
+// --time-report の時はパスごとの時間も表示する。パスはコード生成の中で実行するので、codegen の時間の内数になる。
+// (-j で関数のコード生成を並列にした場合は、各ワーカープロセスで実行したパスの時間を足すので、
+// 実時間の合計が codegen の実時間より長くなることもある)
+
+static char *pass_names[] = {
+  "fold",
+  "regvar",
+  "cse",
+  "dce",
+  "fuse",
+  "regalloc",
+};
+
+static char *pass_descriptions[] = {
+  "定数式を畳み込み、定数で初期化して代入のないローカル変数に定数を伝播する",
+  "IRを通らない関数で、よく使うローカル変数を callee-saved レジスタに置く",
+  "支配木をたどって、同じ計算をしている値を前の値で置き換える",
+  "使われない値を消す",
+  "比較と分岐、アドレスの加算とメモリの読み書きを1つの命令にする",
+  "SSAの値にレジスタを割り当てる(無効なら全部スタックに置く)",
+};
+
+// 有効になる最小の -O のレベル
+// -O1 以上ではIRで扱える関数は regalloc でレジスタに置くので、regvar が効くのはIRで扱えない関数(可変長引数など)だけ。
+// -O0 で regvar だけを試すには -fregvar を指定する
+static int pass_levels[] = {1, 1, 2, 1, 1, 1};
+
+// 1なら有効、-1なら無効、0ならレベルに従う
+static int pass_flags[PASS_NUM];
+
+bool verify_passes;
+
+static long pass_wall[PASS_NUM];
+static long pass_cpu[PASS_NUM];
+static int pass_calls[PASS_NUM];
+static long pass_start_wall;
+static long pass_start_cpu;
+
+static long clock_ns(int clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int find_pass(char *name, int len) {
+  for (int i = 0; i < PASS_NUM; i++) {
+    if ((int)strlen(pass_names[i]) == len && memcmp(pass_names[i], name, len) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool pass_enabled(PassId pass) {
+  if (pass_flags[pass]) {
+    return pass_flags[pass] > 0;
+  }
+  return opt_level >= pass_levels[pass];
+}
+
+// -f<パス名> / -fno-<パス名> を処理する(パス名でなければ false を返す)
+bool parse_pass_flag(char *arg) {
+  int flag = 1;
+  char *name = arg + 2;
+  if (strncmp(name, "no-", 3) == 0) {
+    flag = -1;
+    name = name + 3;
+  }
+  int pass = find_pass(name, strlen(name));
+  if (pass < 0) {
+    return false;
+  }
+  pass_flags[pass] = flag;
+  return true;
+}
+
+// カンマ区切りの names のパスだけを有効にする
+void enable_only_passes(char *names) {
+  for (int i = 0; i < PASS_NUM; i++) {
+    pass_flags[i] = -1;
+  }
+  char *p = names;
+  while (*p) {
+    char *q = p;
+    while (*q && *q != ',') {
+      q++;
+    }
+    int pass = find_pass(p, q - p);
+    if (pass < 0) {
+      error("不明なパスです: %s", names);
+    }
+    pass_flags[pass] = 1;
+    p = *q ? q + 1 : q;
+  }
+}
+
+// パスの一覧を表示する(1列目がパス名、2列目がデフォルトで有効になる -O のレベル)
+void print_passes(void) {
+  for (int i = 0; i < PASS_NUM; i++) {
+    printf("%-10s -O%d  %s\n", pass_names[i], pass_levels[i], pass_descriptions[i]);
+  }
+}
+
+void pass_begin(PassId pass) {
+  if (!time_report_enabled()) {
+    return;
+  }
+  pass_start_wall = clock_ns(CLOCK_MONOTONIC);
+  pass_start_cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+void pass_end(PassId pass) {
+  if (!time_report_enabled()) {
+    return;
+  }
+  pass_wall[pass] = pass_wall[pass] + clock_ns(CLOCK_MONOTONIC) - pass_start_wall;
+  pass_cpu[pass] = pass_cpu[pass] + clock_ns(CLOCK_PROCESS_CPUTIME_ID) - pass_start_cpu;
+  pass_calls[pass]++;
+}
+
+// 構文木を変形するパスを順に実行する(ASTからのコード生成でもIRを経由する場合でも、コード生成の前に実行する)
+void run_ast_passes(Function *func) {
+  if (pass_enabled(PASS_FOLD)) {
+    pass_begin(PASS_FOLD);
+    fold_function(func);
+    pass_end(PASS_FOLD);
+  }
+}
+
+// IRを変形するパスを順に実行する
+void run_ir_passes(IrFunc *fn) {
+  if (pass_enabled(PASS_CSE)) {
+    pass_begin(PASS_CSE);
+    ir_cse(fn);
+    pass_end(PASS_CSE);
+    if (verify_passes) {
+      ir_verify(fn);
+    }
+  }
+  if (pass_enabled(PASS_DCE)) {
+    pass_begin(PASS_DCE);
+    ir_dce(fn);
+    pass_end(PASS_DCE);
+    if (verify_passes) {
+      ir_verify(fn);
+    }
+  }
+}
+
+// パスの時間と回数を0にする(fork したワーカープロセスで、ワーカーで実行した分だけを数えるのに使う)
+void reset_pass_stats(void) {
+  for (int i = 0; i < PASS_NUM; i++) {
+    pass_wall[i] = 0;
+    pass_cpu[i] = 0;
+    pass_calls[i] = 0;
+  }
+}
+
+// パスの時間と回数を fp に書く(ワーカープロセスから親プロセスに渡す)
+void write_pass_stats(FILE *fp) {
+  fwrite(pass_wall, sizeof(long), PASS_NUM, fp);
+  fwrite(pass_cpu, sizeof(long), PASS_NUM, fp);
+  fwrite(pass_calls, sizeof(int), PASS_NUM, fp);
+}
+
+// ワーカープロセスが write_pass_stats で書いたパスの時間と回数を足す
+void add_pass_stats(FILE *fp) {
+  long wall[PASS_NUM];
+  long cpu[PASS_NUM];
+  int calls[PASS_NUM];
+  if (fread(wall, sizeof(long), PASS_NUM, fp) != PASS_NUM || fread(cpu, sizeof(long), PASS_NUM, fp) != PASS_NUM ||
+      fread(calls, sizeof(int), PASS_NUM, fp) != PASS_NUM) {
+    error("cannot read the pass report of a worker");
+  }
+  for (int i = 0; i < PASS_NUM; i++) {
+    pass_wall[i] = pass_wall[i] + wall[i];
+    pass_cpu[i] = pass_cpu[i] + cpu[i];
+    pass_calls[i] = pass_calls[i] + calls[i];
+  }
+}
+
+// ns をミリ秒(小数点以下3桁)で書く
+static void print_ms(long ns) {
+  long us = ns / 1000;
+  long ms = us / 1000;
+  fprintf(stderr, " %9ld.%03ld", ms, us - ms * 1000);
+}
+
+void print_pass_report(void) {
+  fprintf(stderr, "## pass report (-O%d)\n", opt_level);
+  fprintf(stderr, "## %-10s %13s %13s %10s %s\n", "pass", "wall(ms)", "cpu(ms)", "calls", "enabled");
+  for (int i = 0; i < PASS_NUM; i++) {
+    fprintf(stderr, "## %-10s", pass_names[i]);
+    print_ms(pass_wall[i]);
+    print_ms(pass_cpu[i]);
+    fprintf(stderr, " %10d %s\n", pass_calls[i], pass_enabled(i) ? "yes" : "no");
+  }
+}
@@ -0,0 +1,181 @@
+#define _POSIX_C_SOURCE 200809L
+#include "ynicc.h"
+#include <sys/resource.h>
+#include <time.h>
+
+// --time-report と --mem-report 用の計測
+//
+// 時間はフェーズごとに実時間とCPU時間を測る。フェーズは入れ子になる(program の中で add_type を呼ぶなど)ので、
+// 内側のフェーズに入っている間は外側のフェーズの時間を止めて、各フェーズの時間にはそのフェーズ自身の分だけを数える。
+// 一番外側のフェーズが終わるたびに、その時点までの最大RSSも記録する。
+// add_type は式を作るたびに呼ばれるので、時間を測るとその分の時計の読み取りのコストも add_type の時間に入る。
+//
+// メモリは構文解析などで作るオブジェクトの種類ごとに、作った個数とバイト数(累計)を数える。
+
+enum {
+  // フェーズの入れ子の深さの最大
+  PHASE_STACK_MAX = 16,
+};
+
+static char *phase_names[] = {
+  "read_file",
+  "tokenize",
+  "program",
+  "add_type",
+  "codegen",
+};
+
+static char *mem_names[] = {
+  "Token",
+  "Node",
+  "Type",
+  "Var",
+  "Initializer",
+};
+
+static bool time_enabled;
+
+static long phase_wall[PHASE_NUM];
+static long phase_cpu[PHASE_NUM];
+static int phase_calls[PHASE_NUM];
+// フェーズが終わった時点の最大RSS(KB)。入れ子のフェーズでしか呼ばれなかったものは0
+static long phase_peak_rss[PHASE_NUM];
+
+static Phase phase_stack[PHASE_STACK_MAX];
+static int phase_depth;
+// 今のフェーズの時間を最後に数えた時点
+static long mark_wall;
+static long mark_cpu;
+
+static long mem_objects[MEM_NUM];
+static long mem_bytes[MEM_NUM];
+
+static long clock_ns(int clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 前回数えた時点から今までの時間を今のフェーズに足す
+static void charge_current_phase(void) {
+  long wall = clock_ns(CLOCK_MONOTONIC);
+  long cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  if (phase_depth > 0) {
+    Phase p = phase_stack[phase_depth - 1];
+    phase_wall[p] = phase_wall[p] + wall - mark_wall;
+    phase_cpu[p] = phase_cpu[p] + cpu - mark_cpu;
+  }
+  mark_wall = wall;
+  mark_cpu = cpu;
+}
+
+void enable_time_report(void) {
+  time_enabled = true;
+}
+
+bool time_report_enabled(void) {
+  return time_enabled;
+}
+
+void phase_begin(Phase phase) {
+  if (!time_enabled) {
+    return;
+  }
+  if (phase_depth == PHASE_STACK_MAX) {
+    error("too deep phase nesting: %s", phase_names[phase]);
+  }
+  charge_current_phase();
+  phase_stack[phase_depth++] = phase;
+  phase_calls[phase]++;
+}
+
+void phase_end(Phase phase) {
+  if (!time_enabled) {
+    return;
+  }
+  if (phase_depth == 0 || phase_stack[phase_depth - 1] != phase) {
+    error("phase_end(%s) does not match phase_begin", phase_names[phase]);
+  }
+  charge_current_phase();
+  phase_depth--;
+
+  if (phase_depth == 0) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    phase_peak_rss[phase] = usage.ru_maxrss;
+  }
+}
+
+// ns をミリ秒(小数点以下3桁)で書く
+static void print_ms(long ns) {
+  long us = ns / 1000;
+  long ms = us / 1000;
+  fprintf(stderr, " %9ld.%03ld", ms, us - ms * 1000);
+}
+
+// fork したワーカープロセスが使ったCPU時間と最大RSSを fp に書く
+// (子プロセスのCPU時間は fork した時点から0で数え直されるので、ワーカーが使った分だけになる)
+void write_worker_usage(FILE *fp) {
+  long cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  long rss = usage.ru_maxrss;
+  fwrite(&cpu, sizeof(long), 1, fp);
+  fwrite(&rss, sizeof(long), 1, fp);
+}
+
+// ワーカープロセスが write_worker_usage で書いたCPU時間を phase の時間に足す(最大RSSは大きい方にする)
+void add_worker_usage(FILE *fp, Phase phase) {
+  long cpu;
+  long rss;
+  if (fread(&cpu, sizeof(long), 1, fp) != 1 || fread(&rss, sizeof(long), 1, fp) != 1) {
+    error("cannot read the time report of a worker");
+  }
+  phase_cpu[phase] = phase_cpu[phase] + cpu;
+  if (phase_peak_rss[phase] < rss) {
+    phase_peak_rss[phase] = rss;
+  }
+}
+
+void print_time_report(void) {
+  long total_wall = 0;
+  long total_cpu = 0;
+  fprintf(stderr, "## time report\n");
+  fprintf(stderr, "## %-10s %13s %13s %10s %14s\n", "phase", "wall(ms)", "cpu(ms)", "calls", "peak-rss(KB)");
+  for (int i = 0; i < PHASE_NUM; i++) {
+    fprintf(stderr, "## %-10s", phase_names[i]);
+    print_ms(phase_wall[i]);
+    print_ms(phase_cpu[i]);
+    fprintf(stderr, " %10d", phase_calls[i]);
+    if (phase_peak_rss[i]) {
+      fprintf(stderr, " %14ld\n", phase_peak_rss[i]);
+    } else {
+      fprintf(stderr, " %14s\n", "-");
+    }
+    total_wall = total_wall + phase_wall[i];
+    total_cpu = total_cpu + phase_cpu[i];
+  }
+  fprintf(stderr, "## %-10s", "total");
+  print_ms(total_wall);
+  print_ms(total_cpu);
+  fprintf(stderr, "\n");
+}
+
+// kind のオブジェクトを size バイト作ったことを記録する
+void mem_count(MemKind kind, long size) {
+  mem_objects[kind]++;
+  mem_bytes[kind] = mem_bytes[kind] + size;
+}
+
+void print_mem_report(void) {
+  long total_objects = 0;
+  long total_bytes = 0;
+  fprintf(stderr, "## mem report\n");
+  fprintf(stderr, "## %-12s %10s %12s\n", "object", "count", "bytes");
+  for (int i = 0; i < MEM_NUM; i++) {
+    fprintf(stderr, "## %-12s %10ld %12ld\n", mem_names[i], mem_objects[i], mem_bytes[i]);
+    total_objects = total_objects + mem_objects[i];
+    total_bytes = total_bytes + mem_bytes[i];
+  }
+  fprintf(stderr, "## %-12s %10ld %12ld\n", "total", total_objects, total_bytes);
+}
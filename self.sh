@@ -12,6 +12,7 @@ expand() {
 typedef struct FILE FILE;
 extern FILE *stdout;
 extern FILE *stderr;
+extern FILE *stdin;
 
 int isdigit(int c);
 int ispunct(int c);
@@ -28,17 +29,60 @@ char *strerror(int errnum);
 FILE *fopen(char *pathname, char *mode);
 long fread(void *ptr, long size, long nmemb, FILE *stream);
 int feof(FILE *stream);
+int fflush(FILE *stream);
+int fileno(FILE *stream);
+long write(int fd, void *buf, long n);
+long read(int fd, void *buf, long n);
+long fwrite(void *ptr, long size, long nmemb, FILE *stream);
+FILE *tmpfile(void);
+int fork(void);
+int waitpid(int pid, int *status, int options);
+void _exit(int status);
+struct timespec {
+  long tv_sec;
+  long tv_nsec;
+};
+int clock_gettime(int clockid, struct timespec *tp);
+struct sockaddr_un {
+  short sun_family;
+  char sun_path[108];
+};
+int socket(int domain, int type, int protocol);
+int bind(int sockfd, void *addr, int addrlen);
+int listen(int sockfd, int backlog);
+int accept(int sockfd, void *addr, void *addrlen);
+int connect(int sockfd, void *addr, int addrlen);
+int close(int fd);
+int unlink(char *path);
+int dup2(int oldfd, int newfd);
+char *realpath(char *path, char *resolved_path);
+void *memset(void *s, int c, long n);
+int fputc(int c, FILE *stream);
+int mkdir(char *path, int mode);
+int rename(char *oldpath, char *newpath);
+int getpid(void);
+struct rusage {
+  long ru_utime[2];
+  long ru_stime[2];
+  long ru_maxrss;
+  long ru_rest[13];
+};
+int getrusage(int who, struct rusage *usage);
+long lseek(int fd, long offset, int whence);
+void *mmap(void *addr, long length, int prot, int flags, int fd, long offset);
+long sysconf(int name);
 static void assert() {}
 int strcmp(char *s1, char *s2);
 int printf(char *fmt, ...);
 int fprintf(FILE *out, char *fmt, ...);
 int sprintf(char *buf, char *fmt, ...);
 long strlen(char *p);
-int strncmp(char *p, char *q);
+int strncmp(char *p, char *q, long n);
 void *memcpy(char *dst, char *src, long n);
 char *strndup(char *p, long n);
 int isspace(int c);
 char *strstr(char *haystack, char *needle);
+char *strchr(char *s, int c);
 long strtol(char *nptr, char **endptr, int base);
 void free(void* p);
 typedef struct {
@@ -52,6 +96,7 @@ typedef __va_elem va_list[1];
 
 int vfprintf(FILE *stderr, char *fmt, va_list ap);
 int vprintf(char *fmt, va_list ap);
+int vsnprintf(char *buf, long n, char *fmt, va_list ap);
 static void va_start(__va_elem *ap) {
   __builtin_va_start(ap);
 }
@@ -67,9 +112,11 @@ EOF
     sed -i 's/INT_MAX/2147483647/g' $TMP/$1
     sed -i 's/SEEK_END/2/g' $TMP/$1
     sed -i 's/SEEK_SET/0/g' $TMP/$1
-
-    ./ynicc $TMP/$1 > $TMP/${1%.c}.s
-    gcc -g -c -o $TMP/${1%.c}.o $TMP/${1%.c}.s
+    sed -i 's/PROT_READ/1/g; s/PROT_WRITE/2/g' $TMP/$1
+    sed -i 's/MAP_PRIVATE/2/g; s/MAP_FIXED/16/g; s/MAP_ANONYMOUS/32/g; s/MAP_FAILED/((void *) -1)/g' $TMP/$1
+    sed -i 's/_SC_PAGESIZE/30/g' $TMP/$1
+    sed -i 's/CLOCK_MONOTONIC/1/g; s/CLOCK_PROCESS_CPUTIME_ID/2/g; s/RUSAGE_SELF/0/g' $TMP/$1
+    sed -i 's/AF_UNIX/1/g; s/SOCK_STREAM/1/g; s/WNOHANG/1/g; s/EINTR/4/g; s/EEXIST/17/g' $TMP/$1
 }
 
 cp *.c $TMP
@@ -77,12 +124,17 @@ cp *.c $TMP
 #   gcc -I. -c -o ${i%.c}.o $i
 # done
 
-expand ynicc.c
-expand parser.c
-expand codegen.c
-expand string_buffer.c
-expand tokenize.c
-expand debug.c
-expand type.c
+SRCS="ynicc.c parser.c codegen.c report.c string_buffer.c arena.c cache.c intern.c emit.c server.c tokenize.c debug.c type.c ir.c ir_codegen.c ir_opt.c pass.c fold.c"
+
+for f in $SRCS; do
+  expand $f
+done
+
+# 全部のファイルを1回で(並列に)コンパイルして、それぞれ .s を作る
+./ynicc -j 4 $(for f in $SRCS; do echo $TMP/$f; done)
+
+for f in $SRCS; do
+  gcc -g -c -o $TMP/${f%.c}.o $TMP/${f%.c}.s
+done
 
 gcc -g -static -o ynicc-gen2 $TMP/*.o
@@ -0,0 +1,228 @@
+#define _DEFAULT_SOURCE
+#include "ynicc.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// コンパイルサーバー(--server)とそのクライアント(--connect)
+//
+// サーバーは起動時に --prelude のファイルを1回だけパースしておき、コンパイル要求が来るたびに fork して
+// 子プロセスでコンパイルする。子プロセスはパース済みのプレリュード(スコープ、型、internした識別子)や
+// 確保済みのアリーナをそのまま引き継ぐので、毎回プロセスを起動してプレリュードをパースし直す必要がない。
+// また、コンパイルエラーで error() が exit しても子プロセスが終わるだけでサーバーは動き続ける。
+// プレリュードの static でない関数やグローバル変数の定義は各ファイルの出力には入れないので、
+// プレリュード自体は別にコンパイルして一緒にリンクする。
+//
+// プロトコル(1接続で1ファイル)
+//   要求: コンパイルするファイルの絶対パス + "\n"
+//   応答: "<終了ステータス> <アセンブリのバイト数> <エラーメッセージのバイト数>\n" + アセンブリ + エラーメッセージ
+
+enum {
+  // 要求の1行の最大の長さ
+  SERVER_LINE_MAX = 4096,
+  SERVER_COPY_BUFFER_SIZE = 1 << 16,
+};
+
+static void write_all(int fd, char *buf, long len) {
+  while (len > 0) {
+    long n = write(fd, buf, len);
+    if (n < 0) {
+      error("write: %s", strerror(errno));
+    }
+    buf = buf + n;
+    len = len - n;
+  }
+}
+
+// fd から len バイト読んで to に書く
+static void copy_fd(int from, int to, long len) {
+  char *buf = calloc(SERVER_COPY_BUFFER_SIZE, sizeof(char));
+  while (len > 0) {
+    long size = SERVER_COPY_BUFFER_SIZE;
+    if (size > len) {
+      size = len;
+    }
+    long n = read(from, buf, size);
+    if (n <= 0) {
+      error("read: %s", n ? strerror(errno) : "unexpected end of data");
+    }
+    write_all(to, buf, n);
+    len = len - n;
+  }
+  free(buf);
+}
+
+// fd から改行までを1行読む(改行は含まない)
+static char *read_line(int fd) {
+  char *buf = calloc(SERVER_LINE_MAX, sizeof(char));
+  int len = 0;
+  for (;;) {
+    char c;
+    if (read(fd, &c, 1) != 1) {
+      error("read: unexpected end of data");
+    }
+    if (c == '\n') {
+      break;
+    }
+    if (len == SERVER_LINE_MAX - 1) {
+      error("too long line");
+    }
+    buf[len++] = c;
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+static int socket_at(char *socket_path, struct sockaddr_un *addr) {
+  if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+    error("too long socket path: %s", socket_path);
+  }
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  memcpy(addr->sun_path, socket_path, strlen(socket_path));
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0) {
+    error("socket: %s", strerror(errno));
+  }
+  return sock;
+}
+
+// 1個の要求を処理する(サーバーから fork した子プロセスで動く)
+static void serve(int conn) {
+  char *path = read_line(conn);
+
+  // アセンブリとエラーメッセージを一時ファイルに受けてから、まとめて返す
+  FILE *out = tmpfile();
+  FILE *diag = tmpfile();
+  if (!out || !diag) {
+    error("cannot create temporary file: %s", strerror(errno));
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  int pid = fork();
+  if (pid < 0) {
+    error("fork: %s", strerror(errno));
+  }
+  if (pid == 0) {
+    dup2(fileno(out), 1);
+    dup2(fileno(diag), 2);
+    compile_file(path, NULL, 1);
+    exit(0);
+  }
+
+  int status;
+  int ret = waitpid(pid, &status, 0);
+  if (ret < 0) {
+    error("waitpid: %s", strerror(errno));
+  }
+
+  long asm_len = lseek(fileno(out), 0, SEEK_END);
+  long diag_len = lseek(fileno(diag), 0, SEEK_END);
+  lseek(fileno(out), 0, SEEK_SET);
+  lseek(fileno(diag), 0, SEEK_SET);
+
+  char header[100];
+  int n = sprintf(header, "%d %ld %ld\n", status ? 1 : 0, asm_len, diag_len);
+  write_all(conn, header, n);
+  copy_fd(fileno(out), conn, asm_len);
+  copy_fd(fileno(diag), conn, diag_len);
+  close(conn);
+}
+
+// socket_path で待ち受けて、来た要求を順にコンパイルする(終了しない)
+int run_server(char *socket_path) {
+  struct sockaddr_un addr;
+  int sock = socket_at(socket_path, &addr);
+
+  unlink(socket_path);
+  int ret = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  if (ret < 0) {
+    error("bind %s: %s", socket_path, strerror(errno));
+  }
+  ret = listen(sock, 64);
+  if (ret < 0) {
+    error("listen: %s", strerror(errno));
+  }
+  fprintf(stderr, "## ynicc server: listening on %s\n", socket_path);
+
+  for (;;) {
+    int conn = accept(sock, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      error("accept: %s", strerror(errno));
+    }
+
+    // 終わった子プロセスを回収しておく
+    for (;;) {
+      int done = waitpid(-1, NULL, WNOHANG);
+      if (done <= 0) {
+        break;
+      }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    int pid = fork();
+    if (pid < 0) {
+      error("fork: %s", strerror(errno));
+    }
+    if (pid == 0) {
+      close(sock);
+      serve(conn);
+      exit(0);
+    }
+    close(conn);
+  }
+  return 0;
+}
+
+// socket_path のサーバーに path のコンパイルを依頼して、アセンブリを output_path (NULLなら標準出力)に書く
+// コンパイルに失敗したら1を返す
+int run_client(char *socket_path, char *path, char *output_path) {
+  // サーバーのカレントディレクトリは違うかもしれないので絶対パスで送る
+  char *abs_path = realpath(path, NULL);
+  if (!abs_path) {
+    error("cannot open %s: %s", path, strerror(errno));
+  }
+
+  struct sockaddr_un addr;
+  int sock = socket_at(socket_path, &addr);
+  int ret = connect(sock, (struct sockaddr *)&addr, sizeof(addr));
+  if (ret < 0) {
+    error("connect %s: %s", socket_path, strerror(errno));
+  }
+  write_all(sock, abs_path, strlen(abs_path));
+  write_all(sock, "\n", 1);
+
+  char *header = read_line(sock);
+  char *p = header;
+  int status = strtol(p, &p, 10);
+  long asm_len = strtol(p, &p, 10);
+  long diag_len = strtol(p, &p, 10);
+
+  if (status == 0) {
+    emit_open(output_path);
+    emit_copy(sock, asm_len);
+    emit_close();
+  } else {
+    // 失敗した時のアセンブリは途中までしかないので捨てる
+    char *buf = calloc(SERVER_COPY_BUFFER_SIZE, sizeof(char));
+    while (asm_len > 0) {
+      long n = read(sock, buf, asm_len < SERVER_COPY_BUFFER_SIZE ? asm_len : SERVER_COPY_BUFFER_SIZE);
+      if (n <= 0) {
+        error("read: unexpected end of data");
+      }
+      asm_len = asm_len - n;
+    }
+    free(buf);
+  }
+  copy_fd(sock, 2, diag_len);
+  close(sock);
+
+  return status;
+}
@@ -0,0 +1,46 @@
+#!/bin/bash
+# 最適化のパスを1つずつ有効にして tests をコンパイル・実行し、どのパスで壊れたかを調べる
+#
+# 最初にパスを全部無効にしたもので通ることを確かめてから、パスを1つだけ有効にしたもの、
+# ASTからのコード生成だけで使うパスを -O0 で1つだけ有効にしたもの、最後に -O0, -O1, -O2 のそれぞれで通るかを確かめる。IRのパスは実行するたびにIRを検査する(--verify-passes)。
+#
+# usage: ./test_passes.sh [ynicc のパス]
+YNICC=${1:-./ynicc}
+TMP=$(mktemp -d /tmp/ynicc-test-passes.XXXXXX)
+trap "rm -rf $TMP" EXIT
+
+gcc -O0 -c -o $TMP/test_func.o test_func.c || exit 1
+
+failed=""
+
+# $1: 表示する名前、残り: ynicc に渡すオプション
+run() {
+    name=$1
+    shift
+    if $YNICC "$@" --verify-passes tests > $TMP/tmp.s 2> $TMP/out &&
+        gcc -O0 -static -o $TMP/tmp $TMP/test_func.o $TMP/tmp.s 2> /dev/null &&
+        $TMP/tmp > $TMP/out 2>&1; then
+        echo "## $name: ok"
+    else
+        tail -5 $TMP/out
+        echo "## $name: failed"
+        failed="$failed $name"
+    fi
+}
+
+run "-O2 --passes=" -O2 --passes=
+for pass in $($YNICC --list-passes | awk '{print $1}'); do
+    run "-O2 --passes=$pass" -O2 --passes=$pass
+done
+# -O1 以上ではIRで扱える関数はIRを通るので、ASTからのコード生成のパスは -O0 で確かめる
+for pass in fold regvar; do
+    run "-O0 --passes=$pass" -O0 --passes=$pass
+done
+for level in -O0 -O1 -O2; do
+    run "$level" $level
+done
+
+if [ -n "$failed" ]; then
+    echo "## failed:$failed"
+    exit 1
+fi
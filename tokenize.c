@@ -1,9 +1,64 @@
+#define _DEFAULT_SOURCE
 #include "ynicc.h"
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+enum {
+  // tokenize_stream で1個のブロックに入れるトークンの数
+  TOKEN_BLOCK_SIZE = 1024,
+};
+
+typedef struct TokenBlock TokenBlock;
+struct TokenBlock {
+  TokenBlock *next;
+  Token *tokens;
+  int used;
+};
+
+// tokenize_stream で読んでいる途中かどうか
+static bool streaming;
+// 次にトークナイズする位置
+static char *stream_p;
+// 読んだトークンが入っているブロック(古い順)
+static TokenBlock *used_blocks;
+static TokenBlock *last_used_block;
+// 再利用できるブロック
+static TokenBlock *free_blocks;
+
+static Token *alloc_stream_token(void) {
+  TokenBlock *b = last_used_block;
+  if (!b || b->used == TOKEN_BLOCK_SIZE) {
+    if (free_blocks) {
+      b = free_blocks;
+      free_blocks = b->next;
+      memset(b->tokens, 0, sizeof(Token) * TOKEN_BLOCK_SIZE);
+    } else {
+      b = arena_alloc(ARENA_TOKEN, sizeof(TokenBlock));
+      b->tokens = arena_alloc(ARENA_TOKEN, sizeof(Token) * TOKEN_BLOCK_SIZE);
+    }
+    b->next = NULL;
+    b->used = 0;
+
+    if (last_used_block) {
+      last_used_block->next = b;
+    } else {
+      used_blocks = b;
+    }
+    last_used_block = b;
+  }
+  return &b->tokens[b->used++];
+}
 
 Token *new_token(TokenKind kind, Token *cur, char *str, int len) {
-  Token *tok = calloc(1, sizeof(Token));
+  Token *tok;
+  if (streaming) {
+    tok = alloc_stream_token();
+  } else {
+    tok = arena_alloc(ARENA_TOKEN, sizeof(Token));
+  }
+  mem_count(MEM_TOKEN, sizeof(Token));
   tok->kind = kind;
   tok->str = str;
   tok->len = len;
@@ -81,6 +136,108 @@ char *token_kind_to_s(TokenKind kind) {
   return NULL;
 }
 
+char *punct_kind_to_s(PunctKind kind) {
+  switch (kind) {
+    case PK_DUMMY:
+      return "(not punct)";
+    case PK_ADD:
+      return "+";
+    case PK_INC:
+      return "++";
+    case PK_ADD_ASSIGN:
+      return "+=";
+    case PK_SUB:
+      return "-";
+    case PK_DEC:
+      return "--";
+    case PK_SUB_ASSIGN:
+      return "-=";
+    case PK_ARROW:
+      return "->";
+    case PK_MUL:
+      return "*";
+    case PK_MUL_ASSIGN:
+      return "*=";
+    case PK_DIV:
+      return "/";
+    case PK_DIV_ASSIGN:
+      return "/=";
+    case PK_MOD:
+      return "%";
+    case PK_ASSIGN:
+      return "=";
+    case PK_EQ:
+      return "==";
+    case PK_NOT:
+      return "!";
+    case PK_NE:
+      return "!=";
+    case PK_LT:
+      return "<";
+    case PK_LE:
+      return "<=";
+    case PK_SHL:
+      return "<<";
+    case PK_SHL_ASSIGN:
+      return "<<=";
+    case PK_GT:
+      return ">";
+    case PK_GE:
+      return ">=";
+    case PK_SHR:
+      return ">>";
+    case PK_SHR_ASSIGN:
+      return ">>=";
+    case PK_BIT_AND:
+      return "&";
+    case PK_LOGICAL_AND:
+      return "&&";
+    case PK_AND_ASSIGN:
+      return "&=";
+    case PK_BIT_OR:
+      return "|";
+    case PK_LOGICAL_OR:
+      return "||";
+    case PK_OR_ASSIGN:
+      return "|=";
+    case PK_BIT_XOR:
+      return "^";
+    case PK_XOR_ASSIGN:
+      return "^=";
+    case PK_BIT_NOT:
+      return "~";
+    case PK_QUESTION:
+      return "?";
+    case PK_COLON:
+      return ":";
+    case PK_SEMICOLON:
+      return ";";
+    case PK_COMMA:
+      return ",";
+    case PK_DOT:
+      return ".";
+    case PK_ELLIPSIS:
+      return "...";
+    case PK_LPAREN:
+      return "(";
+    case PK_RPAREN:
+      return ")";
+    case PK_LBRACE:
+      return "{";
+    case PK_RBRACE:
+      return "}";
+    case PK_LBRACKET:
+      return "[";
+    case PK_RBRACKET:
+      return "]";
+    case PK_OTHER:
+      return "(other punct)";
+  }
+  error("不正な記号です");
+
+  return NULL;
+}
+
 void dump_token(Token *t) {
   if (!t) {
     printf("## (NULL token)");
@@ -103,14 +260,6 @@ void dump_token(Token *t) {
   printf(")\n");
 }
 
-void free_tokens(Token *cur) {
-  while (cur) {
-    Token *tmp = cur->next;
-    free(cur);
-    cur  = tmp;
-  }
-}
-
 bool is_alnum(char c) {
   return
     ('a' <= c && c <= 'z') ||
@@ -133,120 +282,177 @@ bool starts_with(char *p, char *str) {
 typedef struct Keyword {
   char *keyword;
   TokenKind kind;
+  int len; // keywordの長さ(init_keyword_tableで設定)
 } Keyword;
 
 static Keyword keywords[] = {
   {
     "return",
     TK_RETURN,
+    0,
   },
   {
     "while",
     TK_WHILE,
+    0,
   },
   {
     "if",
     TK_IF,
+    0,
   },
   {
     "else",
     TK_ELSE,
+    0,
   },
   {
     "for",
     TK_FOR,
+    0,
   },
   {
     "void",
     TK_VOID,
+    0,
   },
   {
     "int",
     TK_INT,
+    0,
   },
   {
     "char",
     TK_CHAR,
+    0,
   },
   {
     "long",
     TK_LONG,
+    0,
   },
   {
     "short",
     TK_SHORT,
+    0,
   },
   {
     "_Bool",
     TK_BOOL,
+    0,
   },
   {
     "struct",
     TK_STRUCT,
+    0,
   },
   {
     "enum",
     TK_ENUM,
+    0,
   },
   {
     "sizeof",
     TK_SIZEOF,
+    0,
   },
   {
     "_Alignof",
     TK_ALIGNOF,
+    0,
   },
   {
     "typedef",
     TK_TYPEDEF,
+    0,
   },
   {
     "static",
     TK_STATIC,
+    0,
   },
   {
     "extern",
     TK_EXTERN,
+    0,
   },
   {
     "break",
     TK_BREAK,
+    0,
   },
   {
     "continue",
     TK_CONTINUE,
+    0,
   },
   {
     "goto",
     TK_GOTO,
+    0,
   },
   {
     "switch",
     TK_SWITCH,
+    0,
   },
   {
     "case",
     TK_CASE,
+    0,
   },
   {
     "default",
     TK_DEFAULT,
+    0,
   },
   {
     "do",
     TK_DO,
+    0,
   },
 };
 
-Keyword *tokenize_keyword(char *p) {
-  for (int i = 0; i < sizeof(keywords) / sizeof(Keyword); i++) {
+enum {
+  KEYWORD_TABLE_SIZE = 64,
+};
+
+// キーワードの完全ハッシュ
+// 識別子の先頭の文字、末尾の文字、長さから keyword_table のインデックスを計算する。
+// keywords[] のどのキーワード同士も衝突しないように係数を選んでいるので(衝突したら init_keyword_table でエラーにする)、
+// 識別子を1回読み切った後に、ハッシュ計算1回と文字列比較1回だけでキーワードかどうか判定できる。
+// キーワードを追加して衝突するようになった場合は係数を選び直すこと。
+static int keyword_hash(char *p, int len) {
+  return (p[0] + p[len - 1] * 15 + len * 5) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static Keyword *keyword_table[KEYWORD_TABLE_SIZE];
+static bool keyword_table_initialized;
+
+static void init_keyword_table(void) {
+  if (keyword_table_initialized) {
+    return;
+  }
+  int nkeywords = sizeof(keywords) / sizeof(Keyword);
+  for (int i = 0; i < nkeywords; i++) {
     Keyword *k = &keywords[i];
-    int len = strlen(k->keyword);
-    if (strncmp(p, k->keyword, len) == 0 && !is_alnum(p[len])) {
-      return k;
+    k->len = strlen(k->keyword);
+    int h = keyword_hash(k->keyword, k->len);
+    if (keyword_table[h]) {
+      error("キーワードのハッシュが衝突しています: %s, %s", keyword_table[h]->keyword, k->keyword);
     }
+    keyword_table[h] = k;
   }
-  return NULL;
+  keyword_table_initialized = true;
+}
+
+// p から len 文字の識別子がキーワードならそのトークン種別を、そうでなければ TK_IDENT を返す
+static TokenKind keyword_kind(char *p, int len) {
+  Keyword *k = keyword_table[keyword_hash(p, len)];
+  if (k && k->len == len && memcmp(p, k->keyword, len) == 0) {
+    return k->kind;
+  }
+  return TK_IDENT;
 }
 
 static int parse_escaped(int ch) {
@@ -328,7 +534,9 @@ static Token *tokenize_string_literal(Token *current_token, char **current_point
 
   Token *tok = new_token(TK_STR, current_token, s, p - s);
   sb_append_char(sb, '\0');
-  tok->contents = my_strndup(sb_str(sb), sb_str_len(sb));
+  // 文字列の中身はパース中にInitializerなどへコピーされるのでトークンと同じアリーナに置く
+  tok->contents = arena_alloc(ARENA_TOKEN, sb_str_len(sb));
+  memcpy(tok->contents, sb_str(sb), sb_str_len(sb));
   // \0まで含めた長さ
   tok->content_length = sb_str_len(sb);
 
@@ -474,47 +682,153 @@ static Token *tokenize_number(Token *cur, char **cur_pos) {
   return tok;
 }
 
-static char *multi_char_ope[]= {
-  "<=",
-  ">=",
-  "==",
-  "!=",
-  "->",
-  "++",
-  "--",
-  "+=",
-  "-=",
-  "*=",
-  "/=",
-  "&&",
-  "||",
-  // << より先に確認しないと<<に食われて=が余ってしまう
-  "<<=",
-  ">>=",
-  ">>",
-  "<<",
-  "|=",
-  "&=",
-  "^=",
-  "...",
-  NULL,
-};
-
-// 複数文字からなるオペレータにマッチするかを返す。
-// マッチする場合そのオペレータの文字数、マッチしない場合は0を返す
-int is_multi_char_operator(char *p) {
-  for (char **op = multi_char_ope; *op; op++) {
-    if (starts_with(p, *op)) {
-      return strlen(*op);
-    }
+// p から始まる記号を先頭の1文字で分類して、最長一致する記号の種類を返す。
+// (<<= と << のような前方一致する記号も、最大3文字の比較だけで長い方を選べる)
+// 記号の長さは len に設定する。記号でなければ PK_DUMMY を返す。
+static PunctKind read_punct(char *p, int *len) {
+  *len = 1;
+  switch (*p) {
+    case '+':
+      if (p[1] == '+') {
+        *len = 2;
+        return PK_INC;
+      }
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_ADD_ASSIGN;
+      }
+      return PK_ADD;
+    case '-':
+      if (p[1] == '-') {
+        *len = 2;
+        return PK_DEC;
+      }
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_SUB_ASSIGN;
+      }
+      if (p[1] == '>') {
+        *len = 2;
+        return PK_ARROW;
+      }
+      return PK_SUB;
+    case '*':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_MUL_ASSIGN;
+      }
+      return PK_MUL;
+    case '/':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_DIV_ASSIGN;
+      }
+      return PK_DIV;
+    case '%':
+      return PK_MOD;
+    case '=':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_EQ;
+      }
+      return PK_ASSIGN;
+    case '!':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_NE;
+      }
+      return PK_NOT;
+    case '<':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_LE;
+      }
+      if (p[1] == '<') {
+        if (p[2] == '=') {
+          *len = 3;
+          return PK_SHL_ASSIGN;
+        }
+        *len = 2;
+        return PK_SHL;
+      }
+      return PK_LT;
+    case '>':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_GE;
+      }
+      if (p[1] == '>') {
+        if (p[2] == '=') {
+          *len = 3;
+          return PK_SHR_ASSIGN;
+        }
+        *len = 2;
+        return PK_SHR;
+      }
+      return PK_GT;
+    case '&':
+      if (p[1] == '&') {
+        *len = 2;
+        return PK_LOGICAL_AND;
+      }
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_AND_ASSIGN;
+      }
+      return PK_BIT_AND;
+    case '|':
+      if (p[1] == '|') {
+        *len = 2;
+        return PK_LOGICAL_OR;
+      }
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_OR_ASSIGN;
+      }
+      return PK_BIT_OR;
+    case '^':
+      if (p[1] == '=') {
+        *len = 2;
+        return PK_XOR_ASSIGN;
+      }
+      return PK_BIT_XOR;
+    case '.':
+      if (p[1] == '.' && p[2] == '.') {
+        *len = 3;
+        return PK_ELLIPSIS;
+      }
+      return PK_DOT;
+    case '~':
+      return PK_BIT_NOT;
+    case '?':
+      return PK_QUESTION;
+    case ':':
+      return PK_COLON;
+    case ';':
+      return PK_SEMICOLON;
+    case ',':
+      return PK_COMMA;
+    case '(':
+      return PK_LPAREN;
+    case ')':
+      return PK_RPAREN;
+    case '{':
+      return PK_LBRACE;
+    case '}':
+      return PK_RBRACE;
+    case '[':
+      return PK_LBRACKET;
+    case ']':
+      return PK_RBRACKET;
   }
-  return 0;
+  *len = 0;
+  return PK_DUMMY;
 }
 
-Token *tokenize(char *p) {
-  Token head;
-  head.next = NULL;
-  Token *cur = &head;
+// *pp から次のトークンを1個読んで cur の後ろにつなぐ(空白やコメントは読み飛ばす)
+// 入力の終わりに来たら TK_EOF のトークンを返す
+static Token *lex_token(Token *cur, char **pp) {
+  char *p = *pp;
 
   while (*p) {
     // fprintf(stderr, "*p ... %c\n", *p);
@@ -540,22 +854,14 @@ Token *tokenize(char *p) {
       continue;
     }
 
-    // fprintf(stderr, "c ... %c\n", *p);
-    Keyword *key = tokenize_keyword(p);
-    if (key) {
-      int keyword_len = strlen(key->keyword);
-      cur = new_token(key->kind, cur, p, keyword_len);
-      assert(cur);
-      p += keyword_len;
-      continue;
-    }
-
-    int len = is_multi_char_operator(p);
-    if (len) {
+    int len;
+    PunctKind punct = read_punct(p, &len);
+    if (punct) {
       cur = new_token(TK_RESERVED, cur, p, len);
+      cur->punct = punct;
       assert(cur);
-      p += len;
-      continue;
+      *pp = p + len;
+      return cur;
     }
 
     if (is_ident_first_char(*p)) {
@@ -565,71 +871,284 @@ Token *tokenize(char *p) {
         p++;
       }
 
-      cur = new_token(TK_IDENT, cur, s, p - s); //p - s で文字列長さになる
+      // 識別子を読み切ってから、キーワードかどうかを判定する
+      cur = new_token(keyword_kind(s, p - s), cur, s, p - s); //p - s で文字列長さになる
       assert(cur);
-      continue;
+      if (cur->kind == TK_IDENT) {
+        // 識別子はここでinternしておき、以降は名前の比較をポインタの比較で済ませる
+        cur->ident = intern(s, p - s);
+      }
+      *pp = p;
+      return cur;
     }
 
     if (*p == '"') {
       cur = tokenize_string_literal(cur, &p);
       assert(cur);
-      continue;
+      *pp = p;
+      return cur;
     }
     if (*p == '\'') {
       cur = tokenize_char_literal(cur, &p);
       assert(cur);
-      continue;
+      *pp = p;
+      return cur;
     }
 
 
     if (ispunct(*p)) {
+      // read_punct で分類されなかった記号
       cur = new_token(TK_RESERVED, cur, p++, 1);
+      cur->punct = PK_OTHER;
       assert(cur);
-      continue;
+      *pp = p;
+      return cur;
     }
 
     if (isdigit(*p)) {
       cur = tokenize_number(cur, &p);
       assert(cur);
-      continue;
+      *pp = p;
+      return cur;
     }
 
 
     error_at(p, "トークナイズできません");
   }
-  new_token(TK_EOF, cur, p, 0);
+  *pp = p;
+  return new_token(TK_EOF, cur, p, 0);
+}
+
+// 前のコンパイルで使ったブロックを忘れる(ARENA_TOKEN はコンパイルごとに解放されている)
+static void reset_token_blocks(void) {
+  used_blocks = NULL;
+  last_used_block = NULL;
+  free_blocks = NULL;
+}
+
+// 入力全体をトークナイズしてトークンのリストを返す(--tokens でトークンを全部表示する時用)
+Token *tokenize(char *p) {
+  init_keyword_table();
+  build_line_index(p);
+  streaming = false;
+  reset_token_blocks();
+
+  Token head;
+  head.next = NULL;
+  Token *cur = &head;
+
+  while (cur->kind != TK_EOF) {
+    cur = lex_token(cur, &p);
+  }
 
   return head.next;
 }
 
-char *read_file(char *path) {
-  FILE *fp = fopen(path, "r");
-  if (!fp) {
-    error("cannot open %s: %s", path, strerror(errno));
+// 入力を先頭から必要になった分だけトークナイズするモードを開始して、最初のトークンを返す
+//
+// 2個目以降のトークンは next_token で進んだ時に読む。
+// トークンは TOKEN_BLOCK_SIZE 個ずつのブロックに入れておき、release_tokens_before で不要になったブロックは
+// 使い回す(リング状に再利用する)ので、トークン用のメモリは入力全体ではなく、先読み・巻き戻しする範囲の分だけで済む。
+Token *tokenize_stream(char *p) {
+  init_keyword_table();
+  build_line_index(p);
+
+  streaming = true;
+  stream_p = p;
+  reset_token_blocks();
+
+  Token head;
+  head.next = NULL;
+  return lex_token(&head, &stream_p);
+}
+
+// tok の次のトークンを返す(まだ読んでいなければここでトークナイズする)
+Token *next_token(Token *tok) {
+  if (!tok->next && tok->kind != TK_EOF) {
+    // 未読のトークンは、最後に読んだトークンの次だけ
+    lex_token(tok, &stream_p);
   }
+  return tok->next;
+}
 
-  // ファイルの最後の位置を調べてサイズ計算
-  if (fseek(fp, 0, SEEK_END) == -1) {
-    error("%s: fseek: %s", path, strerror(errno));
+// tok より前のトークンが入っているブロックを再利用できるようにする
+// (パーサがもう tok より前に巻き戻さない時に呼ぶ)
+void release_tokens_before(Token *tok) {
+  while (used_blocks && used_blocks != last_used_block &&
+         !(used_blocks->tokens <= tok && tok < used_blocks->tokens + TOKEN_BLOCK_SIZE)) {
+    TokenBlock *b = used_blocks;
+    used_blocks = b->next;
+    b->next = free_blocks;
+    free_blocks = b;
   }
-  long file_size = ftell(fp);
+}
 
-  // 読むために先頭に戻す
-  if (fseek(fp, 0, SEEK_SET) == -1) {
-    error("%s: fseek: %s", path, strerror(errno));
+// 通常のファイルをmmapして \n\0 で終わる文字列として返す
+//
+// ファイルの後ろに \n\0 を書き足す余地を作るため、2バイト分を含めてページ単位に切り上げた大きさの
+// 無名ページ(0埋め)を確保してから、その先頭にファイルを重ねてマップする。
+// ファイルの最後のページのEOF以降も、その後ろの無名ページも0なので、\0 は書かなくても入っている。
+static char *map_file(char *path, int fd, long file_size) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  long map_size = (file_size + 2 + page_size - 1) / page_size * page_size;
+
+  char *buf = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) {
+    error("%s: mmap: %s", path, strerror(errno));
+  }
+  if (mmap(buf, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    error("%s: mmap: %s", path, strerror(errno));
   }
 
-  // \n\0で終わらせるための2バイト追加で確保
-  char *buf = calloc(1, file_size + 2);
-  fread(buf, file_size, 1, fp);
+  // 書き込むとそのページだけコピーされる(MAP_PRIVATEなのでファイルには反映されない)
+  if (buf[file_size - 1] != '\n') {
+    buf[file_size] = '\n';
+  }
+  return buf;
+}
 
+// パイプなどサイズがわからないものを最後まで読んで \n\0 で終わる文字列として返す
+static char *read_stream(FILE *fp) {
+  long capacity = 4096;
+  long len = 0;
+  char *buf = malloc(capacity);
+
+  for (;;) {
+    // \n\0 で終わらせるための2バイトは常に空けておく
+    if (len + 2 == capacity) {
+      capacity = capacity * 2;
+      buf = realloc(buf, capacity);
+    }
+    long n = fread(buf + len, 1, capacity - len - 2, fp);
+    if (n == 0) {
+      break;
+    }
+    len = len + n;
+  }
 
-  if (file_size == 0 || buf[file_size - 1] != '\n') {
-    buf[file_size++] = '\n';
+  if (len == 0 || buf[len - 1] != '\n') {
+    buf[len++] = '\n';
+  }
+  buf[len] = '\0';
+  return buf;
+}
+
+// path のファイル("-" なら標準入力)を \n\0 で終わる文字列として読む
+char *read_file(char *path) {
+  FILE *fp;
+  if (strcmp(path, "-") == 0) {
+    fp = stdin;
+  } else {
+    fp = fopen(path, "r");
+    if (!fp) {
+      error("cannot open %s: %s", path, strerror(errno));
+    }
+  }
+
+  // パイプはseekできず(-1)、/proc のファイルなどはサイズが0になるので、その場合は読み込んでコピーする
+  char *buf;
+  long file_size = lseek(fileno(fp), 0, SEEK_END);
+  if (file_size > 0) {
+    buf = map_file(path, fileno(fp), file_size);
+  } else {
+    buf = read_stream(fp);
+  }
+
+  // マップした領域はファイルを閉じても残る
+  if (fp != stdin) {
+    fclose(fp);
   }
-  buf[file_size] = '\0';
-  fclose(fp);
 
   return buf;
 }
 
+
+// 各行の先頭位置の索引(エラーメッセージやアセンブリに出す行番号用)
+//
+// サーバーではプレリュードとコンパイルするファイルのように入力が複数あるので、入力ごとに索引を作っておき、
+// 位置がどの入力の中にあるかで索引を選ぶ。
+typedef struct LineIndex LineIndex;
+struct LineIndex {
+  LineIndex *next;
+  char *name;  // 入力ファイル名
+  char *input; // 入力の先頭
+  char *end;   // 入力の末尾の \0 の位置
+  char **line_starts; // line_starts[i] が i+1 行目の先頭
+  int line_count;
+};
+
+static LineIndex *line_indexes;
+
+// input (ファイル名は filename)の各行の先頭位置を記録する
+void build_line_index(char *input) {
+  LineIndex *idx = NULL;
+  for (LineIndex *i = line_indexes; i; i = i->next) {
+    if (i->input == input) {
+      idx = i;
+    }
+  }
+  if (!idx) {
+    idx = calloc(1, sizeof(LineIndex));
+    idx->next = line_indexes;
+    line_indexes = idx;
+  }
+
+  int capacity = 1024;
+  idx->line_starts = realloc(idx->line_starts, sizeof(char *) * capacity);
+  idx->line_starts[0] = input;
+  idx->line_count = 1;
+
+  for (char *p = strchr(input, '\n'); p; p = strchr(p + 1, '\n')) {
+    if (idx->line_count == capacity) {
+      capacity = capacity * 2;
+      idx->line_starts = realloc(idx->line_starts, sizeof(char *) * capacity);
+    }
+    idx->line_starts[idx->line_count++] = p + 1;
+  }
+  idx->name = filename;
+  idx->input = input;
+  idx->end = input + strlen(input);
+}
+
+// loc を含む入力の索引
+static LineIndex *find_line_index(char *loc) {
+  for (LineIndex *i = line_indexes; i; i = i->next) {
+    if (i->input <= loc && loc <= i->end) {
+      return i;
+    }
+  }
+  // トークナイズしていない入力の位置なら、今の入力の索引を作る
+  build_line_index(user_input);
+  return line_indexes;
+}
+
+// loc がある行の索引(0始まり)を二分探索で求める
+static int find_line(LineIndex *idx, char *loc) {
+  int lo = 0;
+  int hi = idx->line_count - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (idx->line_starts[mid] <= loc) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+// loc が何行目か(1始まり)
+int line_number(char *loc) {
+  return find_line(find_line_index(loc), loc) + 1;
+}
+
+// loc がある行の先頭
+char *line_start(char *loc) {
+  LineIndex *idx = find_line_index(loc);
+  return idx->line_starts[find_line(idx, loc)];
+}
+
+// loc があるファイルの名前
+char *source_name(char *loc) {
+  return find_line_index(loc)->name;
+}
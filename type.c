@@ -8,7 +8,8 @@ Type *long_type = &(Type){ TY_LONG, 8, 8};
 Type *short_type = &(Type){ TY_SHORT, 2, 2};
 
 static Type *new_type(TypeKind kind, int size, int align) {
-  Type *t = calloc(1, sizeof(Type));
+  Type *t = arena_alloc(ARENA_TYPE, sizeof(Type));
+  mem_count(MEM_TYPE, sizeof(Type));
   t->kind = kind;
   t->size = size;
   t->align = align;
@@ -60,24 +61,28 @@ int node_type_size(Node *node) {
   return node->ty->size;
 }
 
-void add_type(Node *node) {
+static void add_type_sub(Node *node) {
   if (!node || node->ty)
     return;
 
   assert(node);
-  add_type(node->lhs);
-  add_type(node->rhs);
-  add_type(node->cond);
-  add_type(node->then);
-  add_type(node->els);
-  add_type(node->init);
-  add_type(node->inc);
-
-  for (Node *n = node->body; n; n = n->next) {
-    add_type(n);
-  }
-  for (Node *n = node->arg; n; n = n->next) {
-    add_type(n);
+  add_type_sub(node->lhs);
+  add_type_sub(node->rhs);
+  add_type_sub(node->init);
+
+  // 式のノードには body 以降のフィールドがない
+  if (node_has_stmt_part(node->kind)) {
+    add_type_sub(node->cond);
+    add_type_sub(node->then);
+    add_type_sub(node->els);
+    add_type_sub(node->inc);
+
+    for (Node *n = node->body; n; n = n->next) {
+      add_type_sub(n);
+    }
+    for (Node *n = node->arg; n; n = n->next) {
+      add_type_sub(n);
+    }
   }
   #pragma clang diagnostic ignored "-Wswitch"
   switch (node->kind) {
@@ -86,6 +91,7 @@ void add_type(Node *node) {
     case ND_PTR_DIFF:
     case ND_MUL:
     case ND_DIV:
+    case ND_MOD:
     case ND_EQL:
     case ND_NOT_EQL:
     case ND_LT:
@@ -95,6 +101,10 @@ void add_type(Node *node) {
     case ND_BIT_XOR:
     case ND_A_LSHIFT:
     case ND_A_RSHIFT:
+    case ND_NOT:
+    case ND_BIT_NOT:
+    case ND_AND:
+    case ND_OR:
     case ND_NUM:
       node->ty = long_type;
       return;
@@ -116,6 +126,9 @@ void add_type(Node *node) {
     case ND_TERNARY:
       node->ty = node->then->ty;
       return;
+    case ND_COMMA:
+      node->ty = node->rhs->ty;
+      return;
     case ND_ADDR:
       if (node->lhs->ty->kind == TY_ARRAY) {
         node->ty = pointer_to(node->lhs->ty->ptr_to);
@@ -126,14 +139,14 @@ void add_type(Node *node) {
     case ND_DEREF:
       {
         if (!node->lhs->ty->ptr_to) {
-          error_at(node->tok->str, "invalid pointer dereferrence");
+          error_at(node->loc, "invalid pointer dereferrence");
         }
         Type *ty = node->lhs->ty->ptr_to;
         if (ty->kind == TY_VOID) {
-          error_at(node->tok->str, "void *ポインタをデリファレンスできません");
+          error_at(node->loc, "void *ポインタをデリファレンスできません");
         }
         if (ty->kind == TY_STRUCT && ty->is_incomplete) {
-          error_at(node->tok->str, "不完全な構造体のデリファレンスはできません");
+          error_at(node->loc, "不完全な構造体のデリファレンスはできません");
         }
         node->ty = ty;
       }
@@ -141,3 +154,12 @@ void add_type(Node *node) {
   }
 
 }
+
+void add_type(Node *node) {
+  if (!node || node->ty) {
+    return;
+  }
+  phase_begin(PHASE_ADD_TYPE);
+  add_type_sub(node);
+  phase_end(PHASE_ADD_TYPE);
+}
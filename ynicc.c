@@ -1,4 +1,8 @@
+#define _POSIX_C_SOURCE 200809L
 #include "ynicc.h"
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
 
 // 現在着目しているトークン
 Token *token;
@@ -8,47 +12,135 @@ char *filename;
 // 入力プログラム
 char *user_input;
 
-int main(int argc, char **argv) {
-  bool f_dump_ast = false;
-  bool f_dump_ast_only = false;
-  bool f_dump_tokens = false;
+static bool f_dump_ast = false;
+static bool f_dump_ast_only = false;
+static bool f_dump_ir = false;
+static bool f_dump_tokens = false;
+static bool f_arena_stats = false;
+static bool f_syntax_only = false;
+static bool f_mem_report = false;
 
-  if (argc < 2) {
-    fprintf(stderr, "引数の個数が正しくありません\n");
-    return 1;
+static long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 解析済みのプレリュード(--server --prelude で指定したもの)
+// コンパイルする各ファイルはこの後ろに続けて書かれているものとして扱う
+static Program *prelude;
+static char *prelude_input;
+
+// path をパースして、プレリュードとして以降のコンパイルで使えるようにしておく
+// (グローバルスコープの型、typedef、関数宣言などはパーサのスコープに残る)
+void load_prelude(char *path) {
+  filename = path;
+  user_input = read_file(filename);
+  prelude_input = user_input;
+  init_intern();
+  token = tokenize_stream(user_input);
+  prelude = program();
+  arena_release(ARENA_TOKEN);
+}
+
+// 変数がこのファイルの中だけのシンボルかどうか(static な変数や、文字列リテラルなどの .L で始まるラベル)
+static bool is_file_local(Var *var) {
+  return var->is_static || strncmp(var->name, ".L", 2) == 0;
+}
+
+// プレリュードはヘッダのように、各ファイルの先頭に書かれた宣言として扱う
+//
+// static でない関数やグローバル変数の定義は、プレリュード自体を別にコンパイルしたものの中にあるものとして出力しない
+// (同じプレリュードでコンパイルした複数のファイルをリンクしてもシンボルが重複しないように)。
+// static なものはファイルごとに必要なので、ファイルの先頭にあるものとして出力する。
+static void add_prelude_definitions(Program *pgm) {
+  // pgm->global_var はこのファイルのグローバル変数の後ろにプレリュードのグローバル変数が続いている
+  VarList head = {};
+  VarList *cur = &head;
+  for (VarList *v = pgm->global_var; v; v = v->next) {
+    if (v == prelude->global_var) {
+      break;
+    }
+    cur->next = v;
+    cur = v;
+  }
+  for (VarList *v = prelude->global_var; v; v = v->next) {
+    if (is_file_local(v->var)) {
+      VarList *copy = arena_alloc(ARENA_AST, sizeof(VarList));
+      copy->var = v->var;
+      cur->next = copy;
+      cur = copy;
+    }
   }
+  cur->next = NULL;
+  pgm->global_var = head.next;
 
-  if (argc > 2) {
-    for (int i = 1; i < argc - 1; i++) {
-      if (strcmp(argv[i], "--ast") == 0) {
-        f_dump_ast = true;
-      }
-      if (strcmp(argv[i], "--ast-only") == 0) {
-        f_dump_ast = true;
-        f_dump_ast_only = true;
-      }
-      if (strcmp(argv[i], "--tokens") == 0) {
-        f_dump_tokens = true;
-      }
+  // サーバーの子プロセスで1回だけ呼ぶので、プレリュードの関数のリストをそのままつなぎ替えてよい
+  Function fhead = {};
+  Function *fcur = &fhead;
+  Function *next;
+  for (Function *f = prelude->functions; f; f = next) {
+    next = f->next;
+    if (f->is_staitc) {
+      fcur->next = f;
+      fcur = f;
     }
   }
+  fcur->next = pgm->functions;
+  pgm->functions = fhead.next;
+}
 
+// path をコンパイルしてアセンブリを output_path (NULLなら標準出力)に書く
+void compile_file(char *path, char *output_path, int jobs) {
   // プログラム全体を保存
-  filename = argv[argc - 1];
+  filename = path;
+  phase_begin(PHASE_READ_FILE);
   user_input = read_file(filename);
+  phase_end(PHASE_READ_FILE);
 
-  // head はfree用
-  Token *head = token = tokenize(user_input);
-  // fprintf(stderr, "-------------------------------- tokenized\n");
-  if (f_dump_tokens) {
-    printf("##-----------------------------\n");
-    printf("## tokens\n");
-    dump_tokens(head);
+  // 出力がアセンブリだけの時はキャッシュを使う
+  char *entry = NULL;
+  if (cache_is_open() && !f_dump_tokens && !f_dump_ast && !f_dump_ir && !f_syntax_only && !f_arena_stats &&
+      !f_mem_report && !time_report_enabled()) {
+    entry = cache_entry(user_input, prelude_input);
+    if (cache_fetch(entry, output_path)) {
+      return;
+    }
+  }
+
+  init_intern();
+
+  if (f_dump_tokens || time_report_enabled()) {
+    // 全部のトークンを表示する時や、トークナイズの時間をパースと分けて測る時は先に全体をトークナイズしておく
+    phase_begin(PHASE_TOKENIZE);
+    Token *head = token = tokenize(user_input);
+    phase_end(PHASE_TOKENIZE);
+    if (f_dump_tokens) {
+      printf("##-----------------------------\n");
+      printf("## tokens\n");
+      dump_tokens(head);
+    }
+  } else {
+    // パーサが読み進めるのに合わせてトークナイズする
+    token = tokenize_stream(user_input);
   }
 
   // パースする(結果は グローバル変数のfunctionsに入る)
+  phase_begin(PHASE_PARSE);
   Program *pgm = program();
+  phase_end(PHASE_PARSE);
+  // パースが終わったらトークンは不要
+  arena_release(ARENA_TOKEN);
+
+  if (entry) {
+    // ファイル全体のキャッシュがなくても、変更のない関数のコードはキャッシュから取り出す
+    // (プレリュードの関数はキャッシュしないので、それを前につなげる前に設定する)
+    cache_assign_functions(pgm, user_input, prelude_input);
+  }
 
+  if (prelude) {
+    add_prelude_definitions(pgm);
+  }
 
   if (f_dump_ast) {
     printf("##-----------------------------\n");
@@ -61,12 +153,266 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (!f_dump_ast_only) {
-    codegen(pgm);
+  if (f_dump_ir) {
+    printf("##-----------------------------\n");
+    for (Function *f = pgm->functions; f; f = f->next) {
+      if (ir_supported(f)) {
+        run_ast_passes(f);
+        ir_print(ir_lower(f));
+        arena_reset(ARENA_CODEGEN);
+      }
+    }
+  }
+
+  if (entry) {
+    // キャッシュに書いてからそれを出力する
+    char *temp_path = cache_temp_path(entry);
+    emit_open(temp_path);
+    phase_begin(PHASE_CODEGEN);
+    codegen(pgm, jobs);
+    phase_end(PHASE_CODEGEN);
+    emit_close();
+    cache_store(temp_path, entry);
+    cache_output(entry, output_path);
+  } else if (!f_dump_ast_only && !f_syntax_only) {
+    emit_open(output_path);
+    phase_begin(PHASE_CODEGEN);
+    codegen(pgm, jobs);
+    phase_end(PHASE_CODEGEN);
+    emit_close();
   }
 
-  free_tokens(head);
+  arena_release(ARENA_CODEGEN);
+  free_program(pgm);
 
-  return 0;
+  if (f_arena_stats) {
+    arena_dump_stats();
+  }
+  if (time_report_enabled()) {
+    print_time_report();
+    print_pass_report();
+  }
+  if (f_mem_report) {
+    print_mem_report();
+  }
+}
+
+// 入力ファイル名の拡張子 .c を .s に置き換えた出力ファイル名を返す
+static char *asm_path(char *path) {
+  int len = strlen(path);
+  if (len > 2 && path[len - 2] == '.' && path[len - 1] == 'c') {
+    len = len - 2;
+  }
+  char *buf = calloc(len + 3, sizeof(char));
+  memcpy(buf, path, len);
+  memcpy(buf + len, ".s", 2);
+  return buf;
 }
 
+// 複数の入力ファイルをそれぞれ別のプロセスでコンパイルして、入力ごとに .s ファイルを作る
+// (パーサなどのグローバルな状態はプロセスごとに独立する)
+// 同時に動かすのは jobs 個まで。最後にファイルごとにかかった時間を表示する。
+static int compile_files(char **inputs, int ninputs, int jobs) {
+  int *pids = calloc(ninputs, sizeof(int));
+  long *start = calloc(ninputs, sizeof(long));
+  long *elapsed = calloc(ninputs, sizeof(long));
+  int *statuses = calloc(ninputs, sizeof(int));
+
+  long total_start = now_ns();
+  int next = 0;
+  int running = 0;
+  int done = 0;
+  while (done < ninputs) {
+    while (running < jobs && next < ninputs) {
+      // 子プロセスにstdioのバッファが引き継がれないように先に書き出しておく
+      fflush(stdout);
+      fflush(stderr);
+
+      start[next] = now_ns();
+      int pid = fork();
+      if (pid < 0) {
+        error("fork: %s", strerror(errno));
+      }
+      if (pid == 0) {
+        compile_file(inputs[next], asm_path(inputs[next]), 1);
+        exit(0);
+      }
+      pids[next] = pid;
+      next++;
+      running++;
+    }
+
+    int status;
+    int pid = waitpid(-1, &status, 0);
+    if (pid < 0) {
+      error("waitpid: %s", strerror(errno));
+    }
+    for (int i = 0; i < next; i++) {
+      if (pids[i] == pid) {
+        elapsed[i] = now_ns() - start[i];
+        statuses[i] = status;
+      }
+    }
+    running--;
+    done++;
+  }
+  long total = now_ns() - total_start;
+
+  int failed = 0;
+  fprintf(stderr, "## %-40s %10s %s\n", "file", "time(ms)", "result");
+  for (int i = 0; i < ninputs; i++) {
+    if (statuses[i]) {
+      failed++;
+    }
+    fprintf(stderr, "## %-40s %10ld %s\n", inputs[i], elapsed[i] / 1000000, statuses[i] ? "failed" : "ok");
+  }
+  fprintf(stderr, "## %d files, %d failed, total %ld ms (-j %d)\n", ninputs, failed, total / 1000000, jobs);
+
+  free(pids);
+  free(start);
+  free(elapsed);
+  free(statuses);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  char *output_path = NULL;
+  int jobs = 1;
+  char *server_path = NULL;
+  char *client_path = NULL;
+  char *prelude_path = NULL;
+  char *cache_dir = NULL;
+  bool cache_stats = false;
+  char **inputs = calloc(argc, sizeof(char *));
+  int ninputs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--ast") == 0) {
+      f_dump_ast = true;
+    } else if (strcmp(argv[i], "--ast-only") == 0) {
+      f_dump_ast = true;
+      f_dump_ast_only = true;
+    } else if (strcmp(argv[i], "--ir") == 0) {
+      // 関数ごとのIRを表示する
+      f_dump_ir = true;
+    } else if (strcmp(argv[i], "-O0") == 0) {
+      // ASTから直接コード生成する(デフォルト)
+      opt_level = 0;
+    } else if (strcmp(argv[i], "-O1") == 0) {
+      // 定数畳み込みなどの最適化をして、IRを経由してコード生成する(SSAの値にレジスタを割り当てる)
+      opt_level = 1;
+    } else if (strcmp(argv[i], "-O2") == 0) {
+      // -O1 に加えて、時間のかかるIRの最適化もする
+      opt_level = 2;
+    } else if (argv[i][0] == '-' && argv[i][1] == 'f' && parse_pass_flag(argv[i])) {
+      // -f<パス名> / -fno-<パス名> でパスを個別に有効/無効にする
+    } else if (strncmp(argv[i], "--passes=", 9) == 0) {
+      // 指定したパスだけを有効にする(カンマ区切り)
+      enable_only_passes(argv[i] + 9);
+    } else if (strcmp(argv[i], "--list-passes") == 0) {
+      print_passes();
+      return 0;
+    } else if (strcmp(argv[i], "--verify-passes") == 0) {
+      // IRのパスを実行するたびにIRを検査する
+      verify_passes = true;
+    } else if (strcmp(argv[i], "--tokens") == 0) {
+      f_dump_tokens = true;
+    } else if (strcmp(argv[i], "--arena-stats") == 0) {
+      f_arena_stats = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      // アセンブリの出力先(指定がなければ標準出力)
+      output_path = argv[++i];
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      // 並列に動かすプロセス数
+      // 入力が1個ならその関数のコード生成を、複数ならファイルごとのコンパイルを並列に行う
+      jobs = strtol(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+      // 指定したUnixドメインソケットでコンパイル要求を待ち受ける
+      server_path = argv[++i];
+    } else if (strcmp(argv[i], "--prelude") == 0 && i + 1 < argc) {
+      // --server の時に最初に1回だけパースしておくファイル
+      prelude_path = argv[++i];
+    } else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+      // 自分ではコンパイルせず、--server で起動したynicc にコンパイルを依頼する
+      client_path = argv[++i];
+    } else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+      // 生成したアセンブリを入力の内容ごとにキャッシュするディレクトリ
+      cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "--cache-stats") == 0) {
+      // 終了時にキャッシュのヒット/ミスの回数を表示する
+      cache_stats = true;
+    } else if (strcmp(argv[i], "--time-report") == 0) {
+      // フェーズごとにかかった時間を表示する
+      enable_time_report();
+    } else if (strcmp(argv[i], "--mem-report") == 0) {
+      // 作ったToken, Node などの個数とバイト数を表示する
+      f_mem_report = true;
+    } else if (strcmp(argv[i], "--syntax-only") == 0) {
+      // パースまでで終了する(コード生成しない)
+      f_syntax_only = true;
+    } else if (argv[i][0] == '-' && argv[i][1]) {
+      fprintf(stderr, "不明なオプションです: %s\n", argv[i]);
+      return 1;
+    } else {
+      inputs[ninputs++] = argv[i];
+    }
+  }
+
+  if (cache_dir) {
+    cache_open(cache_dir);
+  } else if (cache_stats) {
+    fprintf(stderr, "--cache-stats には --cache-dir が必要です\n");
+    return 1;
+  }
+
+  if (server_path) {
+    if (prelude_path) {
+      load_prelude(prelude_path);
+    }
+    return run_server(server_path);
+  }
+
+  if (ninputs == 0 && cache_stats) {
+    cache_print_stats();
+    return 0;
+  }
+  if (ninputs == 0) {
+    fprintf(stderr, "引数の個数が正しくありません\n");
+    return 1;
+  }
+
+  if (client_path && ninputs == 1) {
+    return run_client(client_path, inputs[0], output_path);
+  }
+  if (client_path) {
+    int failed = 0;
+    for (int i = 0; i < ninputs; i++) {
+      if (run_client(client_path, inputs[i], asm_path(inputs[i]))) {
+        failed++;
+      }
+    }
+    return failed ? 1 : 0;
+  }
+
+  if (jobs < 1) {
+    jobs = 1;
+  }
+
+  if (ninputs == 1) {
+    compile_file(inputs[0], output_path, jobs);
+    if (cache_stats) {
+      cache_print_stats();
+    }
+    return 0;
+  }
+
+  if (output_path) {
+    fprintf(stderr, "入力ファイルが複数の場合は -o は指定できません\n");
+    return 1;
+  }
+  int failed = compile_files(inputs, ninputs, jobs);
+  if (cache_stats) {
+    cache_print_stats();
+  }
+  return failed ? 1 : 0;
+}
@@ -53,12 +53,65 @@ typedef enum {
   TK_EOF,      // 入力終了
 } TokenKind;
 
+// 記号(TK_RESERVED)の種類
+typedef enum {
+  PK_DUMMY,          // 記号ではないトークン
+  PK_ADD,            // +
+  PK_INC,            // ++
+  PK_ADD_ASSIGN,     // +=
+  PK_SUB,            // -
+  PK_DEC,            // --
+  PK_SUB_ASSIGN,     // -=
+  PK_ARROW,          // ->
+  PK_MUL,            // *
+  PK_MUL_ASSIGN,     // *=
+  PK_DIV,            // /
+  PK_DIV_ASSIGN,     // /=
+  PK_MOD,            // %
+  PK_ASSIGN,         // =
+  PK_EQ,             // ==
+  PK_NOT,            // !
+  PK_NE,             // !=
+  PK_LT,             // <
+  PK_LE,             // <=
+  PK_SHL,            // <<
+  PK_SHL_ASSIGN,     // <<=
+  PK_GT,             // >
+  PK_GE,             // >=
+  PK_SHR,            // >>
+  PK_SHR_ASSIGN,     // >>=
+  PK_BIT_AND,        // &
+  PK_LOGICAL_AND,    // &&
+  PK_AND_ASSIGN,     // &=
+  PK_BIT_OR,         // |
+  PK_LOGICAL_OR,     // ||
+  PK_OR_ASSIGN,      // |=
+  PK_BIT_XOR,        // ^
+  PK_XOR_ASSIGN,     // ^=
+  PK_BIT_NOT,        // ~
+  PK_QUESTION,       // ?
+  PK_COLON,          // :
+  PK_SEMICOLON,      // ;
+  PK_COMMA,          // ,
+  PK_DOT,            // .
+  PK_ELLIPSIS,       // ...
+  PK_LPAREN,         // (
+  PK_RPAREN,         // )
+  PK_LBRACE,         // {
+  PK_RBRACE,         // }
+  PK_LBRACKET,       // [
+  PK_RBRACKET,       // ]
+  PK_OTHER,          // 上記以外の1文字の記号(# や @ など)
+} PunctKind;
+
 struct Token {
   TokenKind kind; // トークンの型
+  PunctKind punct; // kindがTK_RESERVEDの場合、その記号の種類
   Token *next;    // 次の入力トークン
   long val;        // kindがTK_NUMの場合、その数値
   char *str;      // トークン文字列
   int len;        // str の長さ
+  char *ident;    // kindがTK_IDENTの場合、internした識別子
 
   // 文字列リテラル
   char *contents;
@@ -67,10 +120,17 @@ struct Token {
 };
 
 Token *tokenize(char *p);
-void free_tokens(Token *cur);
+Token *tokenize_stream(char *p);
+Token *next_token(Token *tok);
+void release_tokens_before(Token *tok);
 void dump_token(Token *token);
 char *token_kind_to_s(TokenKind kind);
+char *punct_kind_to_s(PunctKind kind);
 char *read_file(char *path);
+void build_line_index(char *input);
+int line_number(char *loc);
+char *line_start(char *loc);
+char *source_name(char *loc);
 
 // 現在着目しているトークン
 extern Token *token;
@@ -204,46 +264,56 @@ struct Function {
   int stack_size; //この関数のスタックサイズ
   bool is_staitc;
   bool has_vararg; // 引数に ... をとるかどうか
+  char *src; // 定義のソースの先頭
+  char *body_src; // 本体の "{" の位置
+  char *src_end; // 定義のソースの終わり(次の宣言の先頭)
+  char *cache_entry; // コード生成結果のキャッシュのパス(キャッシュしない場合はNULL)
 };
 
+// 構文木のノード
+//
+// kind〜init はすべてのノードにあり、body 以降は文や関数呼び出しなど一部の種類のノードでしか使わない。
+// ノードの大部分は式(数、変数、演算子など)なので、node_has_stmt_part が false の種類のノードは
+// body より前の部分だけを確保する(そのノードの body 以降のフィールドは読み書きしてはいけない)。
 struct Node {
   NodeKind kind;
-  Token *tok;
+  char *loc; // エラー表示用のソースの位置(トークンはパース中に使い回すので、トークンではなく位置を持つ)
   Type *ty;
+  Node *next; // ブロックや関数引数など複数Nodeになる場合の次のnode
 
   Node *lhs; // 二項演算での左辺
   Node *rhs; // 二項演算での右辺
 
+  Var *var; //ND_VAR, ND_VAR_DECLのときの変数情報
+  long val;    // kindがND_NUMの場合の値
+  Member *member; // 構造体のメンバーへのアクセス時の対象のメンバー
+
+  Node *init; // forの初期化式、compound literalのND_VARの初期化式
+
+  // ここから下は node_has_stmt_part が true の種類のノードにだけある
+
   Node *body; //while, forとかの本文
-  Node *next; // ブロックや関数引数など複数Nodeになる場合の次のnode
 
   Node *cond; // if, while, for の条件式
   Node *then; // ifの then節
   Node *els; // ifのelse節
 
-  bool is_do_while; // do_while と while 分の区別
-
-  Node *init; // forの初期化式
   Node *inc; // forの継続式
 
   Node *initializer; // 変数の初期化式
 
   Node *arg; //関数の引数
-
-  Var *var; //ND_VAR, ND_VAR_DECLのときの変数情報
-  long val;    // kindがND_NUMの場合の値
   char *funcname; // 関数名
   int funcarg_num; // 関数呼び出しの引数の数
 
-  Member *member; // 構造体のメンバーへのアクセス時の対象のメンバー
-
   char *label_name;
 
   long case_cond_val; // switch文のcaseの値
-  bool is_default_case; // ND_CASEの場合にそれがdefaultならtrue
   Node *default_case; // ND_SWITHの場合にdefault節のノード
   Node *case_next;    // caseのジャンプのコード生成用の1switch中のcaseノードのリスト
 
+  bool is_do_while; // do_while と while 分の区別
+  bool is_default_case; // ND_CASEの場合にそれがdefaultならtrue
 };
 
 struct Var {
@@ -251,6 +321,12 @@ struct Var {
   char *name; // この変数の名前
   int offset; // rbpからのオフセット
   bool is_local; // local、global変数の識別用フラグ
+  int reg; // 0以外ならローカル変数を置く callee-saved レジスタの番号+1(コード生成で決める)
+  int usage_index; // 0以外ならレジスタに置くかを決める時の使われ方の表の番号+1(コード生成で決める)
+  int ir_index; // 0以外ならIRでSSAの値として扱う変数の番号+1(IRを作る時に決める)
+  int nassigns; // 代入の回数(アドレスを取られていたら2以上にする。定数の伝播で数える)
+  bool is_const; // 初期化式の定数 const_val をこの変数の値として使える(定数の伝播で決める)
+  long const_val;
 
   // グローバル変数の初期化式(文字列リテラル用の変数も含む)
   Initializer *initializer;
@@ -282,10 +358,224 @@ void free_program(Program *function);
 char *node_kind_to_s(Node *nd);
 char *my_strndup(char *str, int len);
 Node *new_var_node(Var *var, Token *tk);
+bool node_has_stmt_part(NodeKind kind);
 Program *program();
 
+// ynicc.c
+void load_prelude(char *path);
+void compile_file(char *path, char *output_path, int jobs);
+
+// cache.c
+void cache_open(char *dir);
+bool cache_is_open(void);
+char *cache_entry(char *input, char *prelude_input);
+bool cache_emit(char *entry);
+bool cache_output(char *entry, char *output_path);
+bool cache_fetch(char *entry, char *output_path);
+void cache_assign_functions(Program *pgm, char *input, char *prelude_input);
+bool cache_fetch_function(char *entry);
+char *cache_temp_path(char *entry);
+void cache_store(char *temp_path, char *entry);
+void cache_print_stats(void);
+
+// report.c
+typedef enum {
+  PHASE_READ_FILE,
+  PHASE_TOKENIZE,
+  PHASE_PARSE,
+  PHASE_ADD_TYPE,
+  PHASE_CODEGEN,
+  PHASE_NUM,
+} Phase;
+
+typedef enum {
+  MEM_TOKEN,
+  MEM_NODE,
+  MEM_TYPE,
+  MEM_VAR,
+  MEM_INITIALIZER,
+  MEM_NUM,
+} MemKind;
+
+void enable_time_report(void);
+bool time_report_enabled(void);
+void phase_begin(Phase phase);
+void phase_end(Phase phase);
+void write_worker_usage(FILE *fp);
+void add_worker_usage(FILE *fp, Phase phase);
+void print_time_report(void);
+void mem_count(MemKind kind, long size);
+void print_mem_report(void);
+
+// server.c
+int run_server(char *socket_path);
+int run_client(char *socket_path, char *path, char *output_path);
+
 // codegen.c
-void codegen(Program *prg);
+// 最適化のレベル(0ならASTから直接コード生成する)
+extern int opt_level;
+
+void codegen(Program *prg, int jobs);
+
+// ir.c
+typedef struct IrValue IrValue;
+typedef struct IrBlock IrBlock;
+typedef struct IrFunc IrFunc;
+
+typedef enum {
+  IR_CONST,    // 整数定数(val)
+  IR_PARAM,    // val 番目の引数
+  IR_LOCAL,    // スタックに置くローカル変数 var のアドレス
+  IR_GLOBAL,   // グローバル変数 name のアドレス
+  IR_LOAD,     // args[0] のアドレスから size バイト読んで符号拡張する
+  IR_STORE,    // args[0] のアドレスに args[1] の下位 size バイトを書く(値はない)
+  IR_ADD,
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_MOD,
+  IR_AND,
+  IR_OR,
+  IR_XOR,
+  IR_SHL,
+  IR_SAR,
+  IR_EQ,
+  IR_NE,
+  IR_LT,
+  IR_LE,
+  IR_NOT,      // ビット反転
+  IR_EXT,      // args[0] の下位 size バイトを符号拡張する(is_bool なら0か1にする)
+  IR_CALL,     // 関数 name を args を引数にして呼ぶ
+  IR_PHI,      // 前のブロック preds[i] から来た時は args[i] になる
+  IR_JMP,      // target に飛ぶ
+  IR_BR,       // args[0] が0以外なら target に、0なら els に飛ぶ
+  IR_RET,      // args[0] (なければ不定)を返す
+} IrOp;
+
+// IRの命令(SSAの値)
+struct IrValue {
+  IrOp op;
+  int id;
+  IrBlock *block; // 属しているブロック(消された命令はNULL)
+  IrValue *prev;
+  IrValue *next;
+  IrValue **args;
+  int nargs;
+  int args_cap;
+
+  long val;        // IR_CONST の値、IR_PARAM の番号
+  int size;        // IR_LOAD, IR_STORE, IR_EXT のバイト数
+  bool is_bool;    // IR_EXT で _Bool に変換する、IR_CALL の戻り値が _Bool
+  Var *var;        // IR_LOCAL の変数、IR_PHI の元になった変数(なければNULL)
+  char *name;      // IR_GLOBAL の変数名、IR_CALL の関数名
+  IrBlock *target; // IR_JMP の飛び先、IR_BR の0以外の時の飛び先
+  IrBlock *els;    // IR_BR の0の時の飛び先
+
+  bool incomplete; // 封印されていないブロックで作ったphi(まだ引数がない)
+  IrValue *replaced; // 自明なphiを消した時の置き換え先
+
+  // 以下はコード生成で使う
+  int uses;   // この値を引数にしている命令の数
+  bool fused; // 直後の命令と合わせてコードを出す値(IR_BR の条件の比較、IR_LOAD, IR_STORE のアドレスの加算)
+  int pos;    // 命令の位置
+  int start;  // 生存区間
+  int end;
+  int reg;    // 割り当てたレジスタ(0ならなし)
+  int offset; // スタックに置く場合の rbp からのオフセット(0ならなし)
+  IrValue *interval_next;
+};
+
+// 基本ブロック
+struct IrBlock {
+  int id;
+  IrValue *first;
+  IrValue *last;
+  IrBlock **preds;
+  int npreds;
+  int preds_cap;
+  IrBlock *next; // 関数の中の次のブロック
+  bool sealed;   // これ以上 preds が増えない
+  IrValue **defs; // SSAを作っている間の、このブロックの終わりでの各変数の値
+
+  // 以下は解析やコード生成で使う
+  int rpo;      // 逆後順の番号(-1なら入口から到達できない)
+  IrBlock *idom;
+  IrBlock *dom_child;   // 支配木の最初の子
+  IrBlock *dom_sibling; // 支配木の次の兄弟
+  int dom_pre;  // 支配木を深さ優先でたどった時の行きがけと帰りがけの番号
+  int dom_post;
+  int live_mark; // 生存解析で、入口で生きている印を付けた値の id+1
+  int start;
+  int end;
+  IrBlock *layout_next;
+};
+
+struct IrFunc {
+  Function *func;
+  IrBlock *entry;
+  IrBlock *blocks;
+  IrBlock *last_block;
+  int nblocks;
+  int nvalues;
+  Var **vars; // SSAの値として扱う変数
+  int nvars;
+  IrValue *undef; // 初期化されていない変数の値
+  IrBlock **rpo;  // 入口から到達できるブロックを逆後順に並べたもの
+  int nrpo;
+};
+
+bool ir_supported(Function *func);
+IrFunc *ir_lower(Function *func);
+void ir_compute_rpo(IrFunc *fn);
+void ir_compute_dominators(IrFunc *fn);
+bool ir_dominates(IrBlock *a, IrBlock *b);
+void ir_verify(IrFunc *fn);
+void ir_print(IrFunc *fn);
+bool ir_is_terminator(IrValue *v);
+bool ir_has_value(IrValue *v);
+int ir_successors(IrBlock *bb, IrBlock **succs);
+IrBlock *ir_new_block(IrFunc *fn);
+IrValue *ir_new_value(IrFunc *fn, IrOp op);
+void ir_append(IrBlock *bb, IrValue *v);
+void ir_insert_before(IrValue *pos, IrValue *v);
+void ir_remove(IrValue *v);
+void ir_add_arg(IrFunc *fn, IrValue *v, IrValue *arg);
+
+// ir_opt.c
+void ir_dce(IrFunc *fn);
+void ir_cse(IrFunc *fn);
+
+// fold.c
+void fold_function(Function *func);
+
+// pass.c
+typedef enum {
+  PASS_FOLD,     // 定数畳み込みと定数の伝播
+  PASS_REGVAR,   // ASTからのコード生成でローカル変数をレジスタに置く
+  PASS_CSE,      // 共通部分式の削除
+  PASS_DCE,      // 使われない値の削除
+  PASS_FUSE,     // 比較と分岐などをまとめてコードを出す
+  PASS_REGALLOC, // SSAの値へのレジスタ割り当て
+  PASS_NUM,
+} PassId;
+
+extern bool verify_passes;
+
+bool pass_enabled(PassId pass);
+bool parse_pass_flag(char *arg);
+void enable_only_passes(char *names);
+void print_passes(void);
+void pass_begin(PassId pass);
+void pass_end(PassId pass);
+void run_ast_passes(Function *func);
+void run_ir_passes(IrFunc *fn);
+void reset_pass_stats(void);
+void write_pass_stats(FILE *fp);
+void add_pass_stats(FILE *fp);
+void print_pass_report(void);
+
+// ir_codegen.c
+void ir_codegen_func(Function *func);
 
 // debug.c
 
@@ -296,6 +586,44 @@ void dump_globals(VarList *vars);
 void dump_tokens(Token *t);
 char *type_info(Type *type);
 
+// arena.c
+typedef enum {
+  ARENA_TOKEN,   // Token(tokenize〜programの間だけ使う)
+  ARENA_AST,     // Node, Var, Initializer などprogramで作る構文木
+  ARENA_TYPE,    // Type, Member
+  ARENA_CODEGEN, // コード生成中の一時的な領域
+  ARENA_IDENT,   // internした識別子(プロセスが終わるまで解放しない)
+  ARENA_NUM,
+} ArenaKind;
+
+void *arena_alloc(ArenaKind kind, long size);
+void arena_release(ArenaKind kind);
+void arena_reset(ArenaKind kind);
+void arena_dump_stats(void);
+
+// emit.c
+void emit_open(char *path);
+void emit_redirect(int fd);
+long emit_size(void);
+void emit_copy(int fd, long len);
+void emit_flush(void);
+void emit_switch(int fd);
+void emit_restore(void);
+void emit_close(void);
+void emit(char *s);
+void emit_num(long val);
+void emitln(char *s);
+void emitln_num(char *prefix, long val);
+void emitln_str(char *prefix, char *s);
+void emitfln(char *fmt, ...);
+
+// intern.c
+char *intern(char *str, int len);
+void init_intern(void);
+
+// 組込み関数 __builtin_va_start の名前(intern済み)
+extern char *builtin_va_start_name;
+
 // string_buffer.c
 typedef struct string_buffer string_buffer;
 